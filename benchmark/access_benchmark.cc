@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/embag.h"
+#include "lib/field_index.h"
+#include "lib/field_path.h"
+#include "lib/view.h"
+
+// Times looking up fields of already parsed messages from a bag, test/test.bag by default:
+//   bazel run //benchmark:access_benchmark -- /path/to/file.bag [iterations]
+int main(int argc, char *argv[]) {
+  const std::string filename = argc > 1 ? argv[1] : "test/test.bag";
+  const size_t iterations = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+  const auto bag = std::make_shared<Embag::Bag>(filename);
+  Embag::View view{bag};
+
+  std::shared_ptr<Embag::RosMessage> odometry;
+  std::shared_ptr<Embag::RosMessage> scan;
+  for (const auto &message : view.getMessages({"/base_pose_ground_truth", "/base_scan"})) {
+    if (message->topic == "/base_pose_ground_truth" && !odometry) {
+      odometry = message;
+    } else if (message->topic == "/base_scan" && !scan) {
+      scan = message;
+    }
+  }
+
+  const auto &odometry_data = odometry->data();
+  const auto &scan_data = scan->data();
+  const Embag::FieldPath x{*bag->msgDefForTopic("/base_pose_ground_truth"), "pose.pose.position.x"};
+  const Embag::FieldPath range{*bag->msgDefForTopic("/base_scan"), "ranges[3]"};
+
+  Benchmark::report("pose.pose.position.x", "Pointer", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(odometry_data["pose"]["pose"]["position"]["x"]->as<double>());
+  }, iterations));
+
+  Benchmark::report("pose.pose.position.x", "Ref", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(odometry_data.borrow()["pose"]["pose"]["position"]["x"]->as<double>());
+  }, iterations));
+
+  const Embag::Symbol pose{"pose"};
+  const Embag::Symbol position{"position"};
+  const Embag::Symbol x_symbol{"x"};
+  Benchmark::report("pose.pose.position.x", "Ref with Symbols", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(odometry_data.borrow()[pose][pose][position][x_symbol]->as<double>());
+  }, iterations));
+
+  Benchmark::report("pose.pose.position.x", "FieldPath", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(x.resolve(odometry_data)->as<double>());
+  }, iterations));
+
+  Benchmark::report("pose.pose.position.x", "FieldPath on raw message", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(x.get<double>(*odometry));
+  }, iterations));
+
+  // Every field name of nav_msgs/Odometry and the types embedded in it, looked up in the field index of its type
+  std::vector<std::pair<const Embag::FieldIndex *, std::string>> names;
+  std::vector<std::pair<const Embag::FieldIndex *, Embag::Symbol>> symbols;
+  std::unordered_map<const Embag::FieldIndex *, std::unordered_map<std::string, size_t>> maps;
+  std::vector<const Embag::ParseProgram *> programs{&bag->msgDefForTopic("/base_pose_ground_truth")->program()};
+  for (size_t p = 0; p < programs.size(); ++p) {
+    const auto &field_index = *programs[p]->field_indexes;
+    for (const auto &field : field_index) {
+      names.emplace_back(&field_index, field.first);
+      symbols.emplace_back(&field_index, field_index.symbol(field.second));
+      maps[&field_index].emplace(field.first, field.second);
+
+      const auto embedded = programs[p]->fields[field.second].program;
+      if (embedded != nullptr && std::find(programs.begin(), programs.end(), embedded) == programs.end()) {
+        programs.push_back(embedded);
+      }
+    }
+  }
+
+  std::vector<std::pair<const std::unordered_map<std::string, size_t> *, std::string>> map_names;
+  for (const auto &name : names) {
+    map_names.emplace_back(&maps.at(name.first), name.second);
+  }
+
+  const std::string lookups = "nav_msgs/Odometry names (" + std::to_string(names.size()) + ")";
+  Benchmark::report(lookups, "unordered_map", Benchmark::nanosecondsPerCall([&]() {
+    for (const auto &name : map_names) {
+      Benchmark::doNotOptimize(name.first->find(name.second)->second);
+    }
+  }, iterations / 10));
+
+  Benchmark::report(lookups, "FieldIndex by name", Benchmark::nanosecondsPerCall([&]() {
+    for (const auto &name : names) {
+      Benchmark::doNotOptimize(name.first->find(name.second));
+    }
+  }, iterations / 10));
+
+  Benchmark::report(lookups, "FieldIndex by Symbol", Benchmark::nanosecondsPerCall([&]() {
+    for (const auto &symbol : symbols) {
+      Benchmark::doNotOptimize(symbol.first->find(symbol.second));
+    }
+  }, iterations / 10));
+
+  Benchmark::report("ranges[3]", "Pointer", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(scan_data["ranges"][3]->as<float>());
+  }, iterations));
+
+  Benchmark::report("ranges[3]", "Ref", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(scan_data.borrow()["ranges"][3]->as<float>());
+  }, iterations));
+
+  Benchmark::report("ranges[3]", "FieldPath", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(range.resolve(scan_data)->as<float>());
+  }, iterations));
+
+  Benchmark::report("ranges[3]", "FieldPath on raw message", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(range.get<float>(*scan));
+  }, iterations));
+
+  return 0;
+}
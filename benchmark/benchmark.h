@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace Benchmark {
+
+// Keeps the compiler from optimizing away the work being measured
+template<typename T>
+void doNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs the function the given number of times after a short warm up, and returns the mean time per call
+template<typename Function>
+double nanosecondsPerCall(Function function, size_t iterations) {
+  for (size_t i = 0; i < iterations / 10 + 1; ++i) {
+    function();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    function();
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+inline void report(const std::string &name, const std::string &case_name, double nanoseconds) {
+  std::cout << std::left << std::setw(44) << name << std::setw(36) << case_name
+            << std::right << std::fixed << std::setprecision(1) << std::setw(14) << nanoseconds << " ns" << std::endl;
+}
+
+}
@@ -0,0 +1,40 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/embag.h"
+#include "lib/field_path.h"
+#include "lib/view.h"
+
+// Times extracting a field of every message of a topic as a column, from test/test.bag by default:
+//   bazel run //benchmark:columns_benchmark -- /path/to/file.bag [topic] [field path] [iterations]
+int main(int argc, char *argv[]) {
+  const std::string filename = argc > 1 ? argv[1] : "test/test.bag";
+  const std::string topic = argc > 2 ? argv[2] : "/base_pose_ground_truth";
+  const std::string path = argc > 3 ? argv[3] : "twist.twist.linear.x";
+  const size_t iterations = argc > 4 ? std::stoul(argv[4]) : 20;
+
+  const auto bag = std::make_shared<Embag::Bag>(filename);
+  Embag::View view{bag};
+  const std::string &name = topic;
+  const Embag::FieldPath field_path{*bag->msgDefForTopic(topic), path};
+
+  Benchmark::report(name, "iterate and parse", Benchmark::nanosecondsPerCall([&]() {
+    std::vector<Embag::RosValue::ros_time_t> timestamps;
+    std::vector<double> values;
+    for (const auto &message : view.getMessages(topic)) {
+      timestamps.push_back(message->timestamp);
+      values.push_back(field_path.resolve(message->data())->as<double>());
+    }
+    Benchmark::doNotOptimize(values.data());
+  }, iterations));
+
+  for (const size_t threads : {1, 4}) {
+    Benchmark::report(name, "readColumns, " + std::to_string(threads) + " threads", Benchmark::nanosecondsPerCall([&]() {
+      Benchmark::doNotOptimize(view.readColumns(topic, {path}, threads).columns[0].bytes.data());
+    }, iterations));
+  }
+
+  return 0;
+}
@@ -0,0 +1,41 @@
+import sys
+import timeit
+
+import python.libembag as embag
+
+
+# Times reading every message of each topic and converting it to a dict, from test/test.bag by default:
+#   bazel run //benchmark:dict_benchmark -- /path/to/file.bag [repeats]
+def report(name, case_name, nanoseconds):
+    print('%-44s%-36s%14.1f ns' % (name, case_name, nanoseconds))
+
+
+def main():
+    filename = sys.argv[1] if len(sys.argv) > 1 else 'test/test.bag'
+    repeats = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+    bag = embag.Bag(filename)
+    for topic in sorted(bag.topics()):
+        message_count = sum(1 for _ in embag.View(bag).getMessages(topic))
+        name = '%s (%d messages)' % (topic, message_count)
+
+        def read_only():
+            for message in embag.View(bag).getMessages(topic):
+                pass
+
+        # The previous path: parse into RosValues, then convert them value by value
+        def parsed():
+            for message in embag.View(bag).getMessages(topic):
+                message.data().dict()
+
+        def planned():
+            for message in embag.View(bag).getMessages(topic):
+                message.dict()
+
+        for case_name, function in [('read only', read_only), ('RosValue.dict()', parsed), ('RosMessage.dict()', planned)]:
+            seconds = min(timeit.repeat(function, number=1, repeat=repeats))
+            report(name, case_name, seconds * 1e9 / message_count)
+
+
+if __name__ == '__main__':
+    main()
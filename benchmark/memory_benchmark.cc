@@ -0,0 +1,131 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/embag.h"
+#include "lib/message_parser.h"
+#include "lib/view.h"
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define EMBAG_HAVE_MALLINFO2
+#endif
+
+// Counts every heap allocation made by the process
+namespace {
+std::atomic<size_t> allocation_count{0};
+std::atomic<size_t> allocated_bytes{0};
+
+// The heap memory in use, malloc's overhead included.  Unlike resident memory, it doesn't depend on whether freed
+// pages are reused or returned to the system.  Without mallinfo2, resident memory is the closest measure.
+int64_t heldBytes() {
+#ifdef EMBAG_HAVE_MALLINFO2
+  const auto info = mallinfo2();
+  return static_cast<int64_t>(info.uordblks + info.hblkhd);
+#else
+  std::ifstream statm{"/proc/self/statm"};
+  int64_t total_pages = 0;
+  int64_t resident_pages = 0;
+  statm >> total_pages >> resident_pages;
+  return resident_pages * sysconf(_SC_PAGESIZE);
+#endif
+}
+}
+
+// Once the replacements below are inlined, GCC sees std::free called on memory from operator new and warns, although
+// every operator new it can be paired with here is one of the replacements, which allocate with std::malloc
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size) {
+  allocation_count++;
+  allocated_bytes += size;
+  void *pointer = std::malloc(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// Reports the heap allocations made while parsing a message of each topic in a bag, test/test.bag by default,
+// and how much heap memory the parsed messages hold on to:
+//   bazel run //benchmark:memory_benchmark -- /path/to/file.bag [messages]
+int main(int argc, char *argv[]) {
+  const std::string filename = argc > 1 ? argv[1] : "test/test.bag";
+  const size_t message_count = argc > 2 ? std::stoul(argv[2]) : 1000;
+
+  const auto bag = std::make_shared<Embag::Bag>(filename);
+  Embag::View view{bag};
+
+  std::map<std::string, std::shared_ptr<Embag::RosMessage>> samples;
+  for (const auto &message : view.getMessages()) {
+    if (samples.count(message->topic) == 0) {
+      samples.emplace(message->topic, message);
+    }
+  }
+
+  std::cout << std::left << std::setw(44) << "message" << std::right
+            << std::setw(16) << "allocations" << std::setw(16) << "heap bytes" << std::setw(16) << "held bytes"
+            << std::endl;
+
+  for (const auto &sample : samples) {
+    const auto &message = sample.second;
+    const auto msg_def = bag->msgDefForTopic(message->topic);
+
+    std::vector<Embag::RosValue::Pointer> parsed;
+    parsed.reserve(message_count);
+
+    const int64_t held_before = heldBytes();
+    const size_t allocations_before = allocation_count;
+    const size_t bytes_before = allocated_bytes;
+    for (size_t i = 0; i < message_count; ++i) {
+      Embag::MessageParser parser{message->raw_buffer, message->raw_buffer_offset, *msg_def};
+      parsed.push_back(parser.parse());
+    }
+
+    std::cout << std::left << std::setw(44) << msg_def->name() + " (" + std::to_string(message->raw_data_len) + " bytes)"
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(16) << double(allocation_count - allocations_before) / message_count
+              << std::setw(16) << double(allocated_bytes - bytes_before) / message_count
+              << std::setw(16) << double(heldBytes() - held_before) / message_count
+              << std::endl;
+  }
+
+  return 0;
+}
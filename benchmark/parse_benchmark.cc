@@ -0,0 +1,67 @@
+#include <map>
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "lib/embag.h"
+#include "lib/message_parser.h"
+#include "lib/view.h"
+
+// Times parsing the first message of each topic in a bag, test/test.bag by default:
+//   bazel run //benchmark:parse_benchmark -- /path/to/file.bag [iterations]
+int main(int argc, char *argv[]) {
+  const std::string filename = argc > 1 ? argv[1] : "test/test.bag";
+  const size_t iterations = argc > 2 ? std::stoul(argv[2]) : 1000;
+
+  const auto bag = std::make_shared<Embag::Bag>(filename);
+  Embag::View view{bag};
+
+  std::map<std::string, std::shared_ptr<Embag::RosMessage>> samples;
+  for (const auto &message : view.getMessages()) {
+    if (samples.count(message->topic) == 0) {
+      samples.emplace(message->topic, message);
+    }
+  }
+
+  for (const auto &sample : samples) {
+    const auto &message = sample.second;
+    const auto msg_def = bag->msgDefForTopic(message->topic);
+    const std::string name = msg_def->name() + " (" + std::to_string(message->raw_data_len) + " bytes)";
+
+    Benchmark::report(name, "parse", Benchmark::nanosecondsPerCall([&]() {
+      Embag::MessageParser parser{message->raw_buffer, message->raw_buffer_offset, *msg_def};
+      Benchmark::doNotOptimize(parser.parse());
+    }, iterations));
+
+    Benchmark::report(name, "parse, read header.stamp", Benchmark::nanosecondsPerCall([&]() {
+      Embag::MessageParser parser{message->raw_buffer, message->raw_buffer_offset, *msg_def};
+      Benchmark::doNotOptimize(parser.parse()["header"]["stamp"]->as<Embag::RosValue::ros_time_t>());
+    }, iterations));
+
+    const auto header_program = msg_def->program().project({"header"});
+    Benchmark::report(name, "projected, read header.stamp", Benchmark::nanosecondsPerCall([&]() {
+      Embag::MessageParser parser{message->raw_buffer, message->raw_buffer_offset, header_program};
+      Benchmark::doNotOptimize(parser.parse()["header"]["stamp"]->as<Embag::RosValue::ros_time_t>());
+    }, iterations));
+
+    Benchmark::report(name, "lazy, read header.stamp", Benchmark::nanosecondsPerCall([&]() {
+      Embag::RosMessage lazy_message{
+        message->topic,
+        message->timestamp,
+        message->md5,
+        message->raw_buffer,
+        message->raw_buffer_offset,
+        message->raw_data_len,
+        msg_def,
+      };
+      Benchmark::doNotOptimize(lazy_message.lazyData()["header"]["stamp"].as<Embag::RosValue::ros_time_t>());
+    }, iterations));
+
+    const auto stamp = msg_def->program().constantField("header.stamp");
+    Benchmark::report(name, "constant offset, read header.stamp", Benchmark::nanosecondsPerCall([&]() {
+      Benchmark::doNotOptimize(message->getConstant<Embag::RosValue::ros_time_t>(stamp));
+    }, iterations));
+  }
+
+  return 0;
+}
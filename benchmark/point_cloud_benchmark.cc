@@ -0,0 +1,57 @@
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "lib/embag.h"
+#include "lib/point_cloud.h"
+#include "lib/view.h"
+
+// Times splitting the first point cloud of a topic into per-field arrays, from test/test.bag by default:
+//   bazel run //benchmark:point_cloud_benchmark -- /path/to/file.bag [topic] [iterations]
+int main(int argc, char *argv[]) {
+  const std::string filename = argc > 1 ? argv[1] : "test/test.bag";
+  const std::string topic = argc > 2 ? argv[2] : "/luminar_pointcloud";
+  const size_t iterations = argc > 3 ? std::stoul(argv[3]) : 100;
+
+  Embag::View view{filename};
+  std::shared_ptr<Embag::RosMessage> message;
+  for (const auto &m : view.getMessages(topic)) {
+    message = m;
+    break;
+  }
+
+  const auto &data = message->data();
+  const std::string name = topic + " (" + std::to_string(data["width"]->as<uint32_t>() * data["height"]->as<uint32_t>()) + " points)";
+
+  Benchmark::report(name, "element by element", Benchmark::nanosecondsPerCall([&]() {
+    const auto points = data.borrow()["data"];
+    const size_t point_step = data["point_step"]->as<uint32_t>();
+    std::vector<float> x(points->size() / point_step);
+    for (size_t i = 0; i < x.size(); ++i) {
+      uint8_t bytes[sizeof(float)];
+      for (size_t b = 0; b < sizeof(float); ++b) {
+        bytes[b] = points[i * point_step + b]->as<uint8_t>();
+      }
+      std::memcpy(&x[i], bytes, sizeof(float));
+    }
+    Benchmark::doNotOptimize(x.data());
+  }, iterations));
+
+  Embag::PointCloud::options_t xyz;
+  xyz.fields = {"x", "y", "z"};
+  Benchmark::report(name, "decode x, y, z", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(Embag::PointCloud::decode(data, xyz).size());
+  }, iterations));
+
+  xyz.skip_nans = true;
+  xyz.type = Embag::RosValue::Type::float64;
+  Benchmark::report(name, "decode x, y, z without NaNs as float64", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(Embag::PointCloud::decode(data, xyz).size());
+  }, iterations));
+
+  Benchmark::report(name, "decode all fields", Benchmark::nanosecondsPerCall([&]() {
+    Benchmark::doNotOptimize(Embag::PointCloud::decode(data).size());
+  }, iterations));
+
+  return 0;
+}
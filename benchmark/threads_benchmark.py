@@ -0,0 +1,55 @@
+import sys
+import threading
+import time
+
+import python.libembag as embag
+
+
+# Times reading bags one after the other against reading them from one Python thread each.  Decompression and parsing
+# release the GIL, so the threads only contend while running Python code:
+#   bazel run //benchmark:threads_benchmark -- /path/to/1.bag /path/to/2.bag /path/to/3.bag /path/to/4.bag
+def report(name, case_name, seconds, message_count):
+    print('%-44s%-36s%10.1f ms%14.1f ns/message' % (name, case_name, seconds * 1e3, seconds * 1e9 / message_count))
+
+
+def read_only(filename):
+    for message in embag.View(filename).getMessages():
+        pass
+
+
+def parsed(filename):
+    for message in embag.View(filename).getMessages():
+        message.data()
+
+
+def sequential(function, filenames):
+    for filename in filenames:
+        function(filename)
+
+
+def threaded(function, filenames):
+    threads = [threading.Thread(target=function, args=(filename,)) for filename in filenames]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+
+def main():
+    filenames = sys.argv[1:] or ['test/test.bag'] * 4
+    repeats = 5
+
+    message_count = sum(sum(1 for _ in embag.View(filename).getMessages()) for filename in filenames)
+    name = '%d bags (%d messages)' % (len(filenames), message_count)
+    for function_name, function in [('read only', read_only), ('data()', parsed)]:
+        for case_name, run in [('sequential', sequential), ('%d threads' % len(filenames), threaded)]:
+            seconds = []
+            for _ in range(repeats):
+                start = time.time()
+                run(function, filenames)
+                seconds.append(time.time() - start)
+            report(name, '%s, %s' % (function_name, case_name), min(seconds), message_count)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,501 @@
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "arrow.h"
+
+namespace Embag {
+
+struct ArrowBatches::column_t {
+  enum class Kind {
+    // Fixed size values, copied as they are
+    primitive,
+    // Bit packed
+    boolean,
+    // Times and durations, converted to int64 nanoseconds
+    time,
+    // Strings and variable length uint8 arrays: offsets and bytes
+    binary,
+    // Fixed length uint8 arrays
+    fixed_binary,
+    structure,
+    list,
+    fixed_list,
+  };
+
+  std::string name;
+  std::string format;
+  Kind kind;
+  // Size of a single value, for primitives
+  size_t value_size;
+  // Length of fixed length arrays
+  size_t list_size;
+  // The fields of structs and the elements of lists
+  std::vector<column_t> children;
+
+  // Fills in a new schema of the column, which the caller must release
+  void exportTo(ArrowSchema *schema) const;
+
+  static column_t value(const std::string &name, RosValue::Type type) {
+    column_t column{name, "", Kind::primitive, 0, 0, {}};
+    switch (type) {
+      case RosValue::Type::ros_bool: column.format = "b"; column.kind = Kind::boolean; break;
+      case RosValue::Type::int8: column.format = "c"; break;
+      case RosValue::Type::uint8: column.format = "C"; break;
+      case RosValue::Type::int16: column.format = "s"; break;
+      case RosValue::Type::uint16: column.format = "S"; break;
+      case RosValue::Type::int32: column.format = "i"; break;
+      case RosValue::Type::uint32: column.format = "I"; break;
+      case RosValue::Type::int64: column.format = "l"; break;
+      case RosValue::Type::uint64: column.format = "L"; break;
+      case RosValue::Type::float32: column.format = "f"; break;
+      case RosValue::Type::float64: column.format = "g"; break;
+      case RosValue::Type::ros_time: column.format = "tsn:"; column.kind = Kind::time; break;
+      case RosValue::Type::ros_duration: column.format = "tDn"; column.kind = Kind::time; break;
+      case RosValue::Type::string: column.format = "u"; column.kind = Kind::binary; break;
+      default:
+        throw std::runtime_error("Field " + name + " has no Arrow type");
+    }
+
+    if (column.kind != Kind::binary) {
+      column.value_size = RosValue::primitiveTypeToSize(type);
+    }
+
+    return column;
+  }
+
+  static column_t structure(const std::string &name, const ParseProgram &program) {
+    column_t column{name, "+s", Kind::structure, 0, 0, {}};
+    for (size_t i = 0; i < program.fields.size(); ++i) {
+      column.children.push_back(field(program.field_indexes->name(i), program.fields[i]));
+    }
+
+    return column;
+  }
+
+  static column_t field(const std::string &name, const ParseProgram::instruction_t &instruction) {
+    using Opcode = ParseProgram::Opcode;
+
+    switch (instruction.opcode) {
+      case Opcode::primitive:
+        return value(name, instruction.type);
+      case Opcode::string:
+        return value(name, RosValue::Type::string);
+      case Opcode::object:
+        return structure(name, *instruction.program);
+      default:
+        break;
+    }
+
+    const bool fixed_length = instruction.array_size != -1;
+    const auto list_size = static_cast<size_t>(instruction.array_size);
+    if (instruction.opcode == Opcode::primitive_array && instruction.type == RosValue::Type::uint8) {
+      if (fixed_length) {
+        return column_t{name, "w:" + std::to_string(list_size), Kind::fixed_binary, 0, list_size, {}};
+      }
+
+      return column_t{name, "z", Kind::binary, 0, 0, {}};
+    }
+
+    column_t column{name, "+l", Kind::list, 0, 0, {}};
+    if (fixed_length) {
+      column.format = "+w:" + std::to_string(list_size);
+      column.kind = Kind::fixed_list;
+      column.list_size = list_size;
+    }
+
+    if (instruction.opcode == Opcode::object_array) {
+      column.children.push_back(structure("item", *instruction.program));
+    } else {
+      column.children.push_back(value("item", instruction.opcode == Opcode::string_array ? RosValue::Type::string : instruction.type));
+    }
+
+    return column;
+  }
+};
+
+namespace {
+
+void checkFits(size_t offset, size_t size, size_t length) {
+  if (offset + size > length) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+}
+
+int64_t nanoseconds(const char *data) {
+  uint32_t secs, nsecs;
+  std::memcpy(&secs, data, sizeof(secs));
+  std::memcpy(&nsecs, data + sizeof(secs), sizeof(nsecs));
+  return RosValue::ros_time_t{secs, nsecs}.to_nsec();
+}
+
+// What an exported array or schema owns.  Children are released along with their parent.
+struct array_data_t {
+  std::vector<std::vector<char>> buffers;
+  std::vector<const void *> buffer_pointers;
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray *> child_pointers;
+};
+
+// What an array read from a stream owns: a reference to the batch it shares the buffers of
+struct shared_array_data_t {
+  std::shared_ptr<const void> owner;
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray *> child_pointers;
+};
+
+struct schema_data_t {
+  std::string format;
+  std::string name;
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema *> child_pointers;
+};
+
+template<typename Data>
+void releaseArray(ArrowArray *array) {
+  auto *data = static_cast<Data *>(array->private_data);
+  for (auto &child : data->children) {
+    if (child.release != nullptr) {
+      child.release(&child);
+    }
+  }
+
+  delete data;
+  array->release = nullptr;
+}
+
+// Exports source without copying its buffers, which owner keeps alive
+void exportShared(const ArrowArray &source, const std::shared_ptr<const void> &owner, ArrowArray *array) {
+  auto *data = new shared_array_data_t{owner, {}, {}};
+  data->children.resize(static_cast<size_t>(source.n_children));
+  for (size_t i = 0; i < data->children.size(); ++i) {
+    exportShared(*source.children[i], owner, &data->children[i]);
+    data->child_pointers.push_back(&data->children[i]);
+  }
+
+  *array = source;
+  array->children = data->child_pointers.empty() ? nullptr : data->child_pointers.data();
+  array->release = releaseArray<shared_array_data_t>;
+  array->private_data = data;
+}
+
+void releaseSchema(ArrowSchema *schema) {
+  auto *data = static_cast<schema_data_t *>(schema->private_data);
+  for (auto &child : data->children) {
+    if (child.release != nullptr) {
+      child.release(&child);
+    }
+  }
+
+  delete data;
+  schema->release = nullptr;
+}
+
+}
+
+void ArrowBatches::column_t::exportTo(ArrowSchema *schema) const {
+  auto *data = new schema_data_t{format, name, {}, {}};
+  data->children.resize(children.size());
+  for (size_t i = 0; i < children.size(); ++i) {
+    children[i].exportTo(&data->children[i]);
+    data->child_pointers.push_back(&data->children[i]);
+  }
+
+  schema->format = data->format.c_str();
+  schema->name = data->name.c_str();
+  schema->metadata = nullptr;
+  schema->flags = 0;
+  schema->n_children = static_cast<int64_t>(data->children.size());
+  schema->children = data->child_pointers.empty() ? nullptr : data->child_pointers.data();
+  schema->dictionary = nullptr;
+  schema->release = releaseSchema;
+  schema->private_data = data;
+}
+
+struct ArrowBatches::builder_t {
+  typedef column_t::Kind Kind;
+
+  const column_t &column;
+  size_t length = 0;
+  // The values, bits or bytes of the column
+  std::vector<char> values;
+  // For binary and list columns
+  std::vector<int32_t> offsets;
+  std::vector<builder_t> children;
+
+  explicit builder_t(const column_t &column)
+    : column(column)
+  {
+    if (column.kind == Kind::binary || column.kind == Kind::list) {
+      offsets.push_back(0);
+    }
+
+    children.reserve(column.children.size());
+    for (const auto &child : column.children) {
+      children.emplace_back(child);
+    }
+  }
+
+  // Appends count consecutive primitive, boolean or time values
+  void appendValues(const char *data, size_t count) {
+    switch (column.kind) {
+      case Kind::boolean:
+        values.resize((length + count + 7) / 8, 0);
+        for (size_t i = 0; i < count; ++i) {
+          if (data[i] != 0) {
+            values[(length + i) / 8] |= static_cast<char>(1 << ((length + i) % 8));
+          }
+        }
+        break;
+      case Kind::time:
+        for (size_t i = 0; i < count; ++i) {
+          appendTime(nanoseconds(data + i * column.value_size));
+        }
+        return;
+      default:
+        values.insert(values.end(), data, data + count * column.value_size);
+        break;
+    }
+
+    length += count;
+  }
+
+  void appendTime(int64_t nanoseconds) {
+    const char *bytes = reinterpret_cast<const char *>(&nanoseconds);
+    values.insert(values.end(), bytes, bytes + sizeof(nanoseconds));
+    ++length;
+  }
+
+  void appendOffset(size_t end) {
+    if (end > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+      throw std::runtime_error("Column " + column.name + " has too many values for a single Arrow batch");
+    }
+
+    offsets.push_back(static_cast<int32_t>(end));
+  }
+
+  // Appends the field at offset and moves offset past it
+  void appendField(const char *data, size_t data_length, size_t &offset) {
+    switch (column.kind) {
+      case Kind::primitive:
+      case Kind::boolean:
+      case Kind::time:
+        checkFits(offset, column.value_size, data_length);
+        appendValues(data + offset, 1);
+        offset += column.value_size;
+        return;
+      case Kind::binary: {
+        const uint32_t size = ParseProgram::readLength(data, data_length, offset);
+        offset += sizeof(uint32_t);
+        checkFits(offset, size, data_length);
+        values.insert(values.end(), data + offset, data + offset + size);
+        appendOffset(values.size());
+        offset += size;
+        break;
+      }
+      case Kind::fixed_binary:
+        checkFits(offset, column.list_size, data_length);
+        values.insert(values.end(), data + offset, data + offset + column.list_size);
+        offset += column.list_size;
+        break;
+      case Kind::structure:
+        appendObject(data, data_length, offset);
+        return;
+      case Kind::list:
+      case Kind::fixed_list: {
+        size_t count = column.list_size;
+        if (column.kind == Kind::list) {
+          count = ParseProgram::readLength(data, data_length, offset);
+          offset += sizeof(uint32_t);
+        }
+
+        children[0].appendElements(count, data, data_length, offset);
+        if (column.kind == Kind::list) {
+          appendOffset(children[0].length);
+        }
+        break;
+      }
+    }
+
+    ++length;
+  }
+
+  // Appends the elements of an array
+  void appendElements(size_t count, const char *data, size_t data_length, size_t &offset) {
+    if (column.kind == Kind::primitive || column.kind == Kind::boolean || column.kind == Kind::time) {
+      checkFits(offset, count * column.value_size, data_length);
+      appendValues(data + offset, count);
+      offset += count * column.value_size;
+      return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      appendField(data, data_length, offset);
+    }
+  }
+
+  void appendObject(const char *data, size_t data_length, size_t &offset) {
+    for (auto &child : children) {
+      child.appendField(data, data_length, offset);
+    }
+
+    ++length;
+  }
+
+  // Moves the built column into an array
+  void finish(ArrowArray *array) {
+    auto *data = new array_data_t();
+    data->buffer_pointers.push_back(nullptr);
+
+    // Buffers may only be null when they are empty, so empty ones get a byte of storage
+    const auto add_buffer = [&](std::vector<char> &&buffer) {
+      if (buffer.empty()) {
+        buffer.reserve(1);
+      }
+      data->buffers.push_back(std::move(buffer));
+      data->buffer_pointers.push_back(data->buffers.back().data());
+    };
+
+    if (!offsets.empty()) {
+      const char *begin = reinterpret_cast<const char *>(offsets.data());
+      add_buffer(std::vector<char>(begin, begin + offsets.size() * sizeof(int32_t)));
+    }
+
+    if (column.kind != Kind::structure && column.kind != Kind::list && column.kind != Kind::fixed_list) {
+      add_buffer(std::move(values));
+    }
+
+    data->children.resize(children.size());
+    for (size_t i = 0; i < children.size(); ++i) {
+      children[i].finish(&data->children[i]);
+      data->child_pointers.push_back(&data->children[i]);
+    }
+
+    array->length = static_cast<int64_t>(length);
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = static_cast<int64_t>(data->buffer_pointers.size());
+    array->n_children = static_cast<int64_t>(data->children.size());
+    array->buffers = data->buffer_pointers.data();
+    array->children = data->child_pointers.empty() ? nullptr : data->child_pointers.data();
+    array->dictionary = nullptr;
+    array->release = releaseArray<array_data_t>;
+    array->private_data = data;
+  }
+};
+
+ArrowBatches::ArrowBatches(const ParseProgram &program, size_t batch_count) {
+  auto schema = std::make_shared<column_t>(column_t::structure("", program));
+  for (const auto &child : schema->children) {
+    if (child.name == "timestamp") {
+      throw std::runtime_error("The messages have a field named timestamp, which would hide the record timestamp");
+    }
+  }
+
+  schema->children.insert(schema->children.begin(), column_t{"timestamp", "tsn:", column_t::Kind::time, 8, 0, {}});
+  schema_ = schema;
+
+  batches_.reset(new std::vector<ArrowArray>(batch_count), [](std::vector<ArrowArray> *batches) {
+    for (auto &batch : *batches) {
+      if (batch.release != nullptr) {
+        batch.release(&batch);
+      }
+    }
+
+    delete batches;
+  });
+  for (auto &batch : *batches_) {
+    batch.release = nullptr;
+  }
+}
+
+ArrowBatches::ArrowBatches(ArrowBatches &&other) noexcept
+  : schema_(std::move(other.schema_)),
+    batches_(std::move(other.batches_))
+{
+}
+
+ArrowBatches::~ArrowBatches() = default;
+
+void ArrowBatches::build(size_t index, const std::vector<message_t> &messages) {
+  builder_t batch{*schema_};
+  for (const auto &message : messages) {
+    batch.children[0].appendTime(message.timestamp.to_nsec());
+
+    size_t offset = 0;
+    for (size_t i = 1; i < batch.children.size(); ++i) {
+      batch.children[i].appendField(message.data, message.length, offset);
+    }
+
+    ++batch.length;
+  }
+
+  auto &array = batches_->at(index);
+  if (array.release != nullptr) {
+    array.release(&array);
+  }
+
+  batch.finish(&array);
+}
+
+size_t ArrowBatches::rowCount() const {
+  size_t rows = 0;
+  for (const auto &batch : *batches_) {
+    rows += static_cast<size_t>(batch.length);
+  }
+
+  return rows;
+}
+
+// A stream over the batches, which hands out arrays that share them
+struct ArrowBatches::stream_t {
+  std::shared_ptr<const column_t> schema;
+  std::shared_ptr<const std::vector<ArrowArray>> batches;
+  size_t next = 0;
+
+  static int getSchema(ArrowArrayStream *stream, ArrowSchema *schema) {
+    static_cast<stream_t *>(stream->private_data)->schema->exportTo(schema);
+    return 0;
+  }
+
+  static int getNext(ArrowArrayStream *stream, ArrowArray *array) {
+    auto *data = static_cast<stream_t *>(stream->private_data);
+    if (data->next == data->batches->size()) {
+      // The end of the stream is marked by a released array
+      std::memset(array, 0, sizeof(*array));
+      return 0;
+    }
+
+    exportShared((*data->batches)[data->next], data->batches, array);
+    ++data->next;
+    return 0;
+  }
+
+  static const char *getLastError(ArrowArrayStream *) {
+    // Every batch is built before the stream is, so reading one never fails
+    return nullptr;
+  }
+
+  static void release(ArrowArrayStream *stream) {
+    delete static_cast<stream_t *>(stream->private_data);
+    stream->release = nullptr;
+  }
+};
+
+void ArrowBatches::exportSchema(ArrowSchema *schema) const {
+  schema_->exportTo(schema);
+}
+
+void ArrowBatches::exportStream(ArrowArrayStream *stream) const {
+  auto *data = new stream_t();
+  data->schema = schema_;
+  data->batches = batches_;
+
+  stream->get_schema = stream_t::getSchema;
+  stream->get_next = stream_t::getNext;
+  stream->get_last_error = stream_t::getLastError;
+  stream->release = stream_t::release;
+  stream->private_data = data;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "parse_program.h"
+#include "ros_value.h"
+
+// The Arrow C data and stream interfaces, as specified at https://arrow.apache.org/docs/format/CDataInterface.html and
+// https://arrow.apache.org/docs/format/CStreamInterface.html.  They are a stable ABI, so batches can be handed to
+// pyarrow, polars, DuckDB or any other Arrow implementation without linking against Arrow.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema {
+  // Array type description
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+}
+
+#endif
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+extern "C" {
+
+struct ArrowArrayStream {
+  // Callbacks providing stream functionality
+  int (*get_schema)(struct ArrowArrayStream *, struct ArrowSchema *out);
+  int (*get_next)(struct ArrowArrayStream *, struct ArrowArray *out);
+  const char *(*get_last_error)(struct ArrowArrayStream *);
+
+  // Release callback
+  void (*release)(struct ArrowArrayStream *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+}
+
+#endif
+
+namespace Embag {
+
+// Messages of one type converted to Arrow record batches.
+//
+// The first column of every batch is the record timestamp of each message, named "timestamp", followed by one column
+// per field of the message:
+//  - nested messages are struct columns,
+//  - variable length arrays are list columns and fixed length arrays are fixed size lists, except that uint8 arrays
+//    are binary columns, as they are usually blobs,
+//  - times are timestamp[ns] and durations are duration[ns],
+//  - strings are utf8.
+// No value is ever null.  Batches are built straight from the raw bytes of the messages, independently of each other,
+// so several threads can build different batches at once.  Once built, they can be exported to any number of streams,
+// which share them rather than copying them.
+class ArrowBatches {
+ public:
+  struct message_t {
+    RosValue::ros_time_t timestamp;
+    const char *data;
+    size_t length;
+  };
+
+  // Batches for messages parsed with program, with room for batch_count of them
+  ArrowBatches(const ParseProgram &program, size_t batch_count);
+  ~ArrowBatches();
+
+  ArrowBatches(ArrowBatches &&other) noexcept;
+  ArrowBatches(const ArrowBatches &) = delete;
+  ArrowBatches& operator=(const ArrowBatches &) = delete;
+  ArrowBatches& operator=(ArrowBatches &&) = delete;
+
+  // Converts messages into batch index.  Different batches can be built concurrently.
+  void build(size_t index, const std::vector<message_t> &messages);
+
+  size_t size() const {
+    return batches_ ? batches_->size() : 0;
+  }
+
+  // Number of rows in all the batches
+  size_t rowCount() const;
+
+  // A batch, which stays owned by this
+  const ArrowArray& operator[](size_t index) const {
+    return batches_->at(index);
+  }
+
+  // Fills in a new schema of the batches, which the caller must release
+  void exportSchema(ArrowSchema *schema) const;
+
+  // Fills in a new stream of every batch, which the caller must release.  The arrays read from the stream share the
+  // buffers of the batches, which stay alive until the last of them is released, even after this is gone.
+  void exportStream(ArrowArrayStream *stream) const;
+
+ private:
+  struct column_t;
+  struct builder_t;
+  struct stream_t;
+
+  std::shared_ptr<const column_t> schema_;
+  // Released once neither this nor any array exported from a stream needs them
+  std::shared_ptr<std::vector<ArrowArray>> batches_;
+};
+
+}
@@ -1,6 +1,6 @@
 #include <lz4frame.h>
 
-// LZ4 decompression context singleton
+// LZ4 decompression context, one per thread
 class Lz4DecompressionCtx {
   LZ4F_decompressionContext_t ctx_{nullptr};
 
@@ -12,8 +12,13 @@ class Lz4DecompressionCtx {
   }
 
  public:
+  ~Lz4DecompressionCtx() {
+    LZ4F_freeDecompressionContext(ctx_);
+  }
+
+  // A decompression context can only be used by one thread at a time, so each thread gets its own
   static Lz4DecompressionCtx& getInstance() {
-    static Lz4DecompressionCtx instance;
+    static thread_local Lz4DecompressionCtx instance;
     return instance;
   }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -26,8 +27,15 @@ class Bag {
     bag_impl_ = make_unique<BagFromFile>(this, path);
   }
 
-  Bag(std::shared_ptr<const std::string>bytes) {
-    bag_impl_ = make_unique<BagFromBytes>(this, bytes);
+  Bag(std::shared_ptr<const std::string>bytes)
+    : Bag(std::shared_ptr<const char>(bytes, bytes->data()), bytes->size())
+  {
+  }
+
+  // Reads a bag straight from length bytes of memory, without copying them.  The memory stays alive for as long as the
+  // bag and the messages read from it need it, and is released through bytes' deleter.
+  Bag(std::shared_ptr<const char> bytes, size_t length) {
+    bag_impl_ = make_unique<BagFromBytes>(this, std::move(bytes), length);
   }
 
   ~Bag() {
@@ -50,7 +58,9 @@ class Bag {
     return topic_connection_map_.count(topic) != 0;
   }
 
+  // Parses the definition of a topic on first use.  Safe to call from several threads at once.
   std::shared_ptr<RosMsgTypes::MsgDef> msgDefForTopic(const std::string &topic) {
+    std::lock_guard<std::mutex> lock(message_schemata_mutex_);
     const auto it = message_schemata_.find(topic);
     if (it == message_schemata_.end()) {
       parseMsgDefForTopic(topic);
@@ -105,15 +115,15 @@ class Bag {
 
   class BagFromBytes : public BagImpl {
    public:
-    BagFromBytes(Bag *bag, std::shared_ptr<const std::string>bytes) : BagImpl(bag), bytes_(bytes) {
-      open(bytes->data(), bytes->size());
+    BagFromBytes(Bag *bag, std::shared_ptr<const char> bytes, size_t length) : BagImpl(bag), bytes_(std::move(bytes)) {
+      open(bytes_.get(), length);
     }
 
     void open(const char* bytes, size_t length);
     void close();
 
    private:
-    std::shared_ptr<const std::string> bytes_;
+    std::shared_ptr<const char> bytes_;
     boost::iostreams::stream<boost::iostreams::array_source> bag_stream_;
   };
 
@@ -139,6 +149,7 @@ class Bag {
   std::vector<RosBagTypes::chunk_t> chunks_;
   uint64_t index_pos_ = 0;
   std::unordered_map<std::string, std::shared_ptr<RosMsgTypes::MsgDef>> message_schemata_;
+  std::mutex message_schemata_mutex_;
 
   friend class View;
 };
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "field_index.h"
+
+namespace Embag {
+
+namespace {
+
+// Every name interned so far.  Names are never released; a process only ever sees as many as its message
+// definitions and callers use.
+struct symbol_table_t {
+  std::mutex mutex;
+  // A deque, so the names Symbols point to stay put as more are added
+  std::deque<std::string> names;
+  std::unordered_map<std::string, uint32_t> ids;
+};
+
+symbol_table_t& symbolTable() {
+  static symbol_table_t table;
+  return table;
+}
+
+// Placements tried per table size before settling for one with collisions
+const size_t max_attempts = 32;
+
+}
+
+Symbol::Symbol(const std::string &name) {
+  auto &table = symbolTable();
+  std::lock_guard<std::mutex> lock(table.mutex);
+
+  const auto existing = table.ids.find(name);
+  if (existing != table.ids.end()) {
+    id_ = existing->second;
+    name_ = &table.names[id_];
+    return;
+  }
+
+  id_ = static_cast<uint32_t>(table.names.size());
+  table.names.push_back(name);
+  table.ids.emplace(name, id_);
+  name_ = &table.names.back();
+}
+
+const size_t FieldIndex::npos;
+
+FieldIndex::FieldIndex(const std::vector<std::string> &names) {
+  fields_.reserve(names.size());
+  symbols_.reserve(names.size());
+
+  std::vector<uint32_t> name_keys;
+  std::vector<uint32_t> symbol_keys;
+  for (size_t i = 0; i < names.size(); ++i) {
+    fields_.emplace_back(names[i], i);
+    symbols_.emplace_back(names[i]);
+    name_keys.push_back(nameKey(names[i].data(), names[i].size()));
+    symbol_keys.push_back(symbols_.back().id());
+  }
+
+  names_.build(name_keys);
+  symbol_ids_.build(symbol_keys);
+}
+
+void FieldIndex::table_t::build(const std::vector<uint32_t> &keys) {
+  // At least twice as many slots as keys, so probing always ends at an empty slot
+  uint32_t bits = 1;
+  while ((size_t(1) << bits) < keys.size() * 2) {
+    ++bits;
+  }
+
+  std::vector<uint32_t> distinct_keys = keys;
+  std::sort(distinct_keys.begin(), distinct_keys.end());
+  distinct_keys.erase(std::unique(distinct_keys.begin(), distinct_keys.end()), distinct_keys.end());
+
+  // Look for a multiplier that sends every key to a slot of its own, in a larger table if need be
+  std::vector<bool> used;
+  bool perfect = false;
+  for (uint32_t extra_bits = 0; extra_bits < 3 && !perfect; ++extra_bits) {
+    shift = 32 - (bits + extra_bits);
+    for (size_t attempt = 0; attempt < max_attempts && !perfect; ++attempt) {
+      multiplier = static_cast<uint32_t>(0x9e3779b1u + attempt * 0x6a09e668u) | 1;
+
+      used.assign(size_t(1) << (bits + extra_bits), false);
+      perfect = true;
+      for (const uint32_t key : distinct_keys) {
+        const size_t slot = slotOf(key);
+        if (used[slot]) {
+          perfect = false;
+          break;
+        }
+        used[slot] = true;
+      }
+    }
+  }
+
+  // Whatever placement was settled on, colliding keys are resolved by linear probing.  Keys are inserted in
+  // declaration order, so a repeated name is found at its first declaration.
+  slots.assign(size_t(1) << (32 - shift), slot_t(0, 0));
+  const size_t mask = slots.size() - 1;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t slot = slotOf(keys[i]);
+    while (slots[slot].second != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = slot_t(keys[i], static_cast<uint32_t>(i + 1));
+  }
+}
+
+}
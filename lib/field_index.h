@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Embag {
+
+// A field name interned once for the whole process.  Looking a field up by Symbol compares a single integer per
+// probe instead of hashing or comparing the name, so callers that access the same field of many messages should
+// create the Symbol once and reuse it.  The same Symbol works for objects of any type that has a field of that name.
+class Symbol {
+ public:
+  explicit Symbol(const std::string &name);
+
+  uint32_t id() const {
+    return id_;
+  }
+
+  const std::string& name() const {
+    return *name_;
+  }
+
+  bool operator==(const Symbol &other) const {
+    return id_ == other.id_;
+  }
+
+  bool operator!=(const Symbol &other) const {
+    return id_ != other.id_;
+  }
+
+ private:
+  uint32_t id_;
+  const std::string *name_;
+};
+
+// The field names of a message definition, numbered in declaration order.
+//
+// Names and symbols are looked up in small open addressing tables built once per definition.  A name is keyed by a
+// hash of the whole string, read eight bytes at a time, and the tables are seeded so that, in practice, every field
+// gets a slot of its own and a lookup is a single probe and compare.  Definitions with only a few fields, which most
+// are, are scanned by name instead, comparing lengths before bytes, as that is cheaper than hashing.  Iterating yields
+// (name, index) pairs in declaration order.
+class FieldIndex {
+ public:
+  typedef std::vector<std::pair<std::string, size_t>>::const_iterator const_iterator;
+
+  explicit FieldIndex(const std::vector<std::string> &names);
+
+  size_t size() const {
+    return fields_.size();
+  }
+
+  const std::string& name(size_t index) const {
+    return fields_.at(index).first;
+  }
+
+  const Symbol& symbol(size_t index) const {
+    return symbols_.at(index);
+  }
+
+  // The index of the field, or npos if there is none by that name
+  size_t find(const std::string &name) const {
+    if (fields_.size() <= max_scanned_fields) {
+      for (const auto &field : fields_) {
+        if (field.first.size() == name.size() && sameName(field.first.data(), name.data(), name.size())) {
+          return field.second;
+        }
+      }
+      return npos;
+    }
+
+    const uint32_t key = nameKey(name.data(), name.size());
+    const size_t mask = names_.slots.size() - 1;
+    for (size_t slot = names_.slotOf(key);; slot = (slot + 1) & mask) {
+      const auto &entry = names_.slots[slot];
+      if (entry.second == 0) {
+        return npos;
+      }
+
+      if (entry.first == key) {
+        const auto &field_name = fields_[entry.second - 1].first;
+        if (field_name.size() == name.size() && sameName(field_name.data(), name.data(), name.size())) {
+          return entry.second - 1;
+        }
+      }
+    }
+  }
+
+  size_t find(const Symbol &symbol) const {
+    const size_t mask = symbol_ids_.slots.size() - 1;
+    for (size_t slot = symbol_ids_.slotOf(symbol.id());; slot = (slot + 1) & mask) {
+      const auto &entry = symbol_ids_.slots[slot];
+      if (entry.second == 0) {
+        return npos;
+      }
+
+      if (entry.first == symbol.id()) {
+        return entry.second - 1;
+      }
+    }
+  }
+
+  // The index of the field, throwing std::out_of_range if there is none by that name
+  size_t at(const std::string &name) const {
+    const size_t index = find(name);
+    if (index == npos) {
+      throw std::out_of_range("No field named " + name);
+    }
+
+    return index;
+  }
+
+  size_t at(const Symbol &symbol) const {
+    const size_t index = find(symbol);
+    if (index == npos) {
+      throw std::out_of_range("No field named " + symbol.name());
+    }
+
+    return index;
+  }
+
+  size_t count(const std::string &name) const {
+    return find(name) != npos;
+  }
+
+  size_t count(const Symbol &symbol) const {
+    return find(symbol) != npos;
+  }
+
+  const_iterator begin() const {
+    return fields_.cbegin();
+  }
+
+  const_iterator end() const {
+    return fields_.cend();
+  }
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+ private:
+  // The most fields a definition can have for names to be scanned rather than looked up in names_
+  static const size_t max_scanned_fields = 8;
+
+  // Names and indexes in declaration order
+  std::vector<std::pair<std::string, size_t>> fields_;
+  std::vector<Symbol> symbols_;
+
+  // A key and a field index plus one, or zero for an empty slot
+  typedef std::pair<uint32_t, uint32_t> slot_t;
+  struct table_t {
+    uint32_t multiplier = 1;
+    uint32_t shift = 31;
+    std::vector<slot_t> slots;
+
+    void build(const std::vector<uint32_t> &keys);
+    size_t slotOf(uint32_t key) const {
+      return (key * multiplier) >> shift;
+    }
+  };
+
+  // Names are hashed and compared in whole words, with the last word overlapping the one before it rather than read byte
+  // by byte.  The length is hashed too, so the overlap doesn't make names of different lengths collide.
+  static uint64_t loadWord(const char *name, size_t i) {
+    uint64_t word;
+    std::memcpy(&word, name + i, sizeof(word));
+    return word;
+  }
+
+  static uint64_t loadHalfWord(const char *name, size_t i) {
+    uint32_t word;
+    std::memcpy(&word, name + i, sizeof(word));
+    return word;
+  }
+
+  static uint32_t nameKey(const char *name, size_t size) {
+    const auto mix = [](uint64_t hash, uint64_t word) {
+      hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+      return hash ^ hash >> 32;
+    };
+
+    uint64_t hash = size * 0x9e3779b97f4a7c15ull;
+    if (size >= sizeof(uint64_t)) {
+      for (size_t i = 0; i + sizeof(uint64_t) < size; i += sizeof(uint64_t)) {
+        hash = mix(hash, loadWord(name, i));
+      }
+      hash = mix(hash, loadWord(name, size - sizeof(uint64_t)));
+    } else if (size >= sizeof(uint32_t)) {
+      hash = mix(hash, loadHalfWord(name, 0) | loadHalfWord(name, size - sizeof(uint32_t)) << 32);
+    } else if (size > 0) {
+      const auto byte = [&](size_t i) {
+        return static_cast<uint64_t>(static_cast<uint8_t>(name[i]));
+      };
+      hash = mix(hash, byte(0) | byte(size / 2) << 8 | byte(size - 1) << 16);
+    }
+
+    return static_cast<uint32_t>(hash);
+  }
+
+  // Whether two names of the given size are equal
+  static bool sameName(const char *left, const char *right, size_t size) {
+    if (size >= sizeof(uint64_t)) {
+      for (size_t i = 0; i + sizeof(uint64_t) < size; i += sizeof(uint64_t)) {
+        if (loadWord(left, i) != loadWord(right, i)) {
+          return false;
+        }
+      }
+      return loadWord(left, size - sizeof(uint64_t)) == loadWord(right, size - sizeof(uint64_t));
+    }
+
+    if (size >= sizeof(uint32_t)) {
+      return loadHalfWord(left, 0) == loadHalfWord(right, 0) &&
+        loadHalfWord(left, size - sizeof(uint32_t)) == loadHalfWord(right, size - sizeof(uint32_t));
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+      if (left[i] != right[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  table_t names_;
+  table_t symbol_ids_;
+};
+
+}
@@ -0,0 +1,180 @@
+#include "field_path.h"
+
+namespace Embag {
+
+FieldPath::FieldPath(const ParseProgram &program, const std::string &path)
+  : path_(path)
+  , type_(RosValue::Type::object)
+  , element_type_(RosValue::Type::object)
+  , array_size_(0)
+  , constant_offset_(0)
+{
+  const ParseProgram *current = &program;
+
+  size_t segment_start = 0;
+  while (true) {
+    const size_t segment_end = std::min(path.find('.', segment_start), path.size());
+    std::string name = path.substr(segment_start, segment_end - segment_start);
+
+    // An index into an array, such as ranges[3]
+    bool is_element = false;
+    size_t index = 0;
+    const size_t bracket = name.find('[');
+    if (bracket != std::string::npos) {
+      if (name.back() != ']' || bracket + 2 >= name.size()) {
+        throw std::runtime_error("Invalid field path: " + path);
+      }
+
+      const std::string index_string = name.substr(bracket + 1, name.size() - bracket - 2);
+      if (index_string.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::runtime_error("Invalid field path: " + path);
+      }
+
+      is_element = true;
+      index = std::stoul(index_string);
+      name.resize(bracket);
+    }
+
+    if (current == nullptr) {
+      throw std::runtime_error("Field path " + path + " goes through a field that is not an object");
+    }
+
+    const size_t field_index = current->field_indexes->find(name);
+    if (field_index == FieldIndex::npos) {
+      throw std::runtime_error("No field named " + name + " in field path " + path);
+    }
+
+    const auto &instruction = current->fields[field_index];
+
+    size_t skip_from = field_index;
+    while (skip_from > 0 && current->fields[skip_from].offset == ParseProgram::variable_size) {
+      --skip_from;
+    }
+
+    steps_.push_back({false, field_index, current, nullptr, skip_from});
+
+    if (instruction.offset == ParseProgram::variable_size) {
+      constant_offset_ = ParseProgram::variable_size;
+    } else if (hasConstantOffset()) {
+      constant_offset_ += instruction.offset;
+    }
+
+    if (instruction.array_size == 0) {
+      type_ = instruction.type;
+      current = instruction.program;
+    } else {
+      type_ = instruction.opcode == ParseProgram::Opcode::primitive_array ? RosValue::Type::primitive_array : RosValue::Type::array;
+      element_type_ = instruction.type;
+      array_size_ = instruction.array_size;
+      current = nullptr;
+    }
+
+    if (is_element) {
+      if (instruction.array_size == 0) {
+        throw std::runtime_error("Field path " + path + " indexes into " + name + ", which is not an array");
+      }
+
+      if (instruction.array_size > 0 && index >= static_cast<size_t>(instruction.array_size)) {
+        throw std::out_of_range("Index in field path " + path + " is out of range");
+      }
+
+      steps_.push_back({true, index, instruction.program, &instruction, 0});
+
+      if (instruction.array_size == -1 || instruction.element_size == ParseProgram::variable_size) {
+        constant_offset_ = ParseProgram::variable_size;
+      } else if (hasConstantOffset()) {
+        constant_offset_ += index * instruction.element_size;
+      }
+
+      type_ = instruction.type;
+      element_type_ = RosValue::Type::object;
+      array_size_ = 0;
+      current = instruction.program;
+    }
+
+    if (segment_end == path.size()) {
+      return;
+    }
+
+    segment_start = segment_end + 1;
+  }
+}
+
+const RosValue::Ref FieldPath::resolve(const RosValue::Ref &message_data) const {
+  RosValue::Ref value = message_data;
+  for (const auto &step : steps_) {
+    value = value[step.index];
+  }
+
+  return value;
+}
+
+size_t FieldPath::offsetIn(const char *data, size_t length) const {
+  if (hasConstantOffset()) {
+    return constant_offset_;
+  }
+
+  // The start of the current object, or of the current array field
+  size_t offset = 0;
+  for (const auto &step : steps_) {
+    if (!step.is_element) {
+      // The first field of a complete program is always at a constant offset, but that of a projection may not be
+      const auto &program = *step.program;
+      if (program.fields[step.skip_from].offset != ParseProgram::variable_size) {
+        offset += program.fields[step.skip_from].offset;
+      } else {
+        offset = program.skipDropped(0, data, length, offset);
+      }
+
+      for (size_t i = step.skip_from; i < step.index; ++i) {
+        offset = program.fields[i].skip(data, length, offset);
+        offset = program.skipDropped(i + 1, data, length, offset);
+      }
+
+      continue;
+    }
+
+    const auto &instruction = *step.array_instruction;
+    size_t array_length = static_cast<size_t>(instruction.array_size);
+    if (instruction.array_size == -1) {
+      array_length = ParseProgram::readLength(data, length, offset);
+      offset += sizeof(uint32_t);
+    }
+
+    if (step.index >= array_length) {
+      throw std::out_of_range("Index in field path " + path_ + " is out of range");
+    }
+
+    if (instruction.element_size != ParseProgram::variable_size) {
+      offset += step.index * instruction.element_size;
+    } else if (instruction.type == RosValue::Type::string) {
+      for (size_t i = 0; i < step.index; ++i) {
+        offset += sizeof(uint32_t) + ParseProgram::readLength(data, length, offset);
+      }
+    } else {
+      for (size_t i = 0; i < step.index; ++i) {
+        offset = instruction.program->skip(data, length, offset);
+      }
+    }
+  }
+
+  return offset;
+}
+
+template<>
+std::string FieldPath::get<std::string>(const char *data, size_t length) const {
+  if (type_ != RosValue::Type::string) {
+    throw std::runtime_error("Field path " + path_ + " does not lead to a string field");
+  }
+
+  const size_t offset = offsetIn(data, length);
+  const uint32_t string_length = ParseProgram::readLength(data, length, offset);
+  if (offset + sizeof(uint32_t) + string_length > length) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+
+  const char *const string_loc = data + offset + sizeof(uint32_t);
+  return std::string(string_loc, string_loc + string_length);
+}
+
+}
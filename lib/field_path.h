@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "parse_program.h"
+#include "ros_message.h"
+#include "ros_msg_types.h"
+#include "ros_value.h"
+
+namespace Embag {
+
+// A path to a field such as "pose.pose.position.x" or "ranges[3]", resolved against a message definition once
+// so it can be applied to any number of messages of that type without looking up field names again.
+//
+// A FieldPath can be applied to a parsed message, or read straight from the raw message without parsing it at all.
+// It refers to the parse program it was built from, so it must not outlive that program or the MsgDef that owns it.
+// To follow a path through projected data (see View::getMessages), build it from the same projected program.
+class FieldPath {
+ public:
+  FieldPath(const RosMsgTypes::MsgDef &msg_def, const std::string &path)
+    : FieldPath(msg_def.program(), path)
+  {
+  }
+
+  FieldPath(const ParseProgram &program, const std::string &path);
+
+  const std::string& path() const {
+    return path_;
+  }
+
+  // The type of the value the path leads to, which may be an object or array
+  RosValue::Type type() const {
+    return type_;
+  }
+
+  // For paths to arrays such as "ranges", the type of their elements
+  RosValue::Type elementType() const {
+    return element_type_;
+  }
+
+  // For paths to arrays, their fixed length, or -1 if each message has its own length
+  int32_t arraySize() const {
+    return array_size_;
+  }
+
+  // Whether the value is always found at the same offset from the start of a message, see ParseProgram::constantField
+  bool hasConstantOffset() const {
+    return constant_offset_ != ParseProgram::variable_size;
+  }
+
+  size_t constantOffset() const {
+    return constant_offset_;
+  }
+
+  // Follows the path through a parsed message
+  const RosValue::Ref resolve(const RosValue::Ref &message_data) const;
+  const RosValue::Ref resolve(const RosValue::Pointer &message_data) const {
+    return resolve(message_data.borrow());
+  }
+
+  // Finds the offset of the value in a raw message by skipping over whatever precedes it
+  size_t offsetIn(const char *data, size_t length) const;
+
+  // Reads a primitive or string value straight from a raw message
+  template<typename T>
+  T get(const char *data, size_t length) const {
+    if (type_ == RosValue::Type::object || type_ == RosValue::Type::array || type_ == RosValue::Type::primitive_array || type_ == RosValue::Type::string) {
+      throw std::runtime_error("Field path " + path_ + " does not lead to a primitive field");
+    }
+
+    if (RosValue::primitiveTypeToSize(type_) != sizeof(T)) {
+      throw std::runtime_error("The requested type does not match the size of " + path_);
+    }
+
+    const size_t offset = offsetIn(data, length);
+    if (offset + sizeof(T) > length) {
+      throw std::runtime_error("Message is shorter than its definition requires");
+    }
+
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+  }
+
+  template<typename T>
+  T get(const RosMessage &message) const {
+    return get<T>(message.raw_buffer->data() + message.raw_buffer_offset, message.raw_data_len);
+  }
+
+ private:
+  struct step_t {
+    // Either a field of an object, or an element of the array reached by the previous step
+    bool is_element;
+    size_t index;
+    // For fields, the program of the object holding the field; for elements, that of the array's elements if any
+    const ParseProgram *program;
+    // For elements, the instruction of the array
+    const ParseProgram::instruction_t *array_instruction;
+    // For fields, the last field up to this one at a constant offset, from which to start skipping
+    size_t skip_from;
+  };
+
+  std::string path_;
+  std::vector<step_t> steps_;
+  RosValue::Type type_;
+  RosValue::Type element_type_;
+  int32_t array_size_;
+  size_t constant_offset_;
+};
+
+template<>
+std::string FieldPath::get<std::string>(const char *data, size_t length) const;
+
+}
@@ -0,0 +1,171 @@
+#include <cstring>
+
+#include "lazy_value.h"
+#include "util.h"
+
+namespace Embag {
+
+std::unique_ptr<LazyValue::node_t> LazyValue::makeRoot(const RosMsgTypes::MsgDef &msg_def) {
+  return make_unique<node_t>(0, &msg_def.program(), nullptr, msg_def.program().fields.size());
+}
+
+RosValue::Type LazyValue::getElementType() const {
+  if (type_ != RosValue::Type::array && type_ != RosValue::Type::primitive_array) {
+    throw std::runtime_error("Cannot get element type of a non-array LazyValue");
+  }
+
+  return node_->array_instruction->type;
+}
+
+bool LazyValue::has(const std::string &key) const {
+  if (type_ != RosValue::Type::object) {
+    throw std::runtime_error("Value is not an object");
+  }
+
+  return node_->program->field_indexes->count(key);
+}
+
+bool LazyValue::has(const Symbol &key) const {
+  if (type_ != RosValue::Type::object) {
+    throw std::runtime_error("Value is not an object");
+  }
+
+  return node_->program->field_indexes->count(key);
+}
+
+size_t LazyValue::size() const {
+  if (node_ == nullptr) {
+    throw std::runtime_error("Value is not an array or an object");
+  }
+
+  return node_->length;
+}
+
+const LazyValue LazyValue::get(const std::string &key) const {
+  if (type_ != RosValue::Type::object) {
+    throw std::runtime_error("Value is not an object");
+  }
+
+  return child(node_->program->field_indexes->at(key));
+}
+
+const LazyValue LazyValue::get(const Symbol &key) const {
+  if (type_ != RosValue::Type::object) {
+    throw std::runtime_error("Value is not an object");
+  }
+
+  return child(node_->program->field_indexes->at(key));
+}
+
+const LazyValue LazyValue::at(size_t index) const {
+  if (node_ == nullptr) {
+    throw std::runtime_error("Value is not an array or object");
+  }
+
+  if (index >= node_->length) {
+    throw std::out_of_range("Provided index is out of range!");
+  }
+
+  if (type_ == RosValue::Type::primitive_array) {
+    const auto &instruction = *node_->array_instruction;
+    return LazyValue(data_, length_, nullptr, instruction.type, node_->offset + index * instruction.element_size);
+  }
+
+  return child(index);
+}
+
+const LazyValue LazyValue::child(size_t index) const {
+  const size_t offset = childOffset(index);
+  const auto &instruction = type_ == RosValue::Type::object ? node_->program->fields[index] : *node_->array_instruction;
+
+  // Elements of an array are never arrays themselves
+  const bool is_array = type_ == RosValue::Type::object && instruction.array_size != 0;
+  if (!is_array && instruction.type != RosValue::Type::object) {
+    return LazyValue(data_, length_, nullptr, instruction.type, offset);
+  }
+
+  auto &child_node = node_->children[index];
+  if (!child_node) {
+    if (!is_array) {
+      child_node = make_unique<node_t>(offset, instruction.program, nullptr, instruction.program->fields.size());
+    } else if (instruction.array_size == -1) {
+      const size_t length = ParseProgram::readLength(data_, length_, offset);
+
+      // An element whose size varies holds at least one length prefix, so a length that the rest of the message can't
+      // hold is corrupt, and must not be trusted by anything that goes on to visit the elements
+      const size_t element_size = instruction.element_size == ParseProgram::variable_size
+        ? sizeof(uint32_t)
+        : instruction.element_size;
+      if (element_size != 0 && length > (length_ - offset - sizeof(uint32_t)) / element_size) {
+        throw std::runtime_error("Message is shorter than its definition requires");
+      }
+
+      child_node = make_unique<node_t>(offset + sizeof(uint32_t), nullptr, &instruction, length);
+    } else {
+      child_node = make_unique<node_t>(offset, nullptr, &instruction, static_cast<size_t>(instruction.array_size));
+    }
+  }
+
+  RosValue::Type type = RosValue::Type::object;
+  if (instruction.opcode == ParseProgram::Opcode::primitive_array) {
+    type = RosValue::Type::primitive_array;
+  } else if (is_array) {
+    type = RosValue::Type::array;
+  }
+
+  return LazyValue(data_, length_, child_node.get(), type, child_node->offset);
+}
+
+size_t LazyValue::childOffset(size_t index) const {
+  if (type_ == RosValue::Type::object && node_->program->fields[index].offset != ParseProgram::variable_size) {
+    return node_->offset + node_->program->fields[index].offset;
+  }
+
+  if (type_ == RosValue::Type::array && node_->array_instruction->element_size != ParseProgram::variable_size) {
+    return node_->offset + index * node_->array_instruction->element_size;
+  }
+
+  auto &offsets = node_->child_offsets;
+  if (offsets.empty()) {
+    offsets.push_back(node_->offset);
+  }
+
+  // Skip forward from the last child with a known offset
+  while (offsets.size() <= index) {
+    const size_t previous = offsets.size() - 1;
+    if (type_ == RosValue::Type::object) {
+      offsets.push_back(node_->program->fields[previous].skip(data_, length_, offsets[previous]));
+    } else if (node_->array_instruction->type == RosValue::Type::string) {
+      offsets.push_back(offsets[previous] + sizeof(uint32_t) + ParseProgram::readLength(data_, length_, offsets[previous]));
+    } else {
+      offsets.push_back(node_->array_instruction->program->skip(data_, length_, offsets[previous]));
+    }
+  }
+
+  return offsets[index];
+}
+
+void LazyValue::read(size_t offset, void *destination, size_t size) const {
+  if (offset + size > length_) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+
+  std::memcpy(destination, data_ + offset, size);
+}
+
+template<>
+const std::string LazyValue::as<std::string>() const {
+  if (type_ != RosValue::Type::string) {
+    throw std::runtime_error("Cannot call as<std::string> for a non string");
+  }
+
+  const uint32_t string_length = ParseProgram::readLength(data_, length_, offset_);
+  if (offset_ + sizeof(uint32_t) + string_length > length_) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+
+  const char *const string_loc = data_ + offset_ + sizeof(uint32_t);
+  return std::string(string_loc, string_loc + string_length);
+}
+
+}
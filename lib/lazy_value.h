@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parse_program.h"
+#include "ros_value.h"
+#include "ros_msg_types.h"
+
+namespace Embag {
+
+// A read-only view of a message that decodes fields only when they are accessed.
+//
+// Unlike RosValue, no tree is built up front: the offset of a field is found by running the skip instructions of
+// the fields that precede it (see ParseProgram), and every offset found along the way is cached so later accesses to
+// the same or earlier fields are cheap.  Subtrees that are never accessed cost nothing.
+//
+// A LazyValue borrows from the RosMessage that created it and must not outlive it.
+// Like the rest of a message, it is not safe to access from several threads at once.
+class LazyValue {
+ private:
+  struct node_t {
+    // Offset of the first byte of this object, or of the first element of this array
+    size_t offset;
+    // Set for objects
+    const ParseProgram *program;
+    // Set for arrays, describes the elements
+    const ParseProgram::instruction_t *array_instruction;
+    // Number of fields or elements
+    size_t length;
+
+    // Offsets of the leading children whose position is known so far
+    std::vector<size_t> child_offsets;
+    // Nodes of the object and array children that have been accessed, by index, so that accessing one element of a
+    // long array doesn't allocate anything for the others
+    std::unordered_map<size_t, std::unique_ptr<node_t>> children;
+
+    node_t(size_t offset, const ParseProgram *program, const ParseProgram::instruction_t *array_instruction, size_t length)
+      : offset(offset)
+      , program(program)
+      , array_instruction(array_instruction)
+      , length(length)
+    {
+    }
+  };
+
+ public:
+  RosValue::Type getType() const {
+    return type_;
+  }
+
+  RosValue::Type getElementType() const;
+
+  bool has(const std::string &key) const;
+  bool has(const Symbol &key) const;
+  size_t size() const;
+
+  const LazyValue operator[](const std::string &key) const {
+    return get(key);
+  }
+
+  const LazyValue operator[](size_t index) const {
+    return at(index);
+  }
+
+  const LazyValue operator[](const Symbol &key) const {
+    return get(key);
+  }
+
+  const LazyValue get(const std::string &key) const;
+  const LazyValue get(const Symbol &key) const;
+  const LazyValue at(size_t index) const;
+
+  template<typename T>
+  const T as() const {
+    if (type_ == RosValue::Type::object || type_ == RosValue::Type::array || type_ == RosValue::Type::primitive_array) {
+      throw std::runtime_error("Value cannot be an object or array for as");
+    }
+
+    T value;
+    read(offset_, &value, sizeof(T));
+    return value;
+  }
+
+ private:
+  LazyValue(const char *data, size_t length, node_t *node, RosValue::Type type, size_t offset)
+    : data_(data)
+    , length_(length)
+    , node_(node)
+    , type_(type)
+    , offset_(offset)
+  {
+  }
+
+  static std::unique_ptr<node_t> makeRoot(const RosMsgTypes::MsgDef &msg_def);
+  const LazyValue child(size_t index) const;
+  size_t childOffset(size_t index) const;
+  void read(size_t offset, void *destination, size_t size) const;
+
+  const char *data_;
+  size_t length_;
+  // Null for primitives and strings
+  node_t *node_;
+  RosValue::Type type_;
+  size_t offset_;
+
+  friend class RosMessage;
+};
+
+template<>
+const std::string LazyValue::as<std::string>() const;
+
+}
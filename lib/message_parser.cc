@@ -10,122 +10,149 @@
 namespace Embag {
 
 const RosValue::Pointer MessageParser::parse() {
-  // The lowest number of RosValues occurs when we have a message with only doubles in a single type.
-  // The number of RosValues in this case is the number of doubles that can fit in our buffer,
-  // plus one for the RosValue object that will point to all the doubles.
-  ros_values_->reserve(message_buffer_->size() / sizeof(double) + 1);
-  ros_values_->emplace_back(msg_def_.fieldIndexes());
-  ros_values_offset_ = 1;
-  initObject(0, msg_def_);
-  return RosValue::Pointer(ros_values_);
+  // Nodes refer to their data by a 32 bit offset, which is plenty for a chunk
+  if (message_buffer_->size() > UINT32_MAX) {
+    throw std::runtime_error("Cannot parse messages from buffers larger than 4GB");
+  }
+
+  storage_->message_buffer = message_buffer_;
+  storage_->schema = program_;
+
+  // Count the values up front so they're allocated once, at the size this message needs.  Schemas without variable
+  // length string or object arrays give the count without looking at the message.
+  const auto &program = *program_;
+  size_t value_count = program.value_count;
+  if (value_count == ParseProgram::variable_size) {
+    size_t offset = message_buffer_offset_;
+    value_count = program.countValues(message_buffer_->data(), message_buffer_->size(), offset);
+  }
+
+  auto &nodes = storage_->nodes;
+  nodes.reserve(value_count + 1);
+  emplaceNode(RosValue::Type::object, RosValue::Type::object);
+  nodes[0].field_indexes = program.field_indexes.get();
+  initObject(0, program);
+  return RosValue::Pointer(storage_, 0);
+}
+
+void MessageParser::emplaceNode(RosValue::Type type, RosValue::Type element_type) {
+  RosValue::node_t node{};
+  node.type = type;
+  node.element_type = element_type;
+  storage_->nodes.push_back(node);
+  ++ros_values_offset_;
 }
 
-void MessageParser::initObject(size_t object_offset, const RosMsgTypes::BaseMsgDef &object_definition) {
+void MessageParser::initObject(size_t object_offset, const ParseProgram &program) {
   const size_t children_offset = ros_values_offset_;
-  ros_values_->at(object_offset).object_info_.children.base = ros_values_;
-  ros_values_->at(object_offset).object_info_.children.offset = children_offset;
-  ros_values_->at(object_offset).object_info_.children.length = 0;
-  for (auto &member: object_definition.members()) {
-    if (member.which() == 0) {
-      auto& field = boost::get<RosMsgTypes::FieldDef>(member);
-      emplaceField(field);
-    }
+  storage_->nodes[object_offset].offset = static_cast<uint32_t>(children_offset);
+  for (const auto &instruction : program.fields) {
+    emplaceField(instruction);
   }
 
-  for (auto &member: object_definition.members()) {
-    if (member.which() == 0) {
-      auto& field = boost::get<RosMsgTypes::FieldDef>(member);
-      const size_t child_offset = children_offset + ros_values_->at(object_offset).object_info_.children.length++;
-      switch (ros_values_->at(child_offset).type_) {
-        case RosValue::Type::object: {
-          auto& embedded_type = field.typeDefinition();
-          initObject(child_offset, embedded_type);
-          break;
-        }
-        case RosValue::Type::array:
-        case RosValue::Type::primitive_array:
-        {
-          initArray(child_offset, field);
-          break;
-        }
-        default: {
-          // Primitive
-          initPrimitive(child_offset, field);
-        }
+  for (size_t i = 0; i < program.fields.size(); ++i) {
+    const auto &instruction = program.fields[i];
+    const size_t child_offset = children_offset + i;
+    skipDropped(i, program);
+
+    switch (instruction.opcode) {
+      case ParseProgram::Opcode::object: {
+        initObject(child_offset, *instruction.program);
+        break;
+      }
+      case ParseProgram::Opcode::primitive_array:
+      case ParseProgram::Opcode::string_array:
+      case ParseProgram::Opcode::object_array: {
+        initArray(child_offset, instruction);
+        break;
+      }
+      default: {
+        // Primitive
+        initPrimitive(child_offset, instruction);
       }
     }
   }
+
+  skipDropped(program.fields.size(), program);
 }
 
-void MessageParser::emplaceField(const RosMsgTypes::FieldDef &field) {
-  if (field.arraySize() == 0) {
-    if (field.type() != RosValue::Type::object) {
-      ros_values_->emplace_back(field.type());
-    } else {
-      auto& object_definition = field.typeDefinition();
-      ros_values_->emplace_back(object_definition.fieldIndexes());
-    }
-  } else if (field.type() == RosValue::Type::object || field.type() == RosValue::Type::string) {
-    ros_values_->emplace_back(RosValue::_array_identifier());
-  } else {
-    ros_values_->emplace_back(field.type(), message_buffer_);
+void MessageParser::skipDropped(size_t index, const ParseProgram &program) {
+  if (!program.dropped_fields.empty()) {
+    message_buffer_offset_ = program.skipDropped(index, message_buffer_->data(), message_buffer_->size(), message_buffer_offset_);
   }
+}
 
-  ++ros_values_offset_;
+void MessageParser::emplaceField(const ParseProgram::instruction_t &instruction) {
+  switch (instruction.opcode) {
+    case ParseProgram::Opcode::object: {
+      emplaceNode(RosValue::Type::object, RosValue::Type::object);
+      storage_->nodes.back().field_indexes = instruction.program->field_indexes.get();
+      break;
+    }
+    case ParseProgram::Opcode::string_array:
+    case ParseProgram::Opcode::object_array: {
+      emplaceNode(RosValue::Type::array, instruction.type);
+      break;
+    }
+    case ParseProgram::Opcode::primitive_array: {
+      emplaceNode(RosValue::Type::primitive_array, instruction.type);
+      break;
+    }
+    default: {
+      emplaceNode(instruction.type, instruction.type);
+    }
+  }
 }
 
-void MessageParser::initArray(size_t array_offset, const RosMsgTypes::FieldDef &field) {
+void MessageParser::initArray(size_t array_offset, const ParseProgram::instruction_t &instruction) {
   size_t array_length;
-  if (field.arraySize() == -1) {
+  if (instruction.array_size == -1) {
     array_length = *reinterpret_cast<uint32_t*>(&message_buffer_->at(message_buffer_offset_));
     message_buffer_offset_ += sizeof(uint32_t);
   } else {
-    array_length = static_cast<uint32_t>(field.arraySize());
+    array_length = static_cast<uint32_t>(instruction.array_size);
   }
 
-  const RosValue::Type field_type = field.type();
-  if (field_type == RosValue::Type::object || field_type == RosValue::Type::string) {
-    const size_t children_offset = ros_values_offset_;
-    ros_values_offset_ += array_length;
+  auto &nodes = storage_->nodes;
+  nodes[array_offset].length = array_length;
 
-    ros_values_->at(array_offset).array_info_.children.length = array_length;
-    ros_values_->at(array_offset).array_info_.children.base = ros_values_;
-    ros_values_->at(array_offset).array_info_.children.offset = children_offset;
+  if (instruction.opcode == ParseProgram::Opcode::primitive_array) {
+    nodes[array_offset].offset = static_cast<uint32_t>(message_buffer_offset_);
+    message_buffer_offset_ += array_length * instruction.element_size;
+    return;
+  }
 
-    if (field_type == RosValue::Type::string) {
-      for (size_t i = 0; i < array_length; ++i) {
-        ros_values_->emplace_back(field.type());
-      }
+  const size_t children_offset = ros_values_offset_;
+  nodes[array_offset].offset = static_cast<uint32_t>(children_offset);
 
-      for (size_t i = 0; i < array_length; ++i) {
-        initPrimitive(children_offset + i, field);
-      }
-    } else {
-      auto& object_definition = field.typeDefinition();
-      for (size_t i = 0; i < array_length; ++i) {
-        ros_values_->emplace_back(object_definition.fieldIndexes());
-      }
+  if (instruction.opcode == ParseProgram::Opcode::string_array) {
+    for (size_t i = 0; i < array_length; ++i) {
+      emplaceNode(instruction.type, instruction.type);
+    }
 
-      for (size_t i = 0; i < array_length; ++i) {
-        initObject(children_offset + i, object_definition);
-      }
+    for (size_t i = 0; i < array_length; ++i) {
+      initPrimitive(children_offset + i, instruction);
     }
   } else {
-    ros_values_->at(array_offset).primitive_array_info_.length = array_length;
-    ros_values_->at(array_offset).primitive_array_info_.offset = message_buffer_offset_;
-    message_buffer_offset_ += array_length * field.typeSize();
+    const auto &program = *instruction.program;
+    for (size_t i = 0; i < array_length; ++i) {
+      emplaceNode(RosValue::Type::object, RosValue::Type::object);
+      nodes.back().field_indexes = program.field_indexes.get();
+    }
+
+    for (size_t i = 0; i < array_length; ++i) {
+      initObject(children_offset + i, program);
+    }
   }
 }
 
-void MessageParser::initPrimitive(size_t primitive_offset, const RosMsgTypes::FieldDef &field) {
-  RosValue& primitive = ros_values_->at(primitive_offset);
-  primitive.primitive_info_.message_buffer = message_buffer_;
-  primitive.primitive_info_.offset = message_buffer_offset_;
+void MessageParser::initPrimitive(size_t primitive_offset, const ParseProgram::instruction_t &instruction) {
+  storage_->nodes[primitive_offset].offset = static_cast<uint32_t>(message_buffer_offset_);
 
-  if (field.type() == RosValue::Type::string) {
-    message_buffer_offset_ += primitive.getPrimitive<uint32_t>() + sizeof(uint32_t);
+  if (instruction.type == RosValue::Type::string) {
+    message_buffer_offset_ += *reinterpret_cast<uint32_t*>(&message_buffer_->at(message_buffer_offset_)) + sizeof(uint32_t);
   } else {
-    message_buffer_offset_ += field.typeSize();
+    message_buffer_offset_ += instruction.element_size;
   }
 }
 }
@@ -18,9 +18,23 @@ class MessageParser {
   )
   : message_buffer_(message_buffer)
   , message_buffer_offset_(offset)
-  , ros_values_(std::make_shared<std::vector<RosValue>>())
+  , storage_(std::make_shared<RosValue::storage_t>())
   , ros_values_offset_(0)
-  , msg_def_(msg_def)
+  , program_(msg_def.sharedProgram())
+  {
+  };
+
+  // Parses with a program other than the one of the message's definition, such as a projection
+  MessageParser(
+      const std::shared_ptr<std::vector<char>> message_buffer,
+      size_t offset,
+      const std::shared_ptr<const ParseProgram> &program
+  )
+  : message_buffer_(message_buffer)
+  , message_buffer_offset_(offset)
+  , storage_(std::make_shared<RosValue::storage_t>())
+  , ros_values_offset_(0)
+  , program_(program)
   {
   };
 
@@ -29,17 +43,19 @@ class MessageParser {
  private:
   static std::unordered_map<std::string, size_t> primitive_size_map_;
 
-  void initObject(size_t object_offset, const RosMsgTypes::BaseMsgDef &object_definition);
-  void initArray(size_t array_offset, const RosMsgTypes::FieldDef &field);
-  void initPrimitive(size_t primitive_offset, const RosMsgTypes::FieldDef &field);
-  void emplaceField(const RosMsgTypes::FieldDef &field);
+  void initObject(size_t object_offset, const ParseProgram &program);
+  void initArray(size_t array_offset, const ParseProgram::instruction_t &instruction);
+  void initPrimitive(size_t primitive_offset, const ParseProgram::instruction_t &instruction);
+  void emplaceField(const ParseProgram::instruction_t &instruction);
+  void emplaceNode(RosValue::Type type, RosValue::Type element_type);
+  void skipDropped(size_t index, const ParseProgram &program);
 
   const std::shared_ptr<std::vector<char>> message_buffer_;
   size_t message_buffer_offset_;
 
-  std::shared_ptr<std::vector<RosValue>> ros_values_;
+  std::shared_ptr<RosValue::storage_t> storage_;
   size_t ros_values_offset_;
 
-  const RosMsgTypes::MsgDef& msg_def_;
+  const std::shared_ptr<const ParseProgram> program_;
 };
 }
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "field_path.h"
+#include "parse_program.h"
+#include "ros_msg_types.h"
+
+namespace Embag {
+
+const size_t ParseProgram::variable_size;
+
+uint32_t ParseProgram::readLength(const char *data, size_t length, size_t offset) {
+  if (offset + sizeof(uint32_t) > length) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+
+  uint32_t value;
+  std::memcpy(&value, data + offset, sizeof(uint32_t));
+  return value;
+}
+
+size_t ParseProgram::instruction_t::skip(const char *data, size_t length, size_t offset) const {
+  if (size != variable_size) {
+    return offset + size;
+  }
+
+  switch (opcode) {
+    case Opcode::string:
+      return offset + sizeof(uint32_t) + readLength(data, length, offset);
+    case Opcode::object:
+      return program->skip(data, length, offset);
+    default:
+      break;
+  }
+
+  size_t array_length;
+  if (array_size == -1) {
+    array_length = readLength(data, length, offset);
+    offset += sizeof(uint32_t);
+  } else {
+    array_length = static_cast<size_t>(array_size);
+  }
+
+  if (element_size != variable_size) {
+    return offset + array_length * element_size;
+  }
+
+  for (size_t i = 0; i < array_length; ++i) {
+    if (opcode == Opcode::string_array) {
+      offset += sizeof(uint32_t) + readLength(data, length, offset);
+    } else {
+      offset = program->skip(data, length, offset);
+    }
+  }
+
+  return offset;
+}
+
+size_t ParseProgram::skip(const char *data, size_t length, size_t offset) const {
+  if (size != variable_size) {
+    return offset + size;
+  }
+
+  for (const auto &instruction : skip_instructions) {
+    offset = instruction.skip(data, length, offset);
+  }
+
+  return offset;
+}
+
+size_t ParseProgram::countValues(const char *data, size_t length, size_t &offset) const {
+  if (value_count != variable_size) {
+    offset = skip(data, length, offset);
+    return value_count;
+  }
+
+  size_t count = fields.size();
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const auto &instruction = fields[i];
+    offset = skipDropped(i, data, length, offset);
+
+    switch (instruction.opcode) {
+      case Opcode::object: {
+        count += instruction.program->countValues(data, length, offset);
+        break;
+      }
+      case Opcode::string_array:
+      case Opcode::object_array: {
+        size_t array_length;
+        if (instruction.array_size == -1) {
+          array_length = readLength(data, length, offset);
+          offset += sizeof(uint32_t);
+        } else {
+          array_length = static_cast<size_t>(instruction.array_size);
+        }
+        count += array_length;
+
+        if (instruction.opcode == Opcode::string_array) {
+          for (size_t i = 0; i < array_length; ++i) {
+            offset += sizeof(uint32_t) + readLength(data, length, offset);
+          }
+        } else if (instruction.program->value_count != variable_size && instruction.element_size != variable_size) {
+          count += array_length * instruction.program->value_count;
+          offset += array_length * instruction.element_size;
+        } else {
+          for (size_t i = 0; i < array_length; ++i) {
+            count += instruction.program->countValues(data, length, offset);
+          }
+        }
+        break;
+      }
+      default: {
+        offset = instruction.skip(data, length, offset);
+      }
+    }
+  }
+
+  offset = skipDropped(fields.size(), data, length, offset);
+  return count;
+}
+
+ParseProgram::constant_field_t ParseProgram::constantField(const std::string &path) const {
+  const FieldPath field_path(*this, path);
+  if (!field_path.hasConstantOffset()) {
+    throw std::runtime_error("The offset of " + path + " depends on variable length data that precedes it");
+  }
+
+  switch (field_path.type()) {
+    case RosValue::Type::object:
+    case RosValue::Type::array:
+    case RosValue::Type::primitive_array:
+    case RosValue::Type::string:
+      throw std::runtime_error("Field path " + path + " does not lead to a primitive field");
+    default:
+      return {field_path.constantOffset(), field_path.type()};
+  }
+}
+
+void ParseProgram::appendSkip(std::vector<instruction_t> &skip_instructions, const instruction_t &instruction) {
+  if (instruction.size == variable_size) {
+    skip_instructions.push_back(instruction);
+    return;
+  }
+
+  // Consecutive fixed size fields are skipped in one step
+  if (skip_instructions.empty() || skip_instructions.back().opcode != Opcode::fixed) {
+    instruction_t fixed{};
+    fixed.opcode = Opcode::fixed;
+    fixed.type = RosValue::Type::uint8;
+    fixed.program = nullptr;
+    skip_instructions.push_back(fixed);
+  }
+
+  skip_instructions.back().size += instruction.size;
+}
+
+size_t ParseProgram::addValueCount(size_t value_count, const instruction_t &instruction) {
+  if (value_count == variable_size) {
+    return variable_size;
+  }
+
+  const auto embedded_value_count = instruction.program ? instruction.program->value_count : 0;
+  switch (instruction.opcode) {
+    case Opcode::object:
+      return embedded_value_count == variable_size ? variable_size : value_count + 1 + embedded_value_count;
+    case Opcode::string_array:
+    case Opcode::object_array:
+      return instruction.array_size == -1 || embedded_value_count == variable_size
+          ? variable_size
+          : value_count + 1 + instruction.array_size * (1 + embedded_value_count);
+    default:
+      return value_count + 1;
+  }
+}
+
+namespace {
+
+// The fields kept by a projection, as a tree of field names
+struct projection_node_t {
+  // Set when everything below the field is kept
+  bool whole = false;
+  std::map<std::string, std::shared_ptr<projection_node_t>> children;
+};
+
+std::shared_ptr<ParseProgram> projectProgram(const ParseProgram &program, const projection_node_t &node) {
+  for (const auto &child : node.children) {
+    if (program.field_indexes->count(child.first) == 0) {
+      throw std::runtime_error("No field named " + child.first + " to project");
+    }
+  }
+
+  const auto &names = *program.field_indexes;
+
+  // Skipping over a projected object still skips the whole object
+  auto projected = std::make_shared<ParseProgram>();
+  projected->type_name = program.type_name;
+  projected->size = program.size;
+  projected->skip_instructions = program.skip_instructions;
+  projected->embedded_programs = program.embedded_programs;
+  std::vector<std::string> projected_names;
+  projected->dropped_fields.emplace_back();
+
+  for (size_t i = 0; i < program.fields.size(); ++i) {
+    const auto child = node.children.find(names.name(i));
+    if (child == node.children.end()) {
+      ParseProgram::appendSkip(projected->dropped_fields.back(), program.fields[i]);
+      continue;
+    }
+
+    auto instruction = program.fields[i];
+    if (!child->second->whole) {
+      if (instruction.program == nullptr) {
+        throw std::runtime_error("Cannot project the fields of " + names.name(i) + ", which is not an object");
+      }
+
+      const auto embedded_program = projectProgram(*instruction.program, *child->second);
+      instruction.program = embedded_program.get();
+      projected->embedded_programs.push_back(embedded_program);
+    }
+
+    projected_names.push_back(names.name(i));
+    projected->fields.push_back(instruction);
+    projected->value_count = ParseProgram::addValueCount(projected->value_count, instruction);
+    projected->dropped_fields.emplace_back();
+  }
+
+  projected->field_indexes = std::make_shared<const FieldIndex>(projected_names);
+  return projected;
+}
+
+}
+
+std::shared_ptr<const ParseProgram> ParseProgram::project(const std::vector<std::string> &paths) const {
+  projection_node_t root;
+  for (const auto &path : paths) {
+    projection_node_t *node = &root;
+    size_t segment_start = 0;
+    while (!node->whole) {
+      const size_t segment_end = std::min(path.find('.', segment_start), path.size());
+      const std::string name = path.substr(segment_start, segment_end - segment_start);
+      if (name.empty() || name.find('[') != std::string::npos) {
+        throw std::runtime_error("Invalid projection path: " + path);
+      }
+
+      auto &child = node->children[name];
+      if (!child) {
+        child = std::make_shared<projection_node_t>();
+      }
+
+      node = child.get();
+      if (segment_end == path.size()) {
+        node->whole = true;
+        node->children.clear();
+      }
+
+      segment_start = segment_end + 1;
+    }
+  }
+
+  // Nothing after the last kept field of a message needs to be read
+  auto projected = projectProgram(*this, root);
+  projected->dropped_fields.back().clear();
+  return projected;
+}
+
+void RosMsgTypes::BaseMsgDef::compileProgram() const {
+  if (program_) {
+    return;
+  }
+
+  auto program = std::make_shared<ParseProgram>();
+  // The parser drops the package of embedded std_msgs types
+  program->type_name = name().find('/') == std::string::npos ? "std_msgs/" + name() : name();
+  program->field_indexes = field_indexes_;
+  program->fields.reserve(fieldCount());
+
+  for (size_t i = 0; i < fieldCount(); ++i) {
+    const auto &field = this->field(i);
+
+    ParseProgram::instruction_t instruction{};
+    instruction.type = field.type();
+    instruction.array_size = field.arraySize();
+    instruction.program = nullptr;
+
+    switch (field.type()) {
+      case RosValue::Type::object: {
+        const auto &embedded_definition = field.typeDefinition();
+        embedded_definition.compileProgram();
+        instruction.program = &embedded_definition.program();
+        program->embedded_programs.push_back(embedded_definition.sharedProgram());
+        instruction.element_size = instruction.program->size;
+        instruction.opcode = field.arraySize() == 0 ? ParseProgram::Opcode::object : ParseProgram::Opcode::object_array;
+        break;
+      }
+      case RosValue::Type::string: {
+        instruction.element_size = ParseProgram::variable_size;
+        instruction.opcode = field.arraySize() == 0 ? ParseProgram::Opcode::string : ParseProgram::Opcode::string_array;
+        break;
+      }
+      default: {
+        instruction.element_size = field.typeSize();
+        instruction.opcode = field.arraySize() == 0 ? ParseProgram::Opcode::primitive : ParseProgram::Opcode::primitive_array;
+      }
+    }
+
+    // Until the first variable length field, the size of the object so far is the offset of the next field
+    instruction.offset = program->size;
+    if (instruction.element_size == ParseProgram::variable_size || instruction.array_size == -1) {
+      instruction.size = ParseProgram::variable_size;
+    } else if (instruction.array_size == 0) {
+      instruction.size = instruction.element_size;
+    } else {
+      instruction.size = instruction.element_size * instruction.array_size;
+    }
+
+    program->fields.push_back(instruction);
+    program->value_count = ParseProgram::addValueCount(program->value_count, instruction);
+    ParseProgram::appendSkip(program->skip_instructions, instruction);
+
+    if (instruction.size == ParseProgram::variable_size) {
+      program->size = ParseProgram::variable_size;
+    } else if (program->size != ParseProgram::variable_size) {
+      program->size += instruction.size;
+    }
+  }
+
+  program_ = program;
+}
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "field_index.h"
+#include "ros_value.h"
+
+namespace Embag {
+
+// A message definition compiled into a flat list of instructions.
+//
+// Each definition is compiled once, when its MsgDef is created, and cached on it (see RosMsgTypes::BaseMsgDef::program).
+// Parsing and skipping over messages then runs these instructions rather than walking the members of the definition.
+class ParseProgram {
+ public:
+  // The size of anything whose length depends on the message
+  static const size_t variable_size = SIZE_MAX;
+
+  enum class Opcode : uint8_t {
+    primitive,
+    string,
+    object,
+    primitive_array,
+    string_array,
+    object_array,
+    // A run of fixed size data, only found in skip instructions
+    fixed,
+  };
+
+  struct instruction_t {
+    Opcode opcode;
+    // For arrays, the type of the elements
+    RosValue::Type type;
+    // 0 for single values, the length of a fixed length array, or -1 when the length precedes the array
+    int32_t array_size;
+    // Size of a single value or array element, or variable_size
+    size_t element_size;
+    // Size of the whole field, or variable_size
+    size_t size;
+    // Offset of the field from the start of its object, or variable_size if it follows variable length data
+    size_t offset;
+    // For objects and object arrays, the program of the embedded type
+    const ParseProgram *program;
+
+    // Returns the offset just past this field when it starts at offset
+    size_t skip(const char *data, size_t length, size_t offset) const;
+  };
+
+  // The name of the message type, such as "geometry_msgs/Pose"
+  std::string type_name;
+  // One instruction per field, in declaration order
+  std::vector<instruction_t> fields;
+  // The instructions to skip over a whole object, where consecutive fixed size fields are merged into a single skip
+  std::vector<instruction_t> skip_instructions;
+  // Size of the whole object, or variable_size
+  size_t size = 0;
+  // Number of RosValues that parsing the object creates below it, or variable_size if it contains string or object
+  // arrays of variable length
+  size_t value_count = 0;
+  std::shared_ptr<const FieldIndex> field_indexes;
+  // Keeps the programs of embedded types alive for as long as this one
+  std::vector<std::shared_ptr<const ParseProgram>> embedded_programs;
+  // Only set for projections (see project): the skip instructions for the fields that were dropped in front of each
+  // field, followed by those for the fields dropped after the last one
+  std::vector<std::vector<instruction_t>> dropped_fields;
+
+  // A primitive field that is always found at the same offset from the start of a message
+  struct constant_field_t {
+    size_t offset;
+    RosValue::Type type;
+  };
+
+  // Returns the offset just past this object when it starts at offset
+  size_t skip(const char *data, size_t length, size_t offset) const;
+
+  // Returns the offset of field index once the fields dropped in front of it by a projection have been skipped
+  size_t skipDropped(size_t index, const char *data, size_t length, size_t offset) const {
+    if (dropped_fields.empty()) {
+      return offset;
+    }
+
+    for (const auto &instruction : dropped_fields[index]) {
+      offset = instruction.skip(data, length, offset);
+    }
+
+    return offset;
+  }
+
+  // Returns the number of RosValues that parsing the object at offset creates below it, and moves offset past the object
+  size_t countValues(const char *data, size_t length, size_t &offset) const;
+
+  // Finds a primitive field such as "header.stamp" or "covariance[35]" whose offset doesn't depend on any
+  // variable length data before it, so it can be read straight from the raw message.  Throws if there is none.
+  constant_field_t constantField(const std::string &path) const;
+
+  // Builds a program that only parses the fields on the given paths, such as "header" or "pose.pose.position", and
+  // skips over the bytes of every other field.  A path keeps everything below the field it leads to, and paths into
+  // object arrays, such as "fields.name", apply to every element.  The projected objects only have the kept fields.
+  std::shared_ptr<const ParseProgram> project(const std::vector<std::string> &paths) const;
+
+  // Adds a field to a list of skip instructions, merging it into the preceding run of fixed size fields
+  static void appendSkip(std::vector<instruction_t> &skip_instructions, const instruction_t &instruction);
+
+  // Adds the number of RosValues a field creates to value_count
+  static size_t addValueCount(size_t value_count, const instruction_t &instruction);
+
+  // Reads the length prefix of a string or array, checking that it lies within the message
+  static uint32_t readLength(const char *data, size_t length, size_t offset);
+};
+
+}
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+
+#include "point_cloud.h"
+
+namespace Embag {
+
+namespace {
+
+// Points are decoded a block at a time, so the bytes of a block are still cached when the next field is gathered
+const size_t block_size = 1024;
+
+// A field to gather from a run of points point_step apart, or from the points at the given offsets from the run
+struct gather_t {
+  const char *points;
+  size_t point_step;
+  size_t point_count;
+  const size_t *point_offsets;
+  size_t offset;
+  uint32_t count;
+  // Whether the byte order of the cloud differs from ours
+  bool swap;
+  // Whether to look for NaNs while copying the values
+  bool find_nans;
+};
+
+// sensor_msgs/PointField datatypes
+RosValue::Type pointFieldType(uint8_t datatype) {
+  switch (datatype) {
+    case 1: return RosValue::Type::int8;
+    case 2: return RosValue::Type::uint8;
+    case 3: return RosValue::Type::int16;
+    case 4: return RosValue::Type::uint16;
+    case 5: return RosValue::Type::int32;
+    case 6: return RosValue::Type::uint32;
+    case 7: return RosValue::Type::float32;
+    case 8: return RosValue::Type::float64;
+    default:
+      throw std::runtime_error("Unknown point field datatype " + std::to_string(datatype));
+  }
+}
+
+bool isBigEndian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t *>(&probe) == 0;
+}
+
+template<typename T, bool Swap>
+T load(const char *p) {
+  T value;
+  if (Swap) {
+    char bytes[sizeof(T)];
+    std::reverse_copy(p, p + sizeof(T), bytes);
+    std::memcpy(&value, bytes, sizeof(T));
+  } else {
+    std::memcpy(&value, p, sizeof(T));
+  }
+
+  return value;
+}
+
+// Copies a field out of every point, returning whether any of the values is NaN if find_nans is set.  Whether to swap
+// bytes is settled before the loops, and the common case of single values gets a loop of its own with a constant stride
+// and no branches, which the compiler turns into vector gathers.  The values are converted to the destination type as
+// they are copied.
+template<typename Source, bool Swap, typename Destination>
+bool gather(const gather_t &field, Destination *out) {
+  bool nan = false;
+  if (field.point_offsets) {
+    for (size_t i = 0; i < field.point_count; ++i) {
+      const char *source = field.points + field.point_offsets[i] + field.offset;
+      for (uint32_t c = 0; c < field.count; ++c) {
+        const Source value = load<Source, Swap>(source + c * sizeof(Source));
+        nan |= value != value;
+        *out++ = static_cast<Destination>(value);
+      }
+    }
+    return nan;
+  }
+
+  const char *source = field.points + field.offset;
+  const size_t point_step = field.point_step;
+  if (field.count == 1) {
+    if (field.find_nans) {
+      for (size_t i = 0; i < field.point_count; ++i) {
+        const Source value = load<Source, Swap>(source + i * point_step);
+        nan |= value != value;
+        out[i] = static_cast<Destination>(value);
+      }
+      return nan;
+    }
+
+    for (size_t i = 0; i < field.point_count; ++i) {
+      out[i] = static_cast<Destination>(load<Source, Swap>(source + i * point_step));
+    }
+    return false;
+  }
+
+  for (size_t i = 0; i < field.point_count; ++i) {
+    for (uint32_t c = 0; c < field.count; ++c) {
+      const Source value = load<Source, Swap>(source + i * point_step + c * sizeof(Source));
+      nan |= value != value;
+      *out++ = static_cast<Destination>(value);
+    }
+  }
+  return nan;
+}
+
+template<typename Source, bool Swap>
+bool gatherAs(const gather_t &field, RosValue::Type type, char *out) {
+  switch (type) {
+    case RosValue::Type::int8: return gather<Source, Swap>(field, reinterpret_cast<int8_t *>(out));
+    case RosValue::Type::uint8: return gather<Source, Swap>(field, reinterpret_cast<uint8_t *>(out));
+    case RosValue::Type::int16: return gather<Source, Swap>(field, reinterpret_cast<int16_t *>(out));
+    case RosValue::Type::uint16: return gather<Source, Swap>(field, reinterpret_cast<uint16_t *>(out));
+    case RosValue::Type::int32: return gather<Source, Swap>(field, reinterpret_cast<int32_t *>(out));
+    case RosValue::Type::uint32: return gather<Source, Swap>(field, reinterpret_cast<uint32_t *>(out));
+    case RosValue::Type::int64: return gather<Source, Swap>(field, reinterpret_cast<int64_t *>(out));
+    case RosValue::Type::uint64: return gather<Source, Swap>(field, reinterpret_cast<uint64_t *>(out));
+    case RosValue::Type::float32: return gather<Source, Swap>(field, reinterpret_cast<float *>(out));
+    case RosValue::Type::float64: return gather<Source, Swap>(field, reinterpret_cast<double *>(out));
+    default:
+      throw std::runtime_error("Point fields can only be converted to integer or floating point types");
+  }
+}
+
+template<typename Source>
+bool gatherAs(const gather_t &field, RosValue::Type type, char *out) {
+  return field.swap ? gatherAs<Source, true>(field, type, out) : gatherAs<Source, false>(field, type, out);
+}
+
+bool gatherAs(const gather_t &field, RosValue::Type source_type, RosValue::Type type, char *out) {
+  switch (source_type) {
+    case RosValue::Type::int8: return gatherAs<int8_t>(field, type, out);
+    case RosValue::Type::uint8: return gatherAs<uint8_t>(field, type, out);
+    case RosValue::Type::int16: return gatherAs<int16_t>(field, type, out);
+    case RosValue::Type::uint16: return gatherAs<uint16_t>(field, type, out);
+    case RosValue::Type::int32: return gatherAs<int32_t>(field, type, out);
+    case RosValue::Type::uint32: return gatherAs<uint32_t>(field, type, out);
+    case RosValue::Type::float32: return gatherAs<float>(field, type, out);
+    case RosValue::Type::float64: return gatherAs<double>(field, type, out);
+    default:
+      throw std::runtime_error("Unexpected point field type");
+  }
+}
+
+// Marks the points of a run for which any value of a floating point field is NaN
+template<typename T, bool Swap>
+void markNans(const gather_t &field, uint8_t *nans) {
+  const char *source = field.points + field.offset;
+  for (uint32_t c = 0; c < field.count; ++c) {
+    for (size_t i = 0; i < field.point_count; ++i) {
+      const T value = load<T, Swap>(source + i * field.point_step + c * sizeof(T));
+      nans[i] |= value != value;
+    }
+  }
+}
+
+void markNans(const gather_t &field, RosValue::Type type, uint8_t *nans) {
+  if (type == RosValue::Type::float32) {
+    return field.swap ? markNans<float, true>(field, nans) : markNans<float, false>(field, nans);
+  }
+  if (type == RosValue::Type::float64) {
+    return field.swap ? markNans<double, true>(field, nans) : markNans<double, false>(field, nans);
+  }
+}
+
+// The same for a field already gathered into count values per point, back to back
+template<typename T>
+void markDecodedNans(const char *values, size_t point_count, uint32_t count, uint8_t *nans) {
+  const T *decoded = reinterpret_cast<const T *>(values);
+  for (size_t i = 0; i < point_count; ++i) {
+    for (uint32_t c = 0; c < count; ++c) {
+      nans[i] |= decoded[i * count + c] != decoded[i * count + c];
+    }
+  }
+}
+
+// Moves the values of the points that aren't marked to the front of a run of gathered values
+void dropMarked(char *values, size_t value_size, size_t point_count, const uint8_t *marked) {
+  size_t kept = 0;
+  for (size_t i = 0; i < point_count; ++i) {
+    if (!marked[i]) {
+      if (kept != i) {
+        std::memmove(values + kept * value_size, values + i * value_size, value_size);
+      }
+      ++kept;
+    }
+  }
+}
+
+}
+
+PointCloud PointCloud::decode(const RosValue::Pointer &message_data) {
+  return decode(message_data, options_t());
+}
+
+PointCloud PointCloud::decode(const RosValue::Pointer &message_data, const options_t &options) {
+  const auto cloud = message_data.borrow();
+  const auto data = cloud["data"];
+  if (data->getType() != RosValue::Type::primitive_array || data->getElementType() != RosValue::Type::uint8) {
+    throw std::runtime_error("The data of a point cloud must be an array of bytes");
+  }
+
+  const char *points = static_cast<const char *>(data->getPrimitiveArrayRosValueBuffer());
+  const size_t row_step = cloud["row_step"]->as<uint32_t>();
+  const size_t point_step = cloud["point_step"]->as<uint32_t>();
+  const size_t width = cloud["width"]->as<uint32_t>();
+  const size_t height = cloud["height"]->as<uint32_t>();
+  const bool swap = cloud["is_bigendian"]->as<bool>() != isBigEndian();
+
+  if (height > 0 && (width * point_step > row_step || height * row_step > data->size())) {
+    throw std::runtime_error("The points of the cloud do not fit in its data");
+  }
+
+  struct source_field_t {
+    std::string name;
+    size_t offset;
+    RosValue::Type type;
+    uint32_t count;
+  };
+
+  std::vector<source_field_t> cloud_fields;
+  const auto fields = cloud["fields"];
+  for (size_t i = 0; i < fields->size(); ++i) {
+    const auto field = fields[i];
+    source_field_t source_field{
+      field["name"]->as<std::string>(),
+      field["offset"]->as<uint32_t>(),
+      pointFieldType(field["datatype"]->as<uint8_t>()),
+      field["count"]->as<uint32_t>(),
+    };
+
+    if (source_field.offset + source_field.count * RosValue::primitiveTypeToSize(source_field.type) > point_step) {
+      throw std::runtime_error("Point field " + source_field.name + " does not fit in a point");
+    }
+
+    cloud_fields.push_back(source_field);
+  }
+
+  std::vector<source_field_t> selected_fields;
+  if (options.fields.empty()) {
+    selected_fields = cloud_fields;
+  } else {
+    for (const auto &name : options.fields) {
+      const auto field = std::find_if(cloud_fields.begin(), cloud_fields.end(), [&](const source_field_t &f) {
+        return f.name == name;
+      });
+
+      if (field == cloud_fields.end()) {
+        throw std::runtime_error("The point cloud has no field named " + name);
+      }
+
+      selected_fields.push_back(*field);
+    }
+  }
+
+  const size_t cloud_size = width * height;
+
+  PointCloud result;
+  std::vector<size_t> value_sizes;
+  for (const auto &field : selected_fields) {
+    const auto type = options.type == RosValue::Type::object ? field.type : options.type;
+    value_sizes.push_back(field.count * RosValue::primitiveTypeToSize(type));
+
+    field_t decoded{field.name, type, field.count, {}};
+    decoded.bytes.resize(cloud_size * value_sizes.back());
+    result.fields_.push_back(std::move(decoded));
+  }
+
+  // Points are decoded a block of a row at a time.  With skip_nans, NaNs are looked for as the fields of a block are
+  // gathered, and only for a block that has any are the points with NaNs found in its still cached values and dropped.
+  // When floating point fields are converted to integers, NaNs are instead looked for in the points beforehand, and
+  // just the points without any gathered.
+  const bool check_points = options.skip_nans && options.type != RosValue::Type::object &&
+    options.type != RosValue::Type::float32 && options.type != RosValue::Type::float64;
+  std::vector<uint8_t> nans(options.skip_nans ? block_size : 0);
+  std::vector<size_t> kept_offsets(check_points ? block_size : 0);
+  size_t decoded_points = 0;
+  for (size_t row = 0; row < height; ++row) {
+    for (size_t start = 0; start < width; start += block_size) {
+      const char *block = points + row * row_step + start * point_step;
+      const size_t block_points = std::min(block_size, width - start);
+
+      const size_t *point_offsets = nullptr;
+      size_t kept_points = block_points;
+      if (check_points) {
+        std::fill(nans.begin(), nans.begin() + block_points, 0);
+        for (const auto &field : selected_fields) {
+          const gather_t gather{block, point_step, block_points, nullptr, field.offset, field.count, swap, false};
+          markNans(gather, field.type, nans.data());
+        }
+
+        kept_points = 0;
+        for (size_t i = 0; i < block_points; ++i) {
+          kept_offsets[kept_points] = i * point_step;
+          kept_points += !nans[i];
+        }
+
+        if (kept_points != block_points) {
+          point_offsets = kept_offsets.data();
+        }
+      }
+
+      bool found_nans = false;
+      for (size_t f = 0; f < selected_fields.size(); ++f) {
+        const auto &field = selected_fields[f];
+        const gather_t gather{block, point_step, kept_points, point_offsets, field.offset, field.count, swap, options.skip_nans && !check_points};
+        char *out = result.fields_[f].bytes.data() + decoded_points * value_sizes[f];
+        found_nans |= gatherAs(gather, field.type, result.fields_[f].type, out) && gather.find_nans;
+      }
+
+      if (found_nans) {
+        std::fill(nans.begin(), nans.begin() + block_points, 0);
+        for (size_t f = 0; f < selected_fields.size(); ++f) {
+          const auto &decoded = result.fields_[f];
+          const char *values = decoded.bytes.data() + decoded_points * value_sizes[f];
+          if (decoded.type == RosValue::Type::float32) {
+            markDecodedNans<float>(values, block_points, decoded.count, nans.data());
+          } else if (decoded.type == RosValue::Type::float64) {
+            markDecodedNans<double>(values, block_points, decoded.count, nans.data());
+          }
+        }
+
+        kept_points = block_points - std::count(nans.begin(), nans.begin() + block_points, 1);
+        for (size_t f = 0; f < selected_fields.size(); ++f) {
+          dropMarked(result.fields_[f].bytes.data() + decoded_points * value_sizes[f], value_sizes[f], block_points, nans.data());
+        }
+      }
+
+      decoded_points += kept_points;
+    }
+  }
+
+  result.point_count_ = decoded_points;
+  if (decoded_points != cloud_size) {
+    for (size_t f = 0; f < result.fields_.size(); ++f) {
+      result.fields_[f].bytes.resize(decoded_points * value_sizes[f]);
+    }
+  }
+
+  return result;
+}
+
+const PointCloud::field_t &PointCloud::operator[](const std::string &name) const {
+  for (const auto &field : fields_) {
+    if (field.name == name) {
+      return field;
+    }
+  }
+
+  throw std::out_of_range("No point field named " + name + " was decoded");
+}
+
+}
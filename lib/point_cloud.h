@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ros_value.h"
+
+namespace Embag {
+
+// The points of a sensor_msgs/PointCloud2 message, with each field de-interleaved into its own contiguous array.
+//
+// The layout of the point buffer is taken from the message's fields, point_step, row_step and is_bigendian, so any
+// cloud can be decoded without knowing its fields in advance.
+class PointCloud {
+ public:
+  struct options_t {
+    // The fields to decode, in the order given, or every field of the cloud if empty
+    std::vector<std::string> fields;
+    // Drop the points for which any decoded floating point field is NaN
+    bool skip_nans = false;
+    // Convert every field to this type.  With the default, each field keeps the type it has in the cloud.
+    RosValue::Type type = RosValue::Type::object;
+  };
+
+  struct field_t {
+    std::string name;
+    RosValue::Type type;
+    // Values per point
+    uint32_t count;
+    // count values for each point, back to back
+    std::vector<char> bytes;
+
+    template<typename T>
+    const T* data() const {
+      if (RosValue::primitiveTypeToSize(type) != sizeof(T)) {
+        throw std::runtime_error("The requested type does not match the size of point field " + name);
+      }
+
+      return reinterpret_cast<const T*>(bytes.data());
+    }
+
+    template<typename T>
+    std::vector<T> values() const {
+      const T *begin = data<T>();
+      return std::vector<T>(begin, begin + bytes.size() / sizeof(T));
+    }
+  };
+
+  static PointCloud decode(const RosValue::Pointer &message_data);
+  static PointCloud decode(const RosValue::Pointer &message_data, const options_t &options);
+
+  // Number of points, after NaNs were dropped
+  size_t size() const {
+    return point_count_;
+  }
+
+  const std::vector<field_t>& fields() const {
+    return fields_;
+  }
+
+  const field_t& operator[](const std::string &name) const;
+
+ private:
+  size_t point_count_ = 0;
+  std::vector<field_t> fields_;
+};
+
+}
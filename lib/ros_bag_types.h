@@ -72,12 +72,31 @@ struct RosBagTypes {
     uint32_t connection_count = 0;
   };
 
+  // A single entry of an INDEX_DATA record, laid out exactly as it is in the bag
+  struct index_entry_t {
+    RosValue::ros_time_t time;
+    // Offset of the MESSAGE_DATA record within the uncompressed chunk
+    uint32_t offset;
+  };
+
+  struct chunk_t;
+
+  struct index_block_t {
+    chunk_t *into_chunk;
+    uint32_t connection_id;
+    uint32_t message_count;
+    // Points directly into the bag's INDEX_DATA record, so the bag must outlive this block
+    const index_entry_t *entries;
+  };
+
   struct chunk_t {
     uint64_t offset = 0;
     chunk_info_t info;
     std::string compression;
     uint32_t uncompressed_size = 0;
     record_t record{};
+    // The index blocks of every connection that has messages in this chunk
+    std::vector<index_block_t> index_blocks;
 
     explicit chunk_t(record_t r) {
       record = r;
@@ -127,10 +146,6 @@ struct RosBagTypes {
     }
   };
 
-  struct index_block_t {
-    chunk_t *into_chunk;
-  };
-
   struct connection_record_t {
     uint32_t id;
     std::vector<index_block_t> blocks;
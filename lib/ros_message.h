@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <cstring>
+#include <mutex>
 #include <string>
 
+#include "lazy_value.h"
 #include "ros_value.h"
 #include "message_parser.h"
 #include "ros_msg_types.h"
@@ -17,6 +21,10 @@ class RosMessage {
   const std::shared_ptr<std::vector<char>> raw_buffer;
   const size_t raw_buffer_offset;
   uint32_t raw_data_len = 0;
+  // Position of the chunk holding the message in the bag file, and the offset of the message's record within the
+  // decompressed chunk.  Together, they're what rosbag reports as the position of a message.
+  uint64_t chunk_position = 0;
+  uint32_t chunk_offset = 0;
 
   RosMessage(const std::shared_ptr<std::vector<char>> raw_buffer, const size_t offset)
     : raw_buffer(raw_buffer)
@@ -51,6 +59,41 @@ class RosMessage {
     return data_;
   }
 
+  // Returns a view of the message that only decodes the fields that are accessed, rather than the whole message.
+  // The view must not outlive this message.
+  const LazyValue lazyData() {
+    if (!lazy_built_) {
+      std::lock_guard<std::mutex> lock(hydrate_mutex_);
+      if (!lazy_root_) {
+        lazy_root_ = LazyValue::makeRoot(*msg_def_);
+      }
+      lazy_built_ = true;
+    }
+
+    return LazyValue(raw_buffer->data() + raw_buffer_offset, raw_data_len, lazy_root_.get(), RosValue::Type::object, 0);
+  }
+
+  // Reads a field at a constant offset, found with ParseProgram::constantField, straight from the raw message
+  template<typename T>
+  T getConstant(const ParseProgram::constant_field_t &field) const {
+    if (RosValue::primitiveTypeToSize(field.type) != sizeof(T)) {
+      throw std::runtime_error("The requested type does not match the size of the field");
+    }
+
+    if (field.offset + sizeof(T) > raw_data_len) {
+      throw std::runtime_error("Message is shorter than its definition requires");
+    }
+
+    T value;
+    std::memcpy(&value, raw_buffer->data() + raw_buffer_offset + field.offset, sizeof(T));
+    return value;
+  }
+
+  template<typename T>
+  T getConstant(const std::string &path) const {
+    return getConstant<T>(msg_def_->program().constantField(path));
+  }
+
   bool has(const std::string &key) {
     if (!parsed_) {
       hydrate();
@@ -67,6 +110,11 @@ class RosMessage {
     data_->print();
   }
 
+  // The program the message is parsed with, which only covers some of its fields if the view was projected
+  const std::shared_ptr<const ParseProgram>& program() const {
+    return program_ ? program_ : msg_def_->sharedProgram();
+  }
+
   std::string getTypeName(){
     return msg_def_->name();
   }
@@ -80,12 +128,24 @@ class RosMessage {
   }
 
  private:
-  bool parsed_ = false;
+  // Set once data_ is, so that threads sharing a message parse it only once
+  std::atomic<bool> parsed_{false};
+  std::mutex hydrate_mutex_;
   RosValue::Pointer data_;
   std::shared_ptr<RosMsgTypes::MsgDef> msg_def_;
+  // Set when only some fields of the message are parsed, see View::getMessages
+  std::shared_ptr<const ParseProgram> program_;
+  // Set once lazy_root_ is, like parsed_
+  std::atomic<bool> lazy_built_{false};
+  std::unique_ptr<LazyValue::node_t> lazy_root_;
 
   void hydrate() {
-    MessageParser msg(raw_buffer, raw_buffer_offset, *msg_def_);
+    std::lock_guard<std::mutex> lock(hydrate_mutex_);
+    if (parsed_) {
+      return;
+    }
+
+    MessageParser msg(raw_buffer, raw_buffer_offset, program());
 
     data_ = msg.parse();
 
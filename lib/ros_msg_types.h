@@ -2,6 +2,7 @@
 
 #include <unordered_map>
 
+#include "parse_program.h"
 #include "ros_value.h"
 
 namespace Embag {
@@ -130,17 +131,18 @@ class RosMsgTypes{
       }
 
       members_.reserve(parsed_info.members.size());
-      field_indexes_ = std::make_shared<std::unordered_map<std::string, size_t>>();
-      field_indexes_->reserve(num_fields);
-      size_t field_num = 0;
+      std::vector<std::string> field_names;
+      field_names.reserve(num_fields);
       for (const auto& member : parsed_info.members) {
         if (member.which() == 0) {
+          field_member_indexes_.push_back(members_.size());
           members_.emplace_back(boost::get<FieldDef::parseable_info_t>(member));
-          field_indexes_->emplace(boost::get<FieldDef::parseable_info_t>(member).field_name, field_num++);
+          field_names.push_back(boost::get<FieldDef::parseable_info_t>(member).field_name);
         } else {
           members_.emplace_back(boost::get<ConstantDef>(member));
         }
       }
+      field_indexes_ = std::make_shared<const FieldIndex>(field_names);
 
       // TODO: make this less dumb
       const size_t slash_pos = name_.find_first_of('/');
@@ -160,7 +162,7 @@ class RosMsgTypes{
       }
     }
 
-    const std::shared_ptr<std::unordered_map<std::string, size_t>>& fieldIndexes() const {
+    const std::shared_ptr<const FieldIndex>& fieldIndexes() const {
       return field_indexes_;
     }
 
@@ -168,10 +170,28 @@ class RosMsgTypes{
       return members_;
     };
 
+    size_t fieldCount() const {
+      return field_member_indexes_.size();
+    }
+
+    // Fields are numbered in declaration order, skipping constants, as in fieldIndexes()
+    const FieldDef& field(size_t index) const {
+      return boost::get<FieldDef>(members_[field_member_indexes_[index]]);
+    }
+
     const std::string& name() const {
       return name_;
     }
 
+    // The compiled form of this definition that messages are parsed with
+    const ParseProgram& program() const {
+      return *program_;
+    }
+
+    const std::shared_ptr<const ParseProgram>& sharedProgram() const {
+      return program_;
+    }
+
     const std::string& scope() const {
       return scope_;
     }
@@ -187,11 +207,17 @@ class RosMsgTypes{
       }
     }
 
+   protected:
+    // Compiles this definition and the definitions embedded in it, once their type definitions are known
+    void compileProgram() const;
+
    private:
-    std::shared_ptr<std::unordered_map<std::string, size_t>> field_indexes_;
+    std::shared_ptr<const FieldIndex> field_indexes_;
     std::vector<MemberDef> members_;
+    std::vector<size_t> field_member_indexes_;
     const std::string name_;
     std::string scope_;
+    mutable std::shared_ptr<const ParseProgram> program_;
   };
 
   class EmbeddedMsgDef : public BaseMsgDef {
@@ -224,6 +250,8 @@ class RosMsgTypes{
       for (auto &embedded_definition_kv: embedded_definition_map_) {
         embedded_definition_kv.second.initializeFieldTypeDefinitions(embedded_definition_map_);
       }
+
+      compileProgram();
     }
 
    private:
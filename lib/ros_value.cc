@@ -5,14 +5,6 @@
 
 namespace Embag {
 
-const RosValue::Pointer RosValue::ros_value_list_t::at(size_t index) const {
-  if (index >= length) {
-    throw std::out_of_range("Provided index is out of range!");
-  }
-
-  return RosValue::Pointer(base, offset + index);
-}
-
 const RosValue::Pointer RosValue::operator()(const std::string &key) const {
   return get(key);
 }
@@ -25,14 +17,18 @@ const RosValue::Pointer RosValue::operator[](const size_t idx) const {
   return at(idx);
 }
 
+const RosValue::Pointer RosValue::operator[](const Symbol &key) const {
+  return get(key);
+}
+
 const RosValue::Pointer RosValue::at(const std::string &key) const {
   return get(key);
 }
 
 RosValue::Type RosValue::getElementType() const {
-  if (type_ == Type::primitive_array) {
-    return primitive_array_info_.element_type;
-  } else if (type_ == Type::array) {
+  if (getType() == Type::primitive_array) {
+    return node_.element_type;
+  } else if (getType() == Type::array) {
     return at(0)->getType();
   } else {
     throw std::runtime_error("Cannot get element type of a non-array RosValue");
@@ -44,7 +40,7 @@ const void* RosValue::getPrimitiveArrayRosValueBuffer() const {
     throw std::runtime_error("Cannot access the buffer of a non primitive_array RosValue");
   }
 
-  return static_cast<const void *>(&at(0)->getPrimitive<uint8_t>());
+  return static_cast<const void *>(storage_->message_buffer->data() + node_.offset);
 }
 
 size_t RosValue::getPrimitiveArrayRosValueBufferSize() const {
@@ -52,7 +48,7 @@ size_t RosValue::getPrimitiveArrayRosValueBufferSize() const {
     throw std::runtime_error("Cannot access the buffer of a non primitive_array RosValue");
   }
 
-  return primitive_array_info_.length * primitiveTypeToSize(getElementType());
+  return node_.length * primitiveTypeToSize(getElementType());
 }
 
 template<typename T>
@@ -61,16 +57,24 @@ const T &RosValue::getValue(const std::string &key) const {
 }
 
 const RosValue::Pointer RosValue::get(const std::string &key) const {
-  if (type_ != Type::object) {
+  if (getType() != Type::object) {
     throw std::runtime_error("Value is not an object");
   }
 
-  return at(object_info_.field_indexes->at(key));
+  return at(node_.field_indexes->at(key));
+}
+
+const RosValue::Pointer RosValue::get(const Symbol &key) const {
+  if (getType() != Type::object) {
+    throw std::runtime_error("Value is not an object");
+  }
+
+  return at(node_.field_indexes->at(key));
 }
 
 template<>
 const std::string RosValue::as<std::string>() const {
-  if (type_ != Type::string) {
+  if (getType() != Type::string) {
     throw std::runtime_error("Cannot call as<std::string> for a non string");
   }
 
@@ -80,36 +84,24 @@ const std::string RosValue::as<std::string>() const {
 }
 
 const RosValue::Pointer RosValue::at(const size_t idx) const {
-  if (type_ == Type::object) {
-    return object_info_.children.at(idx);
-  } else if (type_ == Type::array) {
-    return array_info_.children.at(idx);
-  } else if (type_ == Type::primitive_array) {
-    return RosValue::Pointer(
-      primitive_array_info_.element_type,
-      primitive_array_info_.message_buffer,
-      primitive_array_info_.offset + idx * primitiveTypeToSize(primitive_array_info_.element_type)
-    );
-  } else {
-    throw std::runtime_error("Value is not an array or object");
-  }
+  return RosValue::Pointer(storage_->shared_from_this(), child(idx));
 }
 
 std::unordered_map<std::string, RosValue::Pointer> RosValue::getObjects() const {
-  if (type_ != Type::object) {
+  if (getType() != Type::object) {
     throw std::runtime_error("Cannot getObjects of a non-object RosValue");
   }
 
   std::unordered_map<std::string, RosValue::Pointer> objects;
-  objects.reserve(object_info_.children.length);
-  for (const auto& field : *object_info_.field_indexes) {
+  objects.reserve(size());
+  for (const auto& field : *node_.field_indexes) {
     objects.emplace(field.first, at(field.second));
   }
   return objects;
 }
 
 std::vector<RosValue::Pointer> RosValue::getValues() const {
-  if (type_ != Type::object && type_ != Type::array && type_ != Type::primitive_array) {
+  if (getType() != Type::object && getType() != Type::array && getType() != Type::primitive_array) {
     throw std::runtime_error("Cannot getValues of a non object or array RosValue");
   }
 
@@ -124,7 +116,7 @@ std::vector<RosValue::Pointer> RosValue::getValues() const {
 }
 
 std::string RosValue::toString(const std::string &path) const {
-  switch (type_) {
+  switch (getType()) {
     case Type::ros_bool: {
       return path + " -> " + (as<bool>() ? "true" : "false");
     }
@@ -172,15 +164,15 @@ std::string RosValue::toString(const std::string &path) const {
     }
     case Type::object: {
       std::ostringstream output;
-      for (const auto& field : *object_info_.field_indexes) {
+      for (const auto& field : *node_.field_indexes) {
         if (path.empty()) {
-          output << object_info_.children.at(field.second)->toString(field.first);
+          output << at(field.second)->toString(field.first);
         } else {
-          output << object_info_.children.at(field.second)->toString(path + "." + field.first);
+          output << at(field.second)->toString(path + "." + field.first);
         }
 
         // No need for a newline if our child is an object or array
-        const auto &object_type = object_info_.children.at(field.second)->getType();
+        const auto &object_type = at(field.second)->getType();
         if (!(object_type == Type::object || object_type == Type::array)) {
           output << std::endl;
         }
@@ -189,9 +181,9 @@ std::string RosValue::toString(const std::string &path) const {
     }
     case Type::array: {
       std::ostringstream output;
-      for (size_t i = 0; i < array_info_.children.length; ++i) {
+      for (size_t i = 0; i < node_.length; ++i) {
         const std::string array_path = path + "[" + std::to_string(i) + "]";
-        output << array_info_.children.at(i)->toString(array_path) << std::endl;
+        output << at(i)->toString(array_path) << std::endl;
       }
       return output.str();
     }
@@ -284,13 +276,14 @@ ITERATOR SETUP
 --------------
 */
 template<>
-const std::string& RosValue::const_iterator<const std::string&, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const {
+const std::string& RosValue::const_iterator<const std::string&, FieldIndex::const_iterator>::operator*() const {
   return index_->first;
 }
 
 template<>
-const std::pair<const std::string&, const RosValue::Pointer> RosValue::const_iterator<const std::pair<const std::string&, const RosValue::Pointer>, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const {
-  return std::make_pair(index_->first, value_.object_info_.children.at(index_->second));
+const std::pair<const std::string&, const RosValue::Pointer> RosValue::const_iterator<const std::pair<const std::string&, const RosValue::Pointer>, FieldIndex::const_iterator>::operator*() const {
+  // Built directly rather than with make_pair, which would copy the name and leave the reference dangling
+  return std::pair<const std::string&, const RosValue::Pointer>(index_->first, value_.at(index_->second));
 }
 
 }
@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "field_index.h"
 #include "span.hpp"
 #include "util.h"
 
@@ -16,16 +17,9 @@ namespace Embag {
 class RosValue {
  public:
   class Pointer;
+  class Ref;
 
-  struct ros_value_list_t {
-    std::weak_ptr<std::vector<RosValue>> base;
-    size_t offset;
-    size_t length;
-
-    const Pointer at(size_t index) const;
-  };
-
-  enum class Type {
+  enum class Type : uint8_t {
     ros_bool,
     int8,
     uint8,
@@ -102,7 +96,7 @@ class RosValue {
   };
 
   Type getType() const {
-    return type_;
+    return node_.type;
   }
 
   Type getElementType() const;
@@ -150,7 +144,7 @@ class RosValue {
     const_iterator(const RosValue& value, size_t index)
       : const_iterator_base<ReturnType, size_t, const_iterator<ReturnType, size_t>>(value, index)
     {
-      if (value.type_ != Type::object && value.type_ != Type::array && value.type_ != Type::primitive_array) {
+      if (value.getType() != Type::object && value.getType() != Type::array && value.getType() != Type::primitive_array) {
         throw std::runtime_error("Cannot iterate the values of a non-object or non-array RosValue");
       }
     }
@@ -161,12 +155,12 @@ class RosValue {
   };
 
   template<class ReturnType>
-  class const_iterator<ReturnType, std::unordered_map<std::string, size_t>::const_iterator> : public const_iterator_base<ReturnType, std::unordered_map<std::string, size_t>::const_iterator, const_iterator<ReturnType, std::unordered_map<std::string, size_t>::const_iterator>> {
+  class const_iterator<ReturnType, FieldIndex::const_iterator> : public const_iterator_base<ReturnType, FieldIndex::const_iterator, const_iterator<ReturnType, FieldIndex::const_iterator>> {
    public:
-    const_iterator(const RosValue& value, std::unordered_map<std::string, size_t>::const_iterator index)
-      : const_iterator_base<ReturnType, std::unordered_map<std::string, size_t>::const_iterator, const_iterator<ReturnType, std::unordered_map<std::string, size_t>::const_iterator>>(value, index)
+    const_iterator(const RosValue& value, FieldIndex::const_iterator index)
+      : const_iterator_base<ReturnType, FieldIndex::const_iterator, const_iterator<ReturnType, FieldIndex::const_iterator>>(value, index)
     {
-      if (value.type_ != Type::object) {
+      if (value.getType() != Type::object) {
         throw std::runtime_error("Cannot iterate the keys or key/value pairs of an non-object RosValue");
       }
     }
@@ -183,111 +177,57 @@ class RosValue {
     return RosValue::const_iterator<IteratorReturnType, size_t>(*this, this->size());
   }
   template<class IteratorReturnType>
-  const_iterator<IteratorReturnType, std::unordered_map<std::string, size_t>::const_iterator> beginItems() const {
-    if (type_ != Type::object) {
+  const_iterator<IteratorReturnType, FieldIndex::const_iterator> beginItems() const {
+    if (getType() != Type::object) {
       throw std::runtime_error("Cannot iterate over the items of a RosValue that is not an object");
     }
 
-    return RosValue::const_iterator<IteratorReturnType, std::unordered_map<std::string, size_t>::const_iterator>(*this, object_info_.field_indexes->cbegin());
+    return RosValue::const_iterator<IteratorReturnType, FieldIndex::const_iterator>(*this, node_.field_indexes->begin());
   }
   template<class IteratorReturnType>
-  const_iterator<IteratorReturnType, std::unordered_map<std::string, size_t>::const_iterator> endItems() const {
-    if (type_ != Type::object) {
+  const_iterator<IteratorReturnType, FieldIndex::const_iterator> endItems() const {
+    if (getType() != Type::object) {
       throw std::runtime_error("Cannot iterate over the items of a RosValue that is not an object");
     }
 
-    return RosValue::const_iterator<IteratorReturnType, std::unordered_map<std::string, size_t>::const_iterator>(*this, object_info_.field_indexes->cend());
+    return RosValue::const_iterator<IteratorReturnType, FieldIndex::const_iterator>(*this, node_.field_indexes->end());
   }
 
  private:
-  struct _array_identifier {};
- public:
-  RosValue(const Type type, const std::shared_ptr<std::vector<char>>& message_buffer, const size_t offset)
-    : type_(type)
-    , primitive_info_({ offset, message_buffer })
-  {
-    if (type_ == Type::object || type_ == Type::array || type_ == Type::primitive_array) {
-      throw std::runtime_error("Cannot create an object or array with this constructor");
-    }
-  }
-  RosValue(const Type type)
-    : type_(type)
-    , primitive_info_({ 0, nullptr })
-  {
-    if (type_ == Type::object || type_ == Type::array || type_ == Type::primitive_array) {
-      throw std::runtime_error("Cannot create an object or array with this constructor");
-    }
-  }
-  RosValue(const std::shared_ptr<std::unordered_map<std::string, size_t>>& field_indexes)
-    : type_(Type::object)
-    , object_info_()
-  {
-    object_info_.field_indexes = field_indexes;
-  }
-  RosValue(const _array_identifier &i)
-    : type_(Type::array)
-    , array_info_()
-  {
-  }
-  RosValue(const Type element_type, const std::shared_ptr<std::vector<char>>& message_buffer)
-    : type_(Type::primitive_array)
-    , primitive_array_info_(element_type, message_buffer)
-  {
-  }
-
-  // Define custom copy constructor, destructor, and assignment operator because of the union for the infos
-  RosValue(const RosValue &other): type_(other.type_) {
-    if (type_ == Type::object) {
-      new (&object_info_) auto(other.object_info_);
-    } else if (type_ == Type::array) {
-      new (&array_info_) auto(other.array_info_);
-    } else if (type_ == Type::primitive_array) {
-      new (&primitive_array_info_) auto(other.primitive_array_info_);
-    } else {
-      new (&primitive_info_) auto(other.primitive_info_);
-    }
-  }
-
-  ~RosValue() {
-    destroy_object_info();
-  }
-
-  RosValue& operator=(const RosValue& other) {
-    if (type_ != other.type_) {
-      destroy_object_info();
-    }
-
-    type_ = other.type_;
-    if (type_ == Type::object) {
-      object_info_ = other.object_info_;
-    } else if (type_ == Type::array) {
-      array_info_ = other.array_info_;
-    } else if (type_ == Type::primitive_array) {
-      primitive_array_info_ = other.primitive_array_info_;
-    } else {
-      primitive_info_ = other.primitive_info_;
-    }
-
-    return *this;
-  }
+  // The form in which a message's values are stored: a type tag, an offset and either a length or the field
+  // indexes of an object, in 16 bytes.  Nodes don't own anything; every node of a message refers to the same storage_t.
+  struct node_t {
+    Type type;
+    // For primitive arrays, the type of the elements
+    Type element_type;
+    // For primitives and primitive arrays, the offset of the data in the message buffer.
+    // For objects and arrays, the index of the first child node.
+    uint32_t offset;
+    union {
+      // For arrays and primitive arrays
+      size_t length;
+      // For objects
+      const FieldIndex *field_indexes;
+    };
+  };
+  static_assert(sizeof(node_t) <= 16, "RosValue nodes should stay compact");
 
-  void destroy_object_info() {
-    if (type_ == Type::object) {
-      object_info_.~object_info_t();
-    } else if (type_ == Type::array) {
-      array_info_.~array_info_t();
-    } else if (type_ == Type::primitive_array) {
-      primitive_array_info_.~primitive_array_info_t();
-    } else {
-      primitive_info_.~primitive_info_t();
-    }
-  }
+ public:
+  // Owns everything the values of a parsed message refer to
+  struct storage_t : std::enable_shared_from_this<storage_t> {
+    std::shared_ptr<std::vector<char>> message_buffer;
+    // Keeps the field indexes of the message's objects alive
+    std::shared_ptr<const void> schema;
+    std::vector<node_t> nodes;
+  };
 
   // Convenience accessors
   const Pointer operator()(const std::string &key) const;
   const Pointer operator[](const std::string &key) const;
   const Pointer operator[](const size_t idx) const;
+  const Pointer operator[](const Symbol &key) const;
   const Pointer get(const std::string &key) const;
+  const Pointer get(const Symbol &key) const;
   const Pointer at(size_t idx) const;
   const Pointer at(const std::string &key) const;
 
@@ -296,7 +236,7 @@ class RosValue {
 
   template<typename T>
   const T as() const {
-    if (type_ == Type::object || type_ == Type::array) {
+    if (getType() == Type::object || getType() == Type::array) {
       throw std::runtime_error("Value cannot be an object or array for as");
     }
 
@@ -305,18 +245,26 @@ class RosValue {
   }
 
   bool has(const std::string &key) const {
-    if (type_ != Type::object) {
+    if (getType() != Type::object) {
       throw std::runtime_error("Value is not an object");
     }
 
-    return object_info_.field_indexes->count(key);
+    return node_.field_indexes->count(key);
+  }
+
+  bool has(const Symbol &key) const {
+    if (getType() != Type::object) {
+      throw std::runtime_error("Value is not an object");
+    }
+
+    return node_.field_indexes->count(key);
   }
 
   size_t size() const {
-    if (type_ == Type::array || type_ == Type::object) {
-      return getChildren().length;
-    } else if (type_ == Type::primitive_array) {
-      return primitive_array_info_.length;
+    if (getType() == Type::array || getType() == Type::primitive_array) {
+      return node_.length;
+    } else if (getType() == Type::object) {
+      return node_.field_indexes->size();
     } else {
       throw std::runtime_error("Value is not an array or an object");
     }
@@ -339,128 +287,158 @@ class RosValue {
   struct identity { typedef T type; };
 
  private:
-  struct primitive_info_t {
-    size_t offset;
-    std::shared_ptr<std::vector<char>> message_buffer;
-  };
+  RosValue(const storage_t *storage, const node_t &node)
+    : storage_(storage)
+    , node_(node)
+  {
+  }
 
-  struct primitive_array_info_t {
-    primitive_array_info_t(const Type element_type, const std::shared_ptr<std::vector<char>>& message_buffer)
-      : element_type(element_type)
-      , message_buffer(message_buffer)
-    {
+  // The child at the index or with the name, without taking ownership of the message
+  const RosValue child(size_t idx) const;
+  const RosValue child(const std::string &key) const {
+    if (getType() != Type::object) {
+      throw std::runtime_error("Value is not an object");
     }
 
-    Type element_type;
-    size_t offset;
-    size_t length;
-    std::shared_ptr<std::vector<char>> message_buffer;
-  };
+    return child(node_.field_indexes->at(key));
+  }
 
-  struct array_info_t {
-    ros_value_list_t children;
-  };
+  const RosValue child(const Symbol &key) const {
+    if (getType() != Type::object) {
+      throw std::runtime_error("Value is not an object");
+    }
 
-  struct object_info_t {
-    ros_value_list_t children;
-    std::shared_ptr<std::unordered_map<std::string, size_t>> field_indexes;
-  };
+    return child(node_.field_indexes->at(key));
+  }
 
-  Type type_;
-  union {
-    primitive_info_t primitive_info_;
-    primitive_array_info_t primitive_array_info_;
-    array_info_t array_info_;
-    object_info_t object_info_;
-  };
+  const storage_t *storage_;
+  node_t node_;
 
   template<typename T>
   const T& getPrimitive() const {
-    return reinterpret_cast<const T&>(primitive_info_.message_buffer->at(primitive_info_.offset));
-  }
-
-  const ros_value_list_t& getChildren() const {
-    switch(type_) {
-      case Type::object:
-        return object_info_.children;
-      case Type::array:
-        return array_info_.children;
-      default:
-        throw std::runtime_error("Cannot getChildren of a RosValue that is not an object or array");
-    }
+    return reinterpret_cast<const T&>(storage_->message_buffer->at(node_.offset));
   }
 
   friend class MessageParser;
 };
 
+// Gives shared ownership of a value's message, so a Pointer stays valid after the message it came from is gone
 class RosValue::Pointer {
- private:
-  struct vector_based_value_info_t {
-    std::shared_ptr<std::vector<RosValue>> base;
-    size_t index;
-  };
-  boost::variant<RosValue, vector_based_value_info_t> info_;
-
  public:
   Pointer()
-    : info_(vector_based_value_info_t({nullptr, 0}))
+    : value_(nullptr, node_t{})
   {
   }
 
-  Pointer(const std::weak_ptr<std::vector<RosValue>>& base)
-    : Pointer(base, 0)
+  Pointer(const std::shared_ptr<const storage_t>& storage, size_t index)
+    : storage_(storage)
+    , value_(storage.get(), storage->nodes[index])
   {
   }
 
-  Pointer(const std::weak_ptr<std::vector<RosValue>>& base, size_t index)
-    : Pointer(base.lock(), index)
+  Pointer(const std::shared_ptr<const storage_t>& storage, const RosValue &value)
+    : storage_(storage)
+    , value_(value)
   {
   }
 
-  Pointer(const std::shared_ptr<std::vector<RosValue>>& base, size_t index)
-    : info_(vector_based_value_info_t({base, index}))
-  {
+  const Pointer operator()(const std::string &key) const {
+    return value_(key);
   }
 
-  Pointer(const RosValue::Type type, const std::shared_ptr<std::vector<char>>& message_buffer, const size_t offset)
-    : info_(RosValue(type, message_buffer, offset))
-  {
+  const Pointer operator[](const std::string &key) const {
+    return value_[key];
   }
 
-  const Pointer operator()(const std::string &key) const {
-    return (**this)(key);
+  const Pointer operator[](const size_t idx) const {
+    return value_[idx];
   }
 
-  const Pointer operator[](const std::string &key) const {
-    return (**this)[key];
+  const Pointer operator[](const Symbol &key) const {
+    return value_[key];
   }
 
-  const Pointer operator[](const size_t idx) const {
-    return (**this)[idx];
+  const RosValue* operator->() const {
+    return &value_;
+  }
+
+  // Returns a non-owning reference to the value, for traversal without reference counting
+  const Ref borrow() const;
+
+ private:
+  std::shared_ptr<const storage_t> storage_;
+  RosValue value_;
+};
+
+// A borrowed reference to a value that can be used just like a Pointer, but doesn't share ownership of the message.
+// Looking up children costs only pointer arithmetic, no reference counting.  A Ref must not outlive the Pointer
+// or RosMessage it was borrowed from.
+class RosValue::Ref {
+ public:
+  const Ref operator()(const std::string &key) const {
+    return Ref(value_.child(key));
+  }
+
+  const Ref operator[](const std::string &key) const {
+    return Ref(value_.child(key));
+  }
+
+  const Ref operator[](const size_t idx) const {
+    return Ref(value_.child(idx));
+  }
+
+  const Ref operator[](const Symbol &key) const {
+    return Ref(value_.child(key));
   }
 
   const RosValue* operator->() const {
-    return &**this;
+    return &value_;
   }
 
  private:
-  const RosValue& operator*() const {
-    if (info_.which() == 0) {
-      return boost::get<RosValue>(info_);
-    } else {
-      vector_based_value_info_t info = boost::get<vector_based_value_info_t>(info_);
-      return info.base->at(info.index);
-    }
+  explicit Ref(const RosValue &value)
+    : value_(value)
+  {
   }
+
+  RosValue value_;
+
+  friend class Pointer;
 };
 
+inline const RosValue::Ref RosValue::Pointer::borrow() const {
+  return Ref(value_);
+}
+
+inline const RosValue RosValue::child(size_t idx) const {
+  if (getType() == Type::object || getType() == Type::array) {
+    if (idx >= size()) {
+      throw std::out_of_range("Provided index is out of range!");
+    }
+
+    return RosValue(storage_, storage_->nodes[node_.offset + idx]);
+  } else if (getType() == Type::primitive_array) {
+    if (idx >= node_.length) {
+      throw std::out_of_range("Provided index is out of range!");
+    }
+
+    node_t element{};
+    element.type = node_.element_type;
+    element.element_type = node_.element_type;
+    element.offset = static_cast<uint32_t>(node_.offset + idx * primitiveTypeToSize(node_.element_type));
+    return RosValue(storage_, element);
+  } else {
+    throw std::runtime_error("Value is not an array or object");
+  }
+}
+
 template<>
 const std::string RosValue::as<std::string>() const;
 
 template<>
-const std::string& RosValue::const_iterator<const std::string&, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const;
+const std::string& RosValue::const_iterator<const std::string&, FieldIndex::const_iterator>::operator*() const;
 
 template<>
-const std::pair<const std::string&, const RosValue&> RosValue::const_iterator<const std::pair<const std::string&, const RosValue&>, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const;
+const std::pair<const std::string&, const RosValue&> RosValue::const_iterator<const std::pair<const std::string&, const RosValue&>, FieldIndex::const_iterator>::operator*() const;
 
 }
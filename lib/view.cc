@@ -1,3 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "field_path.h"
 #include "view.h"
 #include "ros_message.h"
 #include "ros_value.h"
@@ -8,17 +19,66 @@ View::iterator View::begin() {
   return iterator{this, iterator::begin_cond_t{}};
 }
 
+View::iterator View::begin(const plan_t &plan) {
+  return iterator{this, plan};
+}
+
 View::iterator View::end() {
   return iterator{this};
 }
 
-View::iterator::iterator(View *view, begin_cond_t begin_cond) : view_(view) {
-  // Read a message from each bag into the corresponding bag wrapper
+View::iterator View::rbegin() {
+  return iterator{this, planChunks(true)};
+}
+
+View::iterator View::rend() {
+  return iterator{this};
+}
+
+std::shared_ptr<RosMessage> View::shared_iterator::next() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  if (iterator_ == end_) {
+    return nullptr;
+  }
+
+  auto message = *iterator_;
+  ++iterator_;
+  return message;
+}
+
+View::iterator::iterator(View *view, begin_cond_t begin_cond) : iterator(view, view->planChunks(false)) {
+}
+
+View::iterator::iterator(View *view, const plan_t &plan)
+  : view_(view)
+  , reverse_(plan.reverse)
+  , msg_queue_(timestamp_compare_t{plan.reverse})
+{
   for (auto &pair : view_->bag_wrappers_) {
     auto& wrapper = pair.second;
-    wrapper->chunk_iter = wrapper->chunks_to_parse.begin();
+    wrapper->planned_chunks.clear();
+    wrapper->planned_chunk_index = 0;
+    wrapper->current_buffer.reset();
+    wrapper->processed_bytes = 0;
+    wrapper->reverse_message_offsets.clear();
+  }
 
-    readMessage(wrapper);
+  for (const auto &chunk_read : plan.chunks) {
+    const auto it = view_->bag_wrappers_.find(plan.bags.at(chunk_read.bag_index));
+    if (it == view_->bag_wrappers_.end()) {
+      throw std::runtime_error("This plan reads a bag that is not selected by the view");
+    }
+
+    it->second->planned_chunks.push_back(chunk_read.chunk);
+  }
+
+  // Read a message from each bag into the corresponding bag wrapper
+  for (auto &pair : view_->bag_wrappers_) {
+    if (reverse_) {
+      readPreviousMessage(pair.second);
+    } else {
+      readMessage(pair.second);
+    }
   }
 }
 
@@ -35,8 +95,17 @@ std::shared_ptr<RosMessage> View::iterator::operator*() const {
   message->timestamp = wrapper->current_timestamp;
   message->md5 = connection.data.md5sum;
   message->raw_data_len = wrapper->current_message_len;
+  message->chunk_position = wrapper->current_chunk_position;
+  message->chunk_offset = wrapper->current_chunk_offset;
   message->msg_def_ = msg_def;
 
+  if (!wrapper->projections.empty()) {
+    const auto projection = wrapper->projections.find(wrapper->current_connection_id);
+    if (projection != wrapper->projections.end()) {
+      message->program_ = projection->second;
+    }
+  }
+
   return message;
 }
 
@@ -73,21 +142,46 @@ View::iterator::header_t View::iterator::readHeader(const RosBagTypes::record_t
   return header;
 }
 
+RosBagTypes::record_t View::iterator::readRecordAt(const std::vector<char> &buffer, size_t record_offset) {
+  RosBagTypes::record_t record{};
+  if (record_offset + sizeof(record.header_len) > buffer.size()) {
+    throw std::runtime_error("Index entry points past the end of its chunk, perhaps this bag is corrupt...");
+  }
+
+  std::memcpy(&record.header_len, buffer.data() + record_offset, sizeof(record.header_len));
+  const size_t data_len_offset = record_offset + sizeof(record.header_len) + record.header_len;
+  if (data_len_offset + sizeof(record.data_len) > buffer.size()) {
+    throw std::runtime_error("Index entry points past the end of its chunk, perhaps this bag is corrupt...");
+  }
+
+  std::memcpy(&record.data_len, buffer.data() + data_len_offset, sizeof(record.data_len));
+  const size_t data_offset = data_len_offset + sizeof(record.data_len);
+  if (data_offset + record.data_len > buffer.size()) {
+    throw std::runtime_error("Index entry points past the end of its chunk, perhaps this bag is corrupt...");
+  }
+
+  record.header = buffer.data() + record_offset + sizeof(record.header_len);
+  record.data = buffer.data() + data_offset;
+  return record;
+}
+
 /*
  * initialize: fill the queue with a message from each bag
  * store the message with the smallest timestamp in current_msg_ stuff and remove it from the queue
  * read another message from the bag that had its message removed from the queue
  */
 void View::iterator::readMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper) {
-  while (bag_wrapper->chunk_iter != bag_wrapper->chunks_to_parse.end()) {
+  while (bag_wrapper->planned_chunk_index < bag_wrapper->planned_chunks.size()) {
+    const auto& chunk = bag_wrapper->planned_chunks[bag_wrapper->planned_chunk_index];
+
     if (!bag_wrapper->current_buffer) {
-      const auto& chunk = *(bag_wrapper->chunk_iter);
       bag_wrapper->current_buffer = std::make_shared<std::vector<char>>(chunk->uncompressed_size);
       chunk->decompress(&bag_wrapper->current_buffer->at(0));
       bag_wrapper->uncompressed_size = chunk->uncompressed_size;
     }
 
     while (bag_wrapper->processed_bytes < bag_wrapper->uncompressed_size) {
+      const size_t record_offset = bag_wrapper->processed_bytes;
       RosBagTypes::record_t record{};
 
       // TODO: just use pointers instead of copying memory?
@@ -109,16 +203,28 @@ void View::iterator::readMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper) {
 
       switch (header.op) {
         case RosBagTypes::header_t::op::MESSAGE_DATA: {
-          // Check if this is a topic we're interested in
+          // Check if this is a topic and time we're interested in
           if (bag_wrapper->connection_ids.count(header.connection_id) == 0) {
             continue;
           }
 
+          // Filter on the record header before anything about the message is built
+          const auto &connection = bag_wrapper->bag->connections_[header.connection_id];
+          if (!view_->matches(connection.data, header.timestamp)) {
+            continue;
+          }
+
+          if (bag_wrapper->sampledOut(chunk, header.connection_id, record_offset)) {
+            continue;
+          }
+
           bag_wrapper->current_message_buffer = bag_wrapper->current_buffer;
           bag_wrapper->current_message_data_offset = record.data - &bag_wrapper->current_message_buffer->at(0);
           bag_wrapper->current_message_len = record.data_len;
           bag_wrapper->current_connection_id = header.connection_id;
           bag_wrapper->current_timestamp = header.timestamp;
+          bag_wrapper->current_chunk_position = chunk->info.chunk_pos;
+          bag_wrapper->current_chunk_offset = static_cast<uint32_t>(record_offset);
 
           msg_queue_.push(bag_wrapper);
           return;
@@ -133,23 +239,518 @@ void View::iterator::readMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper) {
       }
     }
 
-    bag_wrapper->chunk_iter++;
+    bag_wrapper->planned_chunk_index++;
     bag_wrapper->current_buffer.reset();
     bag_wrapper->processed_bytes = 0;
   }
 }
 
+/*
+ * The reverse counterpart of readMessage.  Rather than scanning the records of a chunk, the offsets of the
+ * wanted messages are taken from the chunk's index so chunks without any are never decompressed, and the
+ * messages of each chunk are then read from the last offset to the first.
+ */
+void View::iterator::readPreviousMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper) {
+  auto &offsets = bag_wrapper->reverse_message_offsets;
+
+  while (bag_wrapper->planned_chunk_index < bag_wrapper->planned_chunks.size()) {
+    const auto& chunk = bag_wrapper->planned_chunks[bag_wrapper->planned_chunk_index];
+
+    if (!bag_wrapper->current_buffer) {
+      offsets.clear();
+      for (const auto &block : chunk->index_blocks) {
+        if (bag_wrapper->connection_ids.count(block.connection_id) == 0) {
+          continue;
+        }
+
+        const auto &connection = bag_wrapper->bag->connections_[block.connection_id];
+        for (size_t i = 0; i < block.message_count; ++i) {
+          const auto &entry = block.entries[i];
+          if (view_->matches(connection.data, entry.time) && !bag_wrapper->sampledOut(chunk, block.connection_id, entry.offset)) {
+            offsets.push_back(entry.offset);
+          }
+        }
+      }
+
+      if (offsets.empty()) {
+        bag_wrapper->planned_chunk_index++;
+        continue;
+      }
+
+      std::sort(offsets.begin(), offsets.end());
+
+      bag_wrapper->current_buffer = std::make_shared<std::vector<char>>(chunk->uncompressed_size);
+      chunk->decompress(&bag_wrapper->current_buffer->at(0));
+      bag_wrapper->uncompressed_size = chunk->uncompressed_size;
+    }
+
+    if (!offsets.empty()) {
+      const size_t record_offset = offsets.back();
+      offsets.pop_back();
+
+      const auto record = readRecordAt(*bag_wrapper->current_buffer, record_offset);
+      const auto header = readHeader(record);
+      if (header.op != RosBagTypes::header_t::op::MESSAGE_DATA) {
+        throw std::runtime_error("Index entry does not point to a message record, perhaps this bag is corrupt...");
+      }
+
+      bag_wrapper->current_message_buffer = bag_wrapper->current_buffer;
+      bag_wrapper->current_message_data_offset = record.data - bag_wrapper->current_buffer->data();
+      bag_wrapper->current_message_len = record.data_len;
+      bag_wrapper->current_connection_id = header.connection_id;
+      bag_wrapper->current_timestamp = header.timestamp;
+      bag_wrapper->current_chunk_position = chunk->info.chunk_pos;
+      bag_wrapper->current_chunk_offset = static_cast<uint32_t>(record_offset);
+
+      msg_queue_.push(bag_wrapper);
+      return;
+    }
+
+    bag_wrapper->planned_chunk_index++;
+    bag_wrapper->current_buffer.reset();
+  }
+}
+
+bool View::matches(const RosBagTypes::connection_data_t &connection, const RosValue::ros_time_t &timestamp) const {
+  if (timestamp < start_time_ || end_time_ < timestamp) {
+    return false;
+  }
+
+  return !predicate_ || predicate_(connection, timestamp);
+}
+
+bool View::iterator::bag_wrapper_t::sampledOut(
+    const RosBagTypes::chunk_t *chunk,
+    uint32_t connection_id,
+    uint32_t offset) const {
+  if (sampled_connection_ids.count(connection_id) == 0) {
+    return false;
+  }
+
+  const auto it = sampled_offsets.find(chunk);
+  return it == sampled_offsets.end() || !std::binary_search(it->second.begin(), it->second.end(), offset);
+}
+
+bool View::iterator::bag_wrapper_t::hasWantedMessages(const RosBagTypes::chunk_t *chunk, const View &view) const {
+  for (const auto &block : chunk->index_blocks) {
+    if (connection_ids.count(block.connection_id) == 0) {
+      continue;
+    }
+
+    if (sampled_connection_ids.count(block.connection_id)) {
+      if (sampled_offsets.count(chunk)) {
+        return true;
+      }
+      continue;
+    }
+
+    const auto &connection = bag->connections_[block.connection_id];
+    for (size_t i = 0; i < block.message_count; ++i) {
+      if (view.matches(connection.data, block.entries[i].time)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
 View::iterator &View::iterator::operator++() {
   auto wrapper = msg_queue_.top();
   msg_queue_.pop();
 
-  readMessage(wrapper);
+  if (reverse_) {
+    readPreviousMessage(wrapper);
+  } else {
+    readMessage(wrapper);
+  }
 
   return *this;
 }
 
+namespace {
+
+// The index entries of the messages of the given connections in a chunk that fall in a time range, ordered by time.
+// The index gives the position of every wanted message, so no other record needs to be looked at.
+std::vector<RosBagTypes::index_entry_t> wantedEntries(
+    const RosBagTypes::chunk_t &chunk,
+    const std::unordered_set<uint32_t> &connection_ids,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time) {
+  std::vector<RosBagTypes::index_entry_t> entries;
+  for (const auto &block : chunk.index_blocks) {
+    if (connection_ids.count(block.connection_id) == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < block.message_count; ++i) {
+      const auto &entry = block.entries[i];
+      if (!(entry.time < start_time) && !(end_time < entry.time)) {
+        entries.push_back(entry);
+      }
+    }
+  }
+
+  std::sort(entries.begin(), entries.end(), [](const RosBagTypes::index_entry_t &left, const RosBagTypes::index_entry_t &right) {
+    return left.time < right.time || (left.time == right.time && left.offset < right.offset);
+  });
+
+  return entries;
+}
+
+// Calls read_chunk for every chunk index on a pool of threads, or one per core if threads is 0.  The first exception
+// thrown stops the remaining reads and is rethrown.
+void readChunksInParallel(size_t chunk_count, size_t threads, const std::function<void(size_t)> &read_chunk) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, chunk_count);
+
+  std::atomic<size_t> next_chunk{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  const auto work = [&]() {
+    try {
+      for (size_t i = next_chunk++; i < chunk_count; i = next_chunk++) {
+        read_chunk(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      next_chunk = chunk_count;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// Chunks are read in order of their start time, but the time ranges of chunks can overlap.  Returns the order that
+// sorts the timestamps, or nothing if they already are.
+std::vector<size_t> timestampOrder(const std::vector<RosValue::ros_time_t> &timestamps) {
+  std::vector<size_t> order;
+  if (std::is_sorted(timestamps.begin(), timestamps.end())) {
+    return order;
+  }
+
+  order.resize(timestamps.size());
+  for (size_t i = 0; i < timestamps.size(); ++i) {
+    order[i] = i;
+  }
+
+  std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) {
+    return timestamps[left] < timestamps[right];
+  });
+
+  return order;
+}
+
+// The layout of an object whose fields are all of fixed size, as found in the message
+std::vector<View::records_t::field_t> fixedLayout(const ParseProgram &program) {
+  std::vector<View::records_t::field_t> fields;
+  for (size_t i = 0; i < program.fields.size(); ++i) {
+    const auto &instruction = program.fields[i];
+    View::records_t::field_t field{
+      program.field_indexes->name(i),
+      instruction.program ? RosValue::Type::object : instruction.type,
+      static_cast<uint32_t>(std::max(instruction.array_size, 0)),
+      instruction.offset,
+      instruction.element_size,
+      {},
+    };
+
+    if (instruction.program != nullptr) {
+      field.fields = fixedLayout(*instruction.program);
+    }
+
+    fields.push_back(std::move(field));
+  }
+
+  return fields;
+}
+
+// Appends the fixed size fields of an object to a record layout at row_size, with offsets relative to object_start,
+// along with the instructions that copy them out of a message: runs of fixed size data are copied and everything else
+// is skipped over.
+void recordLayout(
+    const ParseProgram &program,
+    std::vector<View::records_t::field_t> &fields,
+    std::vector<ParseProgram::instruction_t> &instructions,
+    size_t object_start,
+    size_t &row_size) {
+  for (size_t i = 0; i < program.fields.size(); ++i) {
+    const auto &instruction = program.fields[i];
+    const auto &name = program.field_indexes->name(i);
+
+    if (instruction.size != ParseProgram::variable_size) {
+      View::records_t::field_t field{
+        name,
+        instruction.program ? RosValue::Type::object : instruction.type,
+        static_cast<uint32_t>(std::max(instruction.array_size, 0)),
+        row_size - object_start,
+        instruction.element_size,
+        {},
+      };
+
+      if (instruction.program != nullptr) {
+        field.fields = fixedLayout(*instruction.program);
+      }
+
+      fields.push_back(std::move(field));
+      ParseProgram::appendSkip(instructions, instruction);
+      row_size += instruction.size;
+    } else if (instruction.opcode == ParseProgram::Opcode::object) {
+      View::records_t::field_t field{name, RosValue::Type::object, 0, row_size - object_start, 0, {}};
+      const size_t field_start = row_size;
+      recordLayout(*instruction.program, field.fields, instructions, field_start, row_size);
+      field.size = row_size - field_start;
+
+      if (!field.fields.empty()) {
+        fields.push_back(std::move(field));
+      }
+    } else {
+      instructions.push_back(instruction);
+    }
+  }
+}
+
+// Rearranges values of the given size into the given order
+void reorder(std::vector<char> &bytes, size_t size, const std::vector<size_t> &order) {
+  std::vector<char> ordered(bytes.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    std::memcpy(ordered.data() + i * size, bytes.data() + order[i] * size, size);
+  }
+  bytes.swap(ordered);
+}
+
+// Rearranges runs of values of the given size, the ith of which starts at offsets[i], into the given order
+void reorder(std::vector<char> &bytes, std::vector<uint64_t> &offsets, size_t size, const std::vector<size_t> &order) {
+  std::vector<char> ordered_bytes(bytes.size());
+  std::vector<uint64_t> ordered_offsets(offsets.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const uint64_t run_length = offsets[order[i] + 1] - offsets[order[i]];
+    std::memcpy(ordered_bytes.data() + ordered_offsets[i] * size, bytes.data() + offsets[order[i]] * size, run_length * size);
+    ordered_offsets[i + 1] = ordered_offsets[i] + run_length;
+  }
+  bytes.swap(ordered_bytes);
+  offsets.swap(ordered_offsets);
+}
+
+}
+
+RosValue::ros_time_t View::records_t::timestamp(size_t index) const {
+  int64_t nanoseconds;
+  std::memcpy(&nanoseconds, row(index), sizeof(nanoseconds));
+  return RosValue::ros_time_t{static_cast<uint32_t>(nanoseconds / 1000000000), static_cast<uint32_t>(nanoseconds % 1000000000)};
+}
+
+const View::column_t &View::columns_t::operator[](const std::string &path) const {
+  for (const auto &column : columns) {
+    if (column.path == path) {
+      return column;
+    }
+  }
+
+  throw std::out_of_range("No column was read for " + path);
+}
+
+View::columns_t View::readColumns(const std::string &topic, const std::vector<std::string> &paths, size_t threads) const {
+  return readColumns(topic, paths, RosValue::ros_time_t{0, 0}, RosValue::ros_time_t{UINT32_MAX, UINT32_MAX}, threads);
+}
+
+View::columns_t View::readColumns(
+    const std::string &topic,
+    const std::vector<std::string> &paths,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads) const {
+  View selection{*this};
+  selection.getMessages({topic}, start_time, end_time);
+  const auto plan = selection.planChunks(false);
+
+  columns_t result;
+  for (const auto &path : paths) {
+    result.columns.push_back({path, RosValue::Type::object, {}, {}});
+  }
+
+  // Paths are resolved against the definition of the topic in each bag
+  struct bag_paths_t {
+    std::unordered_set<uint32_t> connection_ids;
+    std::vector<FieldPath> paths;
+  };
+
+  std::vector<bag_paths_t> bag_paths(plan.bags.size());
+  bool found_topic = false;
+  for (size_t i = 0; i < plan.bags.size(); ++i) {
+    const auto &bag = plan.bags[i];
+    if (!bag->topicInBag(topic)) {
+      continue;
+    }
+
+    for (const auto &connection_record : bag->topic_connection_map_.at(topic)) {
+      bag_paths[i].connection_ids.emplace(connection_record->id);
+    }
+
+    const auto msg_def = bag->msgDefForTopic(topic);
+    for (size_t c = 0; c < paths.size(); ++c) {
+      bag_paths[i].paths.emplace_back(*msg_def, paths[c]);
+
+      // Arrays of primitives are read as the run of their elements
+      const auto &path = bag_paths[i].paths.back();
+      const bool is_array = path.type() == RosValue::Type::primitive_array;
+      const auto type = is_array ? path.elementType() : path.type();
+      if (type == RosValue::Type::object || type == RosValue::Type::array || type == RosValue::Type::primitive_array || type == RosValue::Type::string) {
+        throw std::runtime_error("Field path " + paths[c] + " does not lead to a primitive field or an array of them");
+      }
+
+      if (found_topic && (type != result.columns[c].type || is_array != result.columns[c].isArray())) {
+        throw std::runtime_error("The type of " + paths[c] + " differs between the bags of this view");
+      }
+
+      result.columns[c].type = type;
+      if (is_array) {
+        result.columns[c].offsets.assign(1, 0);
+      }
+    }
+
+    found_topic = true;
+  }
+
+  if (!found_topic) {
+    throw std::runtime_error("None of the bags of this view have the topic " + topic);
+  }
+
+  struct chunk_columns_t {
+    std::vector<RosValue::ros_time_t> timestamps;
+    std::vector<std::vector<char>> columns;
+    // For array columns, the number of elements of each message
+    std::vector<std::vector<uint64_t>> lengths;
+  };
+
+  std::vector<chunk_columns_t> chunk_columns(plan.chunks.size());
+
+  const auto read_chunk = [&](size_t chunk_index) {
+    const auto &chunk_read = plan.chunks[chunk_index];
+    const auto &chunk = *chunk_read.chunk;
+    const auto &chunk_paths = bag_paths[chunk_read.bag_index];
+
+    const auto entries = wantedEntries(chunk, chunk_paths.connection_ids, start_time, end_time);
+    if (entries.empty()) {
+      return;
+    }
+
+    std::vector<char> buffer(chunk.uncompressed_size);
+    chunk.decompress(buffer.data());
+
+    auto &output = chunk_columns[chunk_index];
+    output.timestamps.reserve(entries.size());
+    output.columns.resize(paths.size());
+    output.lengths.resize(paths.size());
+    for (size_t c = 0; c < paths.size(); ++c) {
+      if (result.columns[c].isArray()) {
+        output.lengths[c].reserve(entries.size());
+      } else {
+        output.columns[c].resize(entries.size() * RosValue::primitiveTypeToSize(result.columns[c].type));
+      }
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto record = iterator::readRecordAt(buffer, entries[i].offset);
+      output.timestamps.push_back(entries[i].time);
+
+      for (size_t c = 0; c < paths.size(); ++c) {
+        const auto &path = chunk_paths.paths[c];
+        const size_t size = RosValue::primitiveTypeToSize(result.columns[c].type);
+        size_t offset = path.offsetIn(record.data, record.data_len);
+        if (!result.columns[c].isArray()) {
+          if (offset + size > record.data_len) {
+            throw std::runtime_error("Message is shorter than its definition requires");
+          }
+
+          std::memcpy(output.columns[c].data() + i * size, record.data + offset, size);
+          continue;
+        }
+
+        size_t array_length = static_cast<size_t>(path.arraySize());
+        if (path.arraySize() == -1) {
+          array_length = ParseProgram::readLength(record.data, record.data_len, offset);
+          offset += sizeof(uint32_t);
+        }
+
+        if (offset + array_length * size > record.data_len) {
+          throw std::runtime_error("Message is shorter than its definition requires");
+        }
+
+        output.columns[c].insert(output.columns[c].end(), record.data + offset, record.data + offset + array_length * size);
+        output.lengths[c].push_back(array_length);
+      }
+    }
+  };
+
+  readChunksInParallel(plan.chunks.size(), threads, read_chunk);
+
+  size_t message_count = 0;
+  for (const auto &output : chunk_columns) {
+    message_count += output.timestamps.size();
+  }
+
+  result.timestamps.reserve(message_count);
+  for (size_t c = 0; c < paths.size(); ++c) {
+    if (result.columns[c].isArray()) {
+      result.columns[c].offsets.reserve(message_count + 1);
+    } else {
+      result.columns[c].bytes.reserve(message_count * RosValue::primitiveTypeToSize(result.columns[c].type));
+    }
+  }
+
+  for (const auto &output : chunk_columns) {
+    result.timestamps.insert(result.timestamps.end(), output.timestamps.begin(), output.timestamps.end());
+    for (size_t c = 0; c < output.columns.size(); ++c) {
+      auto &column = result.columns[c];
+      column.bytes.insert(column.bytes.end(), output.columns[c].begin(), output.columns[c].end());
+      for (const uint64_t length : output.lengths[c]) {
+        column.offsets.push_back(column.offsets.back() + length);
+      }
+    }
+  }
+
+  const auto order = timestampOrder(result.timestamps);
+  if (!order.empty()) {
+    std::vector<RosValue::ros_time_t> timestamps(message_count);
+    for (size_t i = 0; i < message_count; ++i) {
+      timestamps[i] = result.timestamps[order[i]];
+    }
+    result.timestamps.swap(timestamps);
+
+    for (auto &column : result.columns) {
+      if (column.isArray()) {
+        reorder(column.bytes, column.offsets, RosValue::primitiveTypeToSize(column.type), order);
+      } else {
+        reorder(column.bytes, RosValue::primitiveTypeToSize(column.type), order);
+      }
+    }
+  }
+
+  return result;
+}
+
 View View::getMessages() {
   bag_wrappers_.clear();
+  start_time_ = RosValue::ros_time_t{0, 0};
+  end_time_ = RosValue::ros_time_t{UINT32_MAX, UINT32_MAX};
+  predicate_ = nullptr;
 
   for (const auto& bag : bags_) {
     bag_wrappers_[bag] = std::make_shared<iterator::bag_wrapper_t>();
@@ -172,7 +773,17 @@ View View::getMessages(const std::string &topic) {
 }
 
 View View::getMessages(const std::vector<std::string> &topics) {
+  return getMessages(topics, RosValue::ros_time_t{0, 0}, RosValue::ros_time_t{UINT32_MAX, UINT32_MAX});
+}
+
+View View::getMessages(
+    const std::vector<std::string> &topics,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time) {
   bag_wrappers_.clear();
+  start_time_ = start_time;
+  end_time_ = end_time;
+  predicate_ = nullptr;
 
   for (const auto& bag : bags_) {
     bag_wrappers_[bag] = std::make_shared<iterator::bag_wrapper_t>();
@@ -185,6 +796,12 @@ View View::getMessages(const std::vector<std::string> &topics) {
 
       for (const auto &connection_record : bag->topic_connection_map_.at(topic)) {
         for (const auto &block : connection_record->blocks) {
+          // Chunks that lie entirely outside of the time range are never read
+          const auto &info = block.into_chunk->info;
+          if (info.end_time < start_time || info.start_time > end_time) {
+            continue;
+          }
+
           bag_wrappers_[bag]->chunks_to_parse.emplace(block.into_chunk);
         }
 
@@ -200,48 +817,871 @@ View View::getMessages(std::initializer_list<std::string> topics) {
   return getMessages(std::vector<std::string>(topics.begin(), topics.end()));
 }
 
-RosValue::ros_time_t View::getStartTime() {
-  RosValue::ros_time_t start_time;
-  start_time.secs = UINT32_MAX;
-  start_time.nsecs = UINT32_MAX;
+View View::getMessages(const std::vector<std::string> &topics, const predicate_t &predicate) {
+  getMessages(topics);
+  predicate_ = predicate;
 
-  for (const auto& bag : bags_) {
-    const auto& bag_start = bag->chunks_.front().info.start_time;
-    if (bag_start.secs < start_time.secs) {
-      start_time = bag_start;
-    } else if (bag_start.secs == start_time.secs && bag_start.nsecs < start_time.nsecs) {
-      start_time = bag_start;
+  // The index holds the connection and timestamp of every message, which is all a predicate can look at.
+  // So chunks without a single matching message can be dropped before they are ever read.
+  for (auto &item : bag_wrappers_) {
+    auto &wrapper = item.second;
+    for (auto it = wrapper->chunks_to_parse.begin(); it != wrapper->chunks_to_parse.end();) {
+      if (wrapper->hasWantedMessages(*it, *this)) {
+        ++it;
+      } else {
+        it = wrapper->chunks_to_parse.erase(it);
+      }
     }
   }
 
-  return start_time;
+  return *this;
 }
 
-RosValue::ros_time_t View::getEndTime() {
-  RosValue::ros_time_t end_time;
-  end_time.secs = 0;
-  end_time.nsecs = 0;
-
-  for (const auto& bag : bags_) {
-    const auto& bag_end = bag->chunks_.back().info.end_time;
-    if (bag_end.secs > end_time.secs) {
-      end_time = bag_end;
-    } else if (bag_end.secs == end_time.secs && bag_end.nsecs > end_time.nsecs) {
-      end_time = bag_end;
-    }
+View View::getMessages(const projection_t &projection) {
+  std::vector<std::string> topics;
+  for (const auto &item : projection) {
+    topics.push_back(item.first);
   }
 
-  return end_time;
-}
+  getMessages(topics);
 
-View View::addBag(const std::string &filename) {
-  auto bag = std::make_shared<Embag::Bag>(filename);
-  addBag(bag);
-  return *this;
-}
+  for (auto &item : bag_wrappers_) {
+    const auto &bag = item.first;
+    auto &wrapper = item.second;
+
+    for (const auto &topic_paths : projection) {
+      const auto &topic = topic_paths.first;
+      if (topic_paths.second.empty() || !bag->topic_connection_map_.count(topic)) {
+        continue;
+      }
+
+      const auto program = bag->msgDefForTopic(topic)->program().project(topic_paths.second);
+      for (const auto &connection_record : bag->topic_connection_map_.at(topic)) {
+        wrapper->projections[connection_record->id] = program;
+      }
+    }
+  }
+
+  return *this;
+}
+
+View View::getMessages(const shard_t &shard) {
+  if (shard.bags.size() != bags_.size()) {
+    throw std::runtime_error("Shard was created for " + std::to_string(shard.bags.size()) + " bags but this view has "
+                                 + std::to_string(bags_.size()));
+  }
+
+  bag_wrappers_.clear();
+  start_time_ = shard.start_time;
+  end_time_ = shard.end_time;
+  predicate_ = nullptr;
+
+  for (size_t i = 0; i < bags_.size(); ++i) {
+    const auto &bag = bags_[i];
+    const auto &slice = shard.bags[i];
+
+    bag_wrappers_[bag] = std::make_shared<iterator::bag_wrapper_t>();
+    bag_wrappers_[bag]->bag = bag;
+
+    for (const auto connection_id : slice.connection_ids) {
+      if (connection_id >= bag->connections_.size()) {
+        throw std::runtime_error("Shard refers to unknown connection " + std::to_string(connection_id));
+      }
+
+      bag_wrappers_[bag]->connection_ids.emplace(connection_id);
+    }
+
+    std::unordered_map<uint64_t, const RosBagTypes::chunk_t *> chunks_by_position;
+    for (const auto &chunk : bag->chunks_) {
+      chunks_by_position.emplace(chunk.info.chunk_pos, &chunk);
+    }
+
+    for (const auto chunk_position : slice.chunk_positions) {
+      const auto it = chunks_by_position.find(chunk_position);
+      if (it == chunks_by_position.end()) {
+        throw std::runtime_error("Shard refers to unknown chunk at position " + std::to_string(chunk_position));
+      }
+
+      bag_wrappers_[bag]->chunks_to_parse.emplace(it->second);
+    }
+  }
+
+  return *this;
+}
+
+View View::sample(const std::string &topic, const sampling_t &sampling) {
+  if (sampling.stride == 0) {
+    throw std::runtime_error("The sampling stride must be at least 1");
+  }
+
+  struct sample_candidate_t {
+    RosValue::ros_time_t time;
+    iterator::bag_wrapper_t *wrapper;
+    const RosBagTypes::chunk_t *chunk;
+    uint32_t offset;
+  };
+
+  // Gather the index entries of every selected connection of the topic
+  std::vector<sample_candidate_t> candidates;
+  bool topic_selected = false;
+  for (const auto &bag : bags_) {
+    const auto wrapper_it = bag_wrappers_.find(bag);
+    const auto connections_it = bag->topic_connection_map_.find(topic);
+    if (wrapper_it == bag_wrappers_.end() || connections_it == bag->topic_connection_map_.end()) {
+      continue;
+    }
+
+    auto &wrapper = wrapper_it->second;
+    std::unordered_set<uint32_t> topic_connection_ids;
+    for (const auto &connection_record : connections_it->second) {
+      if (wrapper->connection_ids.count(connection_record->id) == 0) {
+        continue;
+      }
+
+      if (wrapper->sampled_connection_ids.count(connection_record->id)) {
+        throw std::runtime_error(topic + " has already been sampled, call getMessages again to resample it");
+      }
+
+      topic_connection_ids.emplace(connection_record->id);
+      wrapper->sampled_connection_ids.emplace(connection_record->id);
+    }
+
+    topic_selected |= !topic_connection_ids.empty();
+    for (const auto &chunk : wrapper->chunks_to_parse) {
+      for (const auto &block : chunk->index_blocks) {
+        if (topic_connection_ids.count(block.connection_id) == 0) {
+          continue;
+        }
+
+        const auto &connection = bag->connections_[block.connection_id];
+        for (size_t i = 0; i < block.message_count; ++i) {
+          const auto &entry = block.entries[i];
+          if (matches(connection.data, entry.time)) {
+            candidates.push_back({entry.time, wrapper.get(), chunk, entry.offset});
+          }
+        }
+      }
+    }
+  }
+
+  if (!topic_selected) {
+    throw std::runtime_error(topic + " must be selected by getMessages before it can be sampled");
+  }
+
+  // Walk the candidates in the order they would be iterated
+  std::sort(candidates.begin(), candidates.end(), [](const sample_candidate_t &left, const sample_candidate_t &right) {
+    if (left.time != right.time) {
+      return left.time < right.time;
+    }
+    if (left.chunk != right.chunk) {
+      return left.chunk->offset < right.chunk->offset;
+    }
+    return left.offset < right.offset;
+  });
+
+  const long period = sampling.period.to_nsec();
+  bool kept_any = false;
+  long last_kept = 0;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const auto &candidate = candidates[i];
+    if (i % sampling.stride != 0) {
+      continue;
+    }
+
+    const long time = candidate.time.to_nsec();
+    if (period > 0 && kept_any) {
+      if (sampling.bucketed ? time / period == last_kept / period : time - last_kept < period) {
+        continue;
+      }
+    }
+
+    kept_any = true;
+    last_kept = time;
+    candidate.wrapper->sampled_offsets[candidate.chunk].push_back(candidate.offset);
+  }
+
+  // Drop the chunks that no longer hold anything worth reading
+  for (auto &item : bag_wrappers_) {
+    auto &wrapper = item.second;
+    for (auto &chunk_offsets : wrapper->sampled_offsets) {
+      std::sort(chunk_offsets.second.begin(), chunk_offsets.second.end());
+    }
+
+    for (auto it = wrapper->chunks_to_parse.begin(); it != wrapper->chunks_to_parse.end();) {
+      if (wrapper->hasWantedMessages(*it, *this)) {
+        ++it;
+      } else {
+        it = wrapper->chunks_to_parse.erase(it);
+      }
+    }
+  }
+
+  return *this;
+}
+
+View::shard_t View::shard(size_t index, size_t count, shard_t::balance_t balance) const {
+  if (count == 0 || index >= count) {
+    throw std::runtime_error("Invalid shard " + std::to_string(index) + " of " + std::to_string(count));
+  }
+
+  // Workers would read every message of their shard, so refuse rather than silently drop the filters
+  if (predicate_) {
+    throw std::runtime_error("Can't shard a view with a predicate, as predicates are not part of shard descriptors");
+  }
+
+  for (const auto &bag_wrapper : bag_wrappers_) {
+    if (!bag_wrapper.second->sampled_connection_ids.empty()) {
+      throw std::runtime_error("Can't shard a sampled view, as sampling is not part of shard descriptors");
+    }
+  }
+
+  struct weighted_chunk_t {
+    size_t bag_index;
+    const RosBagTypes::chunk_t *chunk;
+    uint64_t weight;
+  };
+
+  shard_t shard;
+  shard.index = index;
+  shard.count = count;
+  shard.start_time = start_time_;
+  shard.end_time = end_time_;
+  shard.bags.resize(bags_.size());
+
+  std::vector<weighted_chunk_t> chunks;
+  uint64_t total_weight = 0;
+  for (size_t i = 0; i < bags_.size(); ++i) {
+    const auto it = bag_wrappers_.find(bags_[i]);
+    if (it == bag_wrappers_.end()) {
+      throw std::runtime_error("getMessages must be called before a view can be sharded");
+    }
+
+    const auto &wrapper = it->second;
+    shard.bags[i].connection_ids.assign(wrapper->connection_ids.begin(), wrapper->connection_ids.end());
+    std::sort(shard.bags[i].connection_ids.begin(), shard.bags[i].connection_ids.end());
+
+    for (const auto &chunk : wrapper->chunks_to_parse) {
+      uint64_t weight = 0;
+      if (balance == shard_t::balance_t::uncompressed_bytes) {
+        weight = chunk->uncompressed_size;
+      } else {
+        for (const auto &block : chunk->index_blocks) {
+          if (wrapper->connection_ids.count(block.connection_id) == 0) {
+            continue;
+          }
+
+          const auto &connection = bags_[i]->connections_[block.connection_id];
+          for (size_t j = 0; j < block.message_count; ++j) {
+            if (matches(connection.data, block.entries[j].time)) {
+              ++weight;
+            }
+          }
+        }
+      }
+
+      chunks.push_back({i, chunk, weight});
+      total_weight += weight;
+    }
+  }
+
+  // Keep shards contiguous in time so each worker reads a compact region of the bags
+  std::stable_sort(chunks.begin(), chunks.end(), [](const weighted_chunk_t &left, const weighted_chunk_t &right) {
+    return left.chunk->info.start_time < right.chunk->info.start_time;
+  });
+
+  // A chunk belongs to the shard its weighted midpoint falls into
+  uint64_t weight_before = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const auto &chunk = chunks[i];
+
+    size_t chunk_shard;
+    if (total_weight == 0) {
+      chunk_shard = i * count / chunks.size();
+    } else {
+      const double midpoint = weight_before + chunk.weight / 2.0;
+      chunk_shard = std::min(count - 1, static_cast<size_t>(midpoint * count / total_weight));
+    }
+    weight_before += chunk.weight;
+
+    if (chunk_shard == index) {
+      shard.bags[chunk.bag_index].chunk_positions.push_back(chunk.chunk->info.chunk_pos);
+    }
+  }
+
+  return shard;
+}
+
+std::string View::shard_t::toString() const {
+  std::ostringstream output;
+  output << "embag_shard 1\n";
+  output << "index " << index << "\n";
+  output << "count " << count << "\n";
+  output << "start_time " << start_time.secs << " " << start_time.nsecs << "\n";
+  output << "end_time " << end_time.secs << " " << end_time.nsecs << "\n";
+
+  for (const auto &bag : bags) {
+    output << "bag\n";
+    output << "connections";
+    for (const auto connection_id : bag.connection_ids) {
+      output << " " << connection_id;
+    }
+    output << "\n";
+
+    output << "chunks";
+    for (const auto chunk_position : bag.chunk_positions) {
+      output << " " << chunk_position;
+    }
+    output << "\n";
+  }
+
+  return output.str();
+}
+
+View::shard_t View::shard_t::fromString(const std::string &descriptor) {
+  std::istringstream input{descriptor};
+  shard_t shard;
+
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(input, line)) {
+    std::istringstream fields{line};
+    std::string key;
+    fields >> key;
+
+    bool valid = true;
+    if (line_number == 0) {
+      uint32_t version = 0;
+      valid = key == "embag_shard" && (fields >> version) && version == 1;
+    } else if (key == "index") {
+      valid = static_cast<bool>(fields >> shard.index);
+    } else if (key == "count") {
+      valid = static_cast<bool>(fields >> shard.count);
+    } else if (key == "start_time") {
+      valid = static_cast<bool>(fields >> shard.start_time.secs >> shard.start_time.nsecs);
+    } else if (key == "end_time") {
+      valid = static_cast<bool>(fields >> shard.end_time.secs >> shard.end_time.nsecs);
+    } else if (key == "bag") {
+      shard.bags.emplace_back();
+    } else if (key == "connections" && !shard.bags.empty()) {
+      uint32_t connection_id;
+      while (fields >> connection_id) {
+        shard.bags.back().connection_ids.push_back(connection_id);
+      }
+      valid = fields.eof();
+    } else if (key == "chunks" && !shard.bags.empty()) {
+      uint64_t chunk_position;
+      while (fields >> chunk_position) {
+        shard.bags.back().chunk_positions.push_back(chunk_position);
+      }
+      valid = fields.eof();
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      throw std::runtime_error("Unable to parse line " + std::to_string(line_number + 1) + " of shard descriptor: " + line);
+    }
+
+    ++line_number;
+  }
+
+  if (line_number == 0 || shard.count == 0 || shard.index >= shard.count) {
+    throw std::runtime_error("Invalid shard descriptor");
+  }
+
+  return shard;
+}
+
+View::plan_t View::planChunks(bool reverse) const {
+  plan_t plan;
+  plan.reverse = reverse;
+  plan.bags = bags_;
+
+  // Each bag is read in file order (or the opposite when reversed) and the bags are interleaved by chunk time
+  std::vector<std::vector<const RosBagTypes::chunk_t *>> bag_chunks(bags_.size());
+  for (size_t i = 0; i < bags_.size(); ++i) {
+    const auto it = bag_wrappers_.find(bags_[i]);
+    if (it == bag_wrappers_.end()) {
+      continue;
+    }
+
+    bag_chunks[i].assign(it->second->chunks_to_parse.begin(), it->second->chunks_to_parse.end());
+    if (reverse) {
+      std::reverse(bag_chunks[i].begin(), bag_chunks[i].end());
+    }
+  }
+
+  std::vector<size_t> positions(bags_.size(), 0);
+  while (true) {
+    size_t next_bag = bags_.size();
+    for (size_t i = 0; i < bags_.size(); ++i) {
+      if (positions[i] == bag_chunks[i].size()) {
+        continue;
+      }
+
+      if (next_bag == bags_.size()) {
+        next_bag = i;
+        continue;
+      }
+
+      const auto &candidate = bag_chunks[i][positions[i]]->info;
+      const auto &best = bag_chunks[next_bag][positions[next_bag]]->info;
+      if (reverse ? candidate.end_time > best.end_time : candidate.start_time < best.start_time) {
+        next_bag = i;
+      }
+    }
+
+    if (next_bag == bags_.size()) {
+      break;
+    }
+
+    plan.chunks.push_back({next_bag, bag_chunks[next_bag][positions[next_bag]++], 0, 0});
+  }
+
+  return plan;
+}
+
+View::plan_t View::plan(bool reverse) const {
+  auto plan = planChunks(reverse);
+
+  std::vector<uint32_t> record_offsets;
+  for (auto &chunk_read : plan.chunks) {
+    const auto &bag = plan.bags[chunk_read.bag_index];
+    const auto &wrapper = bag_wrappers_.at(bag);
+    const auto chunk = chunk_read.chunk;
+
+    // The index doesn't hold message lengths, but a record ends where the next one in the chunk begins
+    record_offsets.clear();
+    for (const auto &block : chunk->index_blocks) {
+      for (size_t i = 0; i < block.message_count; ++i) {
+        record_offsets.push_back(block.entries[i].offset);
+      }
+    }
+    std::sort(record_offsets.begin(), record_offsets.end());
+
+    for (const auto &block : chunk->index_blocks) {
+      if (wrapper->connection_ids.count(block.connection_id) == 0) {
+        continue;
+      }
+
+      const auto &connection = bag->connections_[block.connection_id];
+      for (size_t i = 0; i < block.message_count; ++i) {
+        const auto &entry = block.entries[i];
+        if (!matches(connection.data, entry.time) || wrapper->sampledOut(chunk, block.connection_id, entry.offset)) {
+          continue;
+        }
+
+        const auto next = std::upper_bound(record_offsets.begin(), record_offsets.end(), entry.offset);
+        const uint64_t record_end = next == record_offsets.end() ? chunk->uncompressed_size : *next;
+
+        chunk_read.wanted_messages++;
+        chunk_read.wanted_bytes += record_end - entry.offset;
+        plan.message_counts[connection.topic]++;
+      }
+    }
+
+    plan.compressed_bytes += chunk->record.data_len;
+    plan.uncompressed_bytes += chunk->uncompressed_size;
+    plan.wanted_bytes += chunk_read.wanted_bytes;
+  }
+
+  return plan;
+}
+
+double View::plan_t::readAmplification() const {
+  if (wanted_bytes == 0) {
+    return 0;
+  }
+
+  return double(uncompressed_bytes) / double(wanted_bytes);
+}
+
+std::string View::plan_t::explain() const {
+  const auto time_string = [](const RosValue::ros_time_t &time) {
+    std::ostringstream output;
+    output << time.secs << "." << std::setw(9) << std::setfill('0') << time.nsecs;
+    return output.str();
+  };
+
+  std::ostringstream output;
+  output << "Read " << chunks.size() << " chunks from " << bags.size() << " bags" << (reverse ? " in reverse" : "") << "\n";
+  output << "  compressed bytes:   " << compressed_bytes << "\n";
+  output << "  uncompressed bytes: " << uncompressed_bytes << "\n";
+  output << "  wanted bytes:       " << wanted_bytes << "\n";
+  output << "  read amplification: " << std::fixed << std::setprecision(2) << readAmplification() << "x\n";
+
+  output << "Messages per topic:\n";
+  for (const auto &item : message_counts) {
+    output << "  " << item.first << ": " << item.second << "\n";
+  }
+
+  output << "Chunks in read order:\n";
+  for (const auto &chunk_read : chunks) {
+    const auto &chunk = *chunk_read.chunk;
+    output << "  bag " << chunk_read.bag_index
+           << " chunk at " << chunk.info.chunk_pos
+           << " [" << time_string(chunk.info.start_time) << ", " << time_string(chunk.info.end_time) << "]"
+           << " " << chunk.compression
+           << " " << chunk.record.data_len << " -> " << chunk.uncompressed_size << " bytes, "
+           << chunk_read.wanted_messages << " wanted messages in " << chunk_read.wanted_bytes << " bytes\n";
+  }
+
+  return output.str();
+}
+
+RosValue::ros_time_t View::getStartTime() {
+  RosValue::ros_time_t start_time;
+  start_time.secs = UINT32_MAX;
+  start_time.nsecs = UINT32_MAX;
+
+  for (const auto& bag : bags_) {
+    const auto& bag_start = bag->chunks_.front().info.start_time;
+    if (bag_start.secs < start_time.secs) {
+      start_time = bag_start;
+    } else if (bag_start.secs == start_time.secs && bag_start.nsecs < start_time.nsecs) {
+      start_time = bag_start;
+    }
+  }
+
+  return start_time;
+}
+
+RosValue::ros_time_t View::getEndTime() {
+  RosValue::ros_time_t end_time;
+  end_time.secs = 0;
+  end_time.nsecs = 0;
+
+  for (const auto& bag : bags_) {
+    const auto& bag_end = bag->chunks_.back().info.end_time;
+    if (bag_end.secs > end_time.secs) {
+      end_time = bag_end;
+    } else if (bag_end.secs == end_time.secs && bag_end.nsecs > end_time.nsecs) {
+      end_time = bag_end;
+    }
+  }
+
+  return end_time;
+}
+
+View View::addBag(const std::string &filename) {
+  auto bag = std::make_shared<Embag::Bag>(filename);
+  addBag(bag);
+  return *this;
+}
 
 View View::addBag(std::shared_ptr<Bag> bag) {
   bags_.emplace_back(bag);
   return *this;
 }
-}
\ No newline at end of file
+std::shared_ptr<const ParseProgram> View::topicProgram(
+    const plan_t &plan,
+    const std::string &topic,
+    std::vector<std::unordered_set<uint32_t>> &connection_ids) {
+  std::shared_ptr<const ParseProgram> program;
+  std::string md5sum;
+  connection_ids.assign(plan.bags.size(), {});
+  for (size_t i = 0; i < plan.bags.size(); ++i) {
+    const auto &bag = plan.bags[i];
+    if (!bag->topicInBag(topic)) {
+      continue;
+    }
+
+    for (const auto &connection_record : bag->topic_connection_map_.at(topic)) {
+      connection_ids[i].emplace(connection_record->id);
+
+      if (md5sum.empty()) {
+        md5sum = connection_record->data.md5sum;
+        program = bag->msgDefForTopic(topic)->sharedProgram();
+      } else if (connection_record->data.md5sum != md5sum) {
+        throw std::runtime_error("The definition of " + topic + " differs between the bags of this view");
+      }
+    }
+  }
+
+  if (!program) {
+    throw std::runtime_error("None of the bags of this view have the topic " + topic);
+  }
+
+  return program;
+}
+
+View::records_t View::readRecords(const std::string &topic, size_t threads) const {
+  return readRecords(topic, RosValue::ros_time_t{0, 0}, RosValue::ros_time_t{UINT32_MAX, UINT32_MAX}, threads);
+}
+
+View::records_t View::readRecords(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads) const {
+  View selection{*this};
+  selection.getMessages({topic}, start_time, end_time);
+  const auto plan = selection.planChunks(false);
+
+  std::vector<std::unordered_set<uint32_t>> connection_ids;
+  const auto program = topicProgram(plan, topic, connection_ids);
+
+  records_t result;
+  std::vector<ParseProgram::instruction_t> instructions;
+  result.fields.push_back({"timestamp", RosValue::Type::int64, 0, 0, sizeof(int64_t), {}});
+  result.row_size = sizeof(int64_t);
+  recordLayout(*program, result.fields, instructions, 0, result.row_size);
+
+  if (result.fields.size() == 1) {
+    throw std::runtime_error("The messages of " + topic + " have no fixed size fields");
+  }
+
+  for (size_t i = 1; i < result.fields.size(); ++i) {
+    if (result.fields[i].name == "timestamp") {
+      throw std::runtime_error("The messages of " + topic + " have a field named timestamp, which would hide the record timestamp");
+    }
+  }
+
+  // Nothing after the last fixed size field needs to be looked at
+  while (!instructions.empty() && instructions.back().opcode != ParseProgram::Opcode::fixed) {
+    instructions.pop_back();
+  }
+
+  const size_t row_size = result.row_size;
+  std::vector<std::vector<RosValue::ros_time_t>> chunk_timestamps(plan.chunks.size());
+  std::vector<std::vector<char>> chunk_rows(plan.chunks.size());
+
+  const auto read_chunk = [&](size_t chunk_index) {
+    const auto &chunk_read = plan.chunks[chunk_index];
+    const auto &chunk = *chunk_read.chunk;
+    const auto entries = wantedEntries(chunk, connection_ids[chunk_read.bag_index], start_time, end_time);
+    if (entries.empty()) {
+      return;
+    }
+
+    std::vector<char> buffer(chunk.uncompressed_size);
+    chunk.decompress(buffer.data());
+
+    auto &timestamps = chunk_timestamps[chunk_index];
+    auto &rows = chunk_rows[chunk_index];
+    timestamps.reserve(entries.size());
+    rows.resize(entries.size() * row_size);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto record = iterator::readRecordAt(buffer, entries[i].offset);
+      timestamps.push_back(entries[i].time);
+
+      char *row = rows.data() + i * row_size;
+      const int64_t nanoseconds = entries[i].time.to_nsec();
+      std::memcpy(row, &nanoseconds, sizeof(nanoseconds));
+
+      size_t row_offset = sizeof(nanoseconds);
+      size_t offset = 0;
+      for (const auto &instruction : instructions) {
+        if (instruction.opcode != ParseProgram::Opcode::fixed) {
+          offset = instruction.skip(record.data, record.data_len, offset);
+          continue;
+        }
+
+        if (offset + instruction.size > record.data_len) {
+          throw std::runtime_error("Message is shorter than its definition requires");
+        }
+
+        std::memcpy(row + row_offset, record.data + offset, instruction.size);
+        row_offset += instruction.size;
+        offset += instruction.size;
+      }
+    }
+  };
+
+  readChunksInParallel(plan.chunks.size(), threads, read_chunk);
+
+  std::vector<RosValue::ros_time_t> timestamps;
+  size_t message_count = 0;
+  for (const auto &rows : chunk_rows) {
+    message_count += rows.size() / row_size;
+  }
+
+  timestamps.reserve(message_count);
+  result.rows.reserve(message_count * row_size);
+  for (size_t i = 0; i < plan.chunks.size(); ++i) {
+    timestamps.insert(timestamps.end(), chunk_timestamps[i].begin(), chunk_timestamps[i].end());
+    result.rows.insert(result.rows.end(), chunk_rows[i].begin(), chunk_rows[i].end());
+  }
+
+  const auto order = timestampOrder(timestamps);
+  if (!order.empty()) {
+    reorder(result.rows, row_size, order);
+  }
+
+  return result;
+}
+
+ArrowBatches View::readArrow(const std::string &topic, size_t threads) const {
+  return readArrow(topic, RosValue::ros_time_t{0, 0}, RosValue::ros_time_t{UINT32_MAX, UINT32_MAX}, threads);
+}
+
+ArrowBatches View::readArrow(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads) const {
+  View selection{*this};
+  selection.getMessages({topic}, start_time, end_time);
+  const auto plan = selection.planChunks(false);
+
+  std::vector<std::unordered_set<uint32_t>> connection_ids;
+  const auto program = topicProgram(plan, topic, connection_ids);
+
+  struct chunk_entries_t {
+    const RosBagTypes::chunk_t *chunk;
+    std::vector<RosBagTypes::index_entry_t> entries;
+  };
+
+  std::vector<chunk_entries_t> chunks;
+  for (const auto &chunk_read : plan.chunks) {
+    auto entries = wantedEntries(*chunk_read.chunk, connection_ids[chunk_read.bag_index], start_time, end_time);
+    if (!entries.empty()) {
+      chunks.push_back({chunk_read.chunk, std::move(entries)});
+    }
+  }
+
+  // Each chunk with wanted messages becomes a batch, except that chunks whose messages overlap in time share one, so
+  // the rows of all the batches are in timestamp order like those of readColumns
+  std::stable_sort(chunks.begin(), chunks.end(), [](const chunk_entries_t &left, const chunk_entries_t &right) {
+    return left.entries.front().time < right.entries.front().time;
+  });
+
+  std::vector<std::vector<const chunk_entries_t *>> batch_chunks;
+  RosValue::ros_time_t batch_end;
+  for (const auto &chunk : chunks) {
+    if (batch_chunks.empty() || !(chunk.entries.front().time < batch_end)) {
+      batch_chunks.emplace_back();
+      batch_end = chunk.entries.back().time;
+    } else if (batch_end < chunk.entries.back().time) {
+      batch_end = chunk.entries.back().time;
+    }
+
+    batch_chunks.back().push_back(&chunk);
+  }
+
+  ArrowBatches batches{*program, batch_chunks.size()};
+  const auto read_batch = [&](size_t batch_index) {
+    const auto &batch = batch_chunks[batch_index];
+    std::vector<std::vector<char>> buffers(batch.size());
+    std::vector<ArrowBatches::message_t> messages;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const auto &chunk = *batch[i]->chunk;
+      buffers[i].resize(chunk.uncompressed_size);
+      chunk.decompress(buffers[i].data());
+
+      for (const auto &entry : batch[i]->entries) {
+        const auto record = iterator::readRecordAt(buffers[i], entry.offset);
+        messages.push_back({entry.time, record.data, record.data_len});
+      }
+    }
+
+    if (batch.size() > 1) {
+      std::stable_sort(messages.begin(), messages.end(), [](const ArrowBatches::message_t &left, const ArrowBatches::message_t &right) {
+        return left.timestamp < right.timestamp;
+      });
+    }
+
+    batches.build(batch_index, messages);
+  };
+
+  readChunksInParallel(batch_chunks.size(), threads, read_batch);
+  return batches;
+}
+
+View::raw_messages_t View::readRaw(const std::string &topic, size_t threads) const {
+  return readRaw(topic, RosValue::ros_time_t{0, 0}, RosValue::ros_time_t{UINT32_MAX, UINT32_MAX}, threads);
+}
+
+View::raw_messages_t View::readRaw(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads) const {
+  View selection{*this};
+  selection.getMessages({topic}, start_time, end_time);
+  const auto plan = selection.planChunks(false);
+
+  // Nothing is parsed, so the connections of the topic may have different definitions
+  std::vector<std::unordered_set<uint32_t>> connection_ids(plan.bags.size());
+  bool found_topic = false;
+  for (size_t i = 0; i < plan.bags.size(); ++i) {
+    const auto &bag = plan.bags[i];
+    if (!bag->topicInBag(topic)) {
+      continue;
+    }
+
+    for (const auto &connection_record : bag->topic_connection_map_.at(topic)) {
+      connection_ids[i].emplace(connection_record->id);
+    }
+    found_topic = true;
+  }
+
+  if (!found_topic) {
+    throw std::runtime_error("None of the bags of this view have the topic " + topic);
+  }
+
+  struct chunk_messages_t {
+    std::vector<RosValue::ros_time_t> timestamps;
+    std::vector<char> bytes;
+    std::vector<uint64_t> lengths;
+  };
+
+  std::vector<chunk_messages_t> chunk_messages(plan.chunks.size());
+  const auto read_chunk = [&](size_t chunk_index) {
+    const auto &chunk_read = plan.chunks[chunk_index];
+    const auto &chunk = *chunk_read.chunk;
+    const auto entries = wantedEntries(chunk, connection_ids[chunk_read.bag_index], start_time, end_time);
+    if (entries.empty()) {
+      return;
+    }
+
+    std::vector<char> buffer(chunk.uncompressed_size);
+    chunk.decompress(buffer.data());
+
+    auto &output = chunk_messages[chunk_index];
+    output.timestamps.reserve(entries.size());
+    output.lengths.reserve(entries.size());
+    for (const auto &entry : entries) {
+      const auto record = iterator::readRecordAt(buffer, entry.offset);
+      output.timestamps.push_back(entry.time);
+      output.bytes.insert(output.bytes.end(), record.data, record.data + record.data_len);
+      output.lengths.push_back(record.data_len);
+    }
+  };
+
+  readChunksInParallel(plan.chunks.size(), threads, read_chunk);
+
+  size_t message_count = 0;
+  size_t byte_count = 0;
+  for (const auto &output : chunk_messages) {
+    message_count += output.timestamps.size();
+    byte_count += output.bytes.size();
+  }
+
+  raw_messages_t result;
+  result.timestamps.reserve(message_count);
+  result.bytes.reserve(byte_count);
+  result.offsets.reserve(message_count + 1);
+  for (const auto &output : chunk_messages) {
+    result.timestamps.insert(result.timestamps.end(), output.timestamps.begin(), output.timestamps.end());
+    result.bytes.insert(result.bytes.end(), output.bytes.begin(), output.bytes.end());
+    for (const uint64_t length : output.lengths) {
+      result.offsets.push_back(result.offsets.back() + length);
+    }
+  }
+
+  const auto order = timestampOrder(result.timestamps);
+  if (!order.empty()) {
+    std::vector<RosValue::ros_time_t> timestamps(message_count);
+    for (size_t i = 0; i < message_count; ++i) {
+      timestamps[i] = result.timestamps[order[i]];
+    }
+    result.timestamps.swap(timestamps);
+
+    reorder(result.bytes, result.offsets, 1, order);
+  }
+
+  return result;
+}
+}
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 #include <queue>
 
+#include "arrow.h"
 #include "embag.h"
 #include "ros_message.h"
 #include "ros_value.h"
@@ -25,6 +30,158 @@ class View {
     addBag(filename);
   }
 
+  // A slice of the chunks selected by a View.  Shards can be serialized to a string so they can be dispatched to
+  // other processes, which then open the same bags (in the same order) and read only the chunks of their shard.
+  struct shard_t {
+    enum class balance_t {
+      uncompressed_bytes,
+      message_count,
+    };
+
+    struct bag_slice_t {
+      std::vector<uint32_t> connection_ids;
+      // Chunks are identified by their position in the bag file
+      std::vector<uint64_t> chunk_positions;
+    };
+
+    size_t index = 0;
+    size_t count = 1;
+    RosValue::ros_time_t start_time{0, 0};
+    RosValue::ros_time_t end_time{UINT32_MAX, UINT32_MAX};
+    // One slice per bag of the View, in the order the bags were added
+    std::vector<bag_slice_t> bags;
+
+    std::string toString() const;
+    static shard_t fromString(const std::string &descriptor);
+  };
+
+  // The chunks a View will read and what reading them costs, worked out from the bag index without decompressing
+  // anything.  A plan can be inspected with explain() and then executed with begin(plan).
+  struct plan_t {
+    struct chunk_read_t {
+      // Index into bags
+      size_t bag_index;
+      const RosBagTypes::chunk_t *chunk;
+      uint64_t wanted_messages;
+      // Bytes of the wanted message records, measured between index offsets
+      uint64_t wanted_bytes;
+    };
+
+    bool reverse = false;
+    std::vector<std::shared_ptr<Bag>> bags;
+    // Chunks in read order
+    std::vector<chunk_read_t> chunks;
+    std::map<std::string, uint64_t> message_counts;
+    uint64_t compressed_bytes = 0;
+    uint64_t uncompressed_bytes = 0;
+    uint64_t wanted_bytes = 0;
+
+    // Bytes decompressed per byte of wanted messages
+    double readAmplification() const;
+    std::string explain() const;
+  };
+
+  // The values of a primitive field, one per message, stored back to back.  For a path to an array of primitives such
+  // as "ranges", the elements of every message are stored back to back instead, and offsets gives where those of each
+  // message start.
+  struct column_t {
+    std::string path;
+    // For arrays, the type of their elements
+    RosValue::Type type;
+    // The values in the representation of type
+    std::vector<char> bytes;
+    // For arrays only, one more than there are messages: the values of message i are those from offsets[i] to
+    // offsets[i + 1]
+    std::vector<uint64_t> offsets;
+
+    bool isArray() const {
+      return !offsets.empty();
+    }
+
+    size_t size() const {
+      return bytes.size() / RosValue::primitiveTypeToSize(type);
+    }
+
+    template<typename T>
+    const T* data() const {
+      if (RosValue::primitiveTypeToSize(type) != sizeof(T)) {
+        throw std::runtime_error("The requested type does not match the size of " + path);
+      }
+
+      return reinterpret_cast<const T*>(bytes.data());
+    }
+
+    template<typename T>
+    std::vector<T> values() const {
+      const T *begin = data<T>();
+      return std::vector<T>(begin, begin + size());
+    }
+  };
+
+  struct columns_t {
+    // Record timestamps of the messages, in order
+    std::vector<RosValue::ros_time_t> timestamps;
+    // One column per path, in the order they were requested
+    std::vector<column_t> columns;
+
+    const column_t& operator[](const std::string &path) const;
+  };
+
+  // The fixed size fields of every message of a topic, laid out as one row per message.  Each row starts with the
+  // record timestamp of the message in nanoseconds, as an int64_t named "timestamp", followed by the fields of the
+  // message in declaration order, packed as they are in the message.  Strings and variable length arrays are left
+  // out, along with fixed length arrays of anything that contains them.
+  struct records_t {
+    struct field_t {
+      std::string name;
+      // A primitive type, or object
+      RosValue::Type type;
+      // The length of a fixed length array, or 0 for a single value
+      uint32_t array_size;
+      // Offset from the start of the row or of the enclosing object
+      size_t offset;
+      // Size of a single value or array element
+      size_t size;
+      // For objects, the fields of the object
+      std::vector<field_t> fields;
+    };
+
+    std::vector<field_t> fields;
+    size_t row_size = 0;
+    std::vector<char> rows;
+
+    size_t size() const {
+      return row_size == 0 ? 0 : rows.size() / row_size;
+    }
+
+    const char* row(size_t index) const {
+      return rows.data() + index * row_size;
+    }
+
+    RosValue::ros_time_t timestamp(size_t index) const;
+  };
+
+  // The raw bytes of messages, as found in the bag, stored back to back in one buffer
+  struct raw_messages_t {
+    // Record timestamps of the messages, in order
+    std::vector<RosValue::ros_time_t> timestamps;
+    std::vector<char> bytes;
+    // One more than there are messages: message i is the bytes from offsets[i] to offsets[i + 1]
+    std::vector<uint64_t> offsets{0};
+
+    size_t size() const {
+      return timestamps.size();
+    }
+
+    const char* data(size_t index) const {
+      return bytes.data() + offsets[index];
+    }
+
+    size_t length(size_t index) const {
+      return offsets[index + 1] - offsets[index];
+    }
+  };
+
   struct iterator {
     struct begin_cond_t{};
 
@@ -33,14 +190,17 @@ class View {
 
     // Begin constructor
     iterator(View *view, begin_cond_t begin_cond);
+    // Plan constructor: reads the chunks of the plan in order, newest message first for reverse plans
+    iterator(View *view, const plan_t &plan);
     // End constructor
     explicit iterator(View *view) : view_(view) {};
 
     // Copy constructor
-    iterator(const iterator& other) : view_(other.view_), msg_queue_(other.msg_queue_) {};
+    iterator(const iterator& other) : view_(other.view_), reverse_(other.reverse_), msg_queue_(other.msg_queue_) {};
 
     iterator& operator=(const iterator&& other) {
       view_ = other.view_;
+      reverse_ = other.reverse_;
       msg_queue_ = other.msg_queue_;
 
       return *this;
@@ -81,46 +241,174 @@ class View {
       };
 
       std::set<const RosBagTypes::chunk_t *, bag_offset_compare_t> chunks_to_parse;
-      std::set<const RosBagTypes::chunk_t *, bag_offset_compare_t>::iterator chunk_iter;
       std::unordered_set<uint32_t> connection_ids;
 
+      // The chunks of this bag in the plan being executed
+      std::vector<const RosBagTypes::chunk_t *> planned_chunks;
+      size_t planned_chunk_index = 0;
+
+      // When iterating in reverse, the offsets of the wanted messages in the current chunk that are yet to be read
+      std::vector<uint32_t> reverse_message_offsets;
+
+      // Messages of sampled connections are only read if the sampler kept their offset.  The offsets of each
+      // chunk are sorted.
+      std::unordered_set<uint32_t> sampled_connection_ids;
+      std::unordered_map<const RosBagTypes::chunk_t *, std::vector<uint32_t>> sampled_offsets;
+
+      // Projected parse programs of the connections whose topics were selected with a projection
+      std::unordered_map<uint32_t, std::shared_ptr<const ParseProgram>> projections;
+
+      bool sampledOut(const RosBagTypes::chunk_t *chunk, uint32_t connection_id, uint32_t offset) const;
+      bool hasWantedMessages(const RosBagTypes::chunk_t *chunk, const View &view) const;
 
       uint32_t current_connection_id = 0;
       std::shared_ptr<std::vector<char>> current_message_buffer;
       size_t current_message_data_offset;
       uint32_t current_message_len = 0;
       RosValue::ros_time_t current_timestamp{};
+      uint64_t current_chunk_position = 0;
+      uint32_t current_chunk_offset = 0;
     };
 
     static header_t readHeader(const RosBagTypes::record_t &record);
+    // Reads the record at an offset taken from a chunk's index, checking that it lies within the chunk
+    static RosBagTypes::record_t readRecordAt(const std::vector<char> &buffer, size_t record_offset);
     void readMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper);
+    void readPreviousMessage(std::shared_ptr<bag_wrapper_t> bag_wrapper);
 
-    // Function for comparing message timestamps
+    // Function for comparing message timestamps.  The queue yields the earliest message first,
+    // or the latest message first when iterating in reverse.
     struct timestamp_compare_t {
+      explicit timestamp_compare_t(bool reverse = false) : reverse(reverse) {}
+
+      bool reverse;
+
       bool operator()(std::shared_ptr<bag_wrapper_t> &left, std::shared_ptr<bag_wrapper_t> &right) {
         const auto &left_ts = left->current_timestamp;
         const auto &right_ts = right->current_timestamp;
 
-        if (left_ts.secs > right_ts.secs) {
-          return true;
-        } else if (left_ts.secs == right_ts.secs && left_ts.nsecs > right_ts.nsecs) {
-          return true;
+        if (reverse) {
+          return left_ts < right_ts;
         }
-        return false;
+
+        return left_ts > right_ts;
       };
     };
 
+    bool reverse_ = false;
     std::priority_queue<std::shared_ptr<bag_wrapper_t>, std::vector<std::shared_ptr<bag_wrapper_t>>, timestamp_compare_t> msg_queue_;
   };
 
+  // Hands the messages between two iterators out to several threads, each message to exactly one of them.  Comparing
+  // with the end, reading the message and advancing past it happen together under one lock.
+  class shared_iterator {
+   public:
+    shared_iterator(const iterator &begin, const iterator &end)
+      : iterator_(begin), end_(end), mutex_(new std::mutex()) {}
+
+    // Returns the next message, or nullptr once there are none left
+    std::shared_ptr<RosMessage> next();
+
+   private:
+    iterator iterator_;
+    iterator end_;
+    std::unique_ptr<std::mutex> mutex_;
+  };
+
   iterator begin();
+  iterator begin(const plan_t &plan);
   iterator end();
+  // Reverse iteration walks the selected chunks from the end of the bag and only decompresses the chunks it visits.
+  // Combine with a time range to iterate backwards from a seek point.
+  iterator rbegin();
+  iterator rend();
+
+  // Plans the read of the messages selected by the last call to getMessages
+  plan_t plan(bool reverse = false) const;
+
+  // Reads primitive fields such as "twist.twist.linear.x", or arrays of primitives such as "ranges", of every message
+  // of a topic straight into columns, without building RosValues.  Chunks are decompressed and scanned in parallel by
+  // `threads` threads, or one per core if 0, and the messages are ordered by timestamp.  The messages selected by
+  // getMessages have no effect on the columns.
+  columns_t readColumns(const std::string &topic, const std::vector<std::string> &paths, size_t threads = 0) const;
+  columns_t readColumns(
+    const std::string &topic,
+    const std::vector<std::string> &paths,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads = 0) const;
+
+  // Reads the fixed size fields of every message of a topic into records, see records_t.  Like readColumns, no
+  // RosValues are built, chunks are read in parallel and the messages are ordered by timestamp.  The topic must have
+  // the same definition in every bag of the view.
+  records_t readRecords(const std::string &topic, size_t threads = 0) const;
+  records_t readRecords(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads = 0) const;
+
+  // Converts every message of a topic to Arrow record batches, see ArrowBatches.  There is one batch per chunk, or per
+  // run of chunks whose messages overlap in time, so the rows of the batches are ordered by timestamp overall.  Batches
+  // are converted in parallel like readColumns.  The topic must have the same definition in every bag of the view.
+  ArrowBatches readArrow(const std::string &topic, size_t threads = 0) const;
+  ArrowBatches readArrow(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads = 0) const;
+
+  // Copies the raw bytes of every message of a topic into one buffer, see raw_messages_t, to forward them without
+  // parsing them.  Chunks are read in parallel like readColumns and the messages are ordered by timestamp.  As nothing
+  // is parsed, the definition of the topic may differ between connections.
+  raw_messages_t readRaw(const std::string &topic, size_t threads = 0) const;
+  raw_messages_t readRaw(
+    const std::string &topic,
+    const RosValue::ros_time_t &start_time,
+    const RosValue::ros_time_t &end_time,
+    size_t threads = 0) const;
 
   // Message iterators
   View getMessages();
   View getMessages(const std::string &topic);
   View getMessages(const std::vector<std::string> &topics);
   View getMessages(std::initializer_list<std::string> topics);
+  // Only messages with start_time <= timestamp <= end_time are yielded
+  View getMessages(const std::vector<std::string> &topics, const RosValue::ros_time_t &start_time, const RosValue::ros_time_t &end_time);
+  // Restricts this View to the chunks of a shard
+  View getMessages(const shard_t &shard);
+
+  // The fields to keep for each topic, such as {{"/points", {"header", "width", "height"}}}
+  typedef std::map<std::string, std::vector<std::string>> projection_t;
+  // Selects the topics of a projection.  Their messages only parse the fields on the given paths and skip over the
+  // bytes of everything else, so their data only has the kept fields (see ParseProgram::project).  A topic without
+  // any paths keeps all of its fields.
+  View getMessages(const projection_t &projection);
+
+  // A cheap filter on a message's connection (topic, type, callerid, latching...) and record timestamp.
+  // It is checked against the bag index to skip whole chunks and against each record header before a
+  // RosMessage is built.  Predicates are not part of shard descriptors, so views with one can't be sharded.
+  typedef std::function<bool(const RosBagTypes::connection_data_t &connection, const RosValue::ros_time_t &timestamp)> predicate_t;
+  View getMessages(const std::vector<std::string> &topics, const predicate_t &predicate);
+
+  struct sampling_t {
+    // Keep every stride-th message
+    uint32_t stride = 1;
+    // Keep at most one message per period.  A zero period disables rate limiting.
+    RosValue::ros_duration_t period{0, 0};
+    // Rather than keeping messages at least one period apart, keep the first message of each period-aligned bucket
+    bool bucketed = false;
+  };
+
+  // Thins out the messages of a topic selected by the last call to getMessages.  Messages are chosen from the
+  // bag index alone, so chunks that hold no kept message are never decompressed.  The stride is applied before
+  // the period, and both are applied across all bags of the View in timestamp order.
+  // Sampling is not part of shard descriptors, so sampled views can't be sharded.
+  View sample(const std::string &topic, const sampling_t &sampling);
+
+  // Partitions the chunks selected by the last call to getMessages into `count` contiguous shards of roughly
+  // equal weight and returns the shard at `index`.  Throws if the view has a predicate or is sampled.
+  shard_t shard(size_t index, size_t count, shard_t::balance_t balance = shard_t::balance_t::uncompressed_bytes) const;
   RosValue::ros_time_t getStartTime();
   RosValue::ros_time_t getEndTime();
 
@@ -161,5 +449,17 @@ class View {
  private:
   std::vector<std::shared_ptr<Bag>> bags_;
   std::unordered_map<std::shared_ptr<Bag>, std::shared_ptr<iterator::bag_wrapper_t>> bag_wrappers_;
+  RosValue::ros_time_t start_time_{0, 0};
+  RosValue::ros_time_t end_time_{UINT32_MAX, UINT32_MAX};
+  predicate_t predicate_;
+
+  bool matches(const RosBagTypes::connection_data_t &connection, const RosValue::ros_time_t &timestamp) const;
+  plan_t planChunks(bool reverse) const;
+  // The program the messages of topic are parsed with, checking that every bag of plan has the same definition of it,
+  // along with the ids of its connections in each bag
+  static std::shared_ptr<const ParseProgram> topicProgram(
+    const plan_t &plan,
+    const std::string &topic,
+    std::vector<std::unordered_set<uint32_t>> &connection_ids);
 };
 }
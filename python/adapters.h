@@ -3,6 +3,8 @@
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+#include "dict_plan.h"
+#include "lib/view.h"
 #include "utils.h"
 
 namespace py = pybind11;
@@ -177,33 +179,63 @@ py::dict rosValueToDict(
   return dict;
 }
 
+// How times and durations are converted for ros_time_py_type: kept as RosTime and RosDuration objects for None,
+// or converted to nanoseconds for int and to seconds for float
+DictPlan::TimeConversion timeConversion(const py::object& ros_time_py_type) {
+  if (ros_time_py_type.is_none()) {
+    return DictPlan::TimeConversion::object;
+  }
+
+  if (!py::isinstance<py::type>(ros_time_py_type)) {
+    throw py::type_error("Provided python type for casting a ROS time is not a type!");
+  }
+
+  PyObject* native_py_type = ros_time_py_type.ptr();
+  if (
+    native_py_type == (PyObject*) &PyLong_Type
+    // In python2, we also need to support the PyInt_Type
+    // (In python3, all `int`s are `long`s under the hood)
+    #if PY_VERSION_HEX < 0x03000000
+    || native_py_type == (PyObject*) &PyInt_Type
+    #endif
+  ) {
+    return DictPlan::TimeConversion::nanoseconds;
+  } else if (native_py_type == (PyObject*) &PyFloat_Type) {
+    return DictPlan::TimeConversion::seconds;
+  }
+
+  throw py::value_error("Can only cast ROS times and durations to int or float!");
+}
+
 template<typename RosTimeType>
 py::object castRosTime(const Embag::RosValue::Pointer& ros_value, const py::object& py_type=py::none()) {
   const RosTimeType time_value = ros_value->as<RosTimeType>();
-  if (py_type.is_none()) {
-    // Keep as a RosTime or RosDuration
-    return py::cast(time_value);
-  } else if (!py::isinstance<py::type>(py_type)) {
-    throw py::type_error("Provided python type for casting a ROS time is not a type!");
-  } else {
-    PyObject* native_py_type = py_type.ptr();
-    if (
-      native_py_type == (PyObject*) &PyLong_Type
-      // In python2, we also need to support the PyInt_Type
-      // (In python3, all `int`s are `long`s under the hood)
-      #if PY_VERSION_HEX < 0x03000000
-      || native_py_type == (PyObject*) &PyInt_Type
-      #endif
-    ) {
+  switch (timeConversion(py_type)) {
+    case DictPlan::TimeConversion::nanoseconds:
       return py::cast(time_value.to_nsec());
-    } else if (native_py_type == (PyObject*) &PyFloat_Type) {
+    case DictPlan::TimeConversion::seconds:
       return py::cast(time_value.to_sec());
-    } else {
-      throw py::value_error("Can only cast ROS times and durations to int or float!");
-    }
+    default:
+      // Keep as a RosTime or RosDuration
+      return py::cast(time_value);
   }
 }
 
+// The options of rosValueToDict, for converting a whole message with a DictPlan
+DictPlan::options_t dictPlanOptions(
+    const RosValueTypeSet &array_blob_types,
+    bool blob_types_as_memoryview,
+    const py::object& ros_time_py_type) {
+  DictPlan::options_t options;
+  for (const auto type : array_blob_types) {
+    options.blob_types |= 1u << static_cast<uint32_t>(type);
+  }
+  options.blob_types_as_memoryview = blob_types_as_memoryview;
+  options.times = timeConversion(ros_time_py_type);
+
+  return options;
+}
+
 py::object castValue(const Embag::RosValue::Pointer& value, const py::object& ros_time_py_type=py::none()) {
   switch (value->getType()) {
     case Embag::RosValue::Type::object:
@@ -259,6 +291,80 @@ py::object getIndex(Embag::RosValue::Pointer &v, const size_t index) {
   return castValue(v->at(index));
 }
 
+// The numpy dtype of a primitive value: times and durations become (secs, nsecs) pairs
+py::dtype primitiveDtype(Embag::RosValue::Type type) {
+  if (type == Embag::RosValue::Type::ros_time || type == Embag::RosValue::Type::ros_duration) {
+    return py::dtype(
+      py::list(py::make_tuple("secs", "nsecs")),
+      py::list(py::make_tuple(py::dtype("I"), py::dtype("I"))),
+      py::list(py::make_tuple(0, sizeof(uint32_t))),
+      2 * sizeof(uint32_t));
+  }
+
+  return py::dtype(Embag::RosValue::primitiveTypeToFormat(type));
+}
+
+// The numeric type of a native numpy dtype, or of anything np.dtype accepts such as np.float64.  A RosValueType is
+// taken as is.
+Embag::RosValue::Type numericType(const py::object &dtype) {
+  if (py::isinstance<Embag::RosValue::Type>(dtype)) {
+    return dtype.cast<Embag::RosValue::Type>();
+  }
+
+  const auto numpy_dtype = py::dtype::from_args(dtype);
+  if (numpy_dtype.attr("isnative").cast<bool>()) {
+    const auto kind = numpy_dtype.kind();
+    switch (numpy_dtype.itemsize()) {
+      case 1:
+        if (kind == 'i') return Embag::RosValue::Type::int8;
+        if (kind == 'u') return Embag::RosValue::Type::uint8;
+        break;
+      case 2:
+        if (kind == 'i') return Embag::RosValue::Type::int16;
+        if (kind == 'u') return Embag::RosValue::Type::uint16;
+        break;
+      case 4:
+        if (kind == 'i') return Embag::RosValue::Type::int32;
+        if (kind == 'u') return Embag::RosValue::Type::uint32;
+        if (kind == 'f') return Embag::RosValue::Type::float32;
+        break;
+      case 8:
+        if (kind == 'i') return Embag::RosValue::Type::int64;
+        if (kind == 'u') return Embag::RosValue::Type::uint64;
+        if (kind == 'f') return Embag::RosValue::Type::float64;
+        break;
+    }
+  }
+
+  throw std::runtime_error("Only native integer and floating point dtypes are supported, not " + py::str(numpy_dtype).cast<std::string>());
+}
+
+// The numpy dtype of a record layout: objects become nested structured types, primitives are as for primitiveDtype,
+// and fixed length arrays become subarrays
+py::dtype recordsDtype(const std::vector<Embag::View::records_t::field_t> &fields, size_t itemsize) {
+  py::list names;
+  py::list formats;
+  py::list offsets;
+  for (const auto &field : fields) {
+    py::dtype format;
+    if (field.type == Embag::RosValue::Type::object) {
+      format = recordsDtype(field.fields, field.size);
+    } else {
+      format = primitiveDtype(field.type);
+    }
+
+    if (field.array_size != 0) {
+      format = py::dtype::from_args(py::make_tuple(format, py::make_tuple(field.array_size)));
+    }
+
+    names.append(py::str(field.name));
+    formats.append(format);
+    offsets.append(field.offset);
+  }
+
+  return py::dtype(names, formats, offsets, itemsize);
+}
+
 namespace Embag {
 template<>
 const py::object RosValue::const_iterator<py::object, size_t>::operator*() const {
@@ -266,12 +372,12 @@ const py::object RosValue::const_iterator<py::object, size_t>::operator*() const
 }
 
 template<>
-const py::str RosValue::const_iterator<py::str, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const {
+const py::str RosValue::const_iterator<py::str, FieldIndex::const_iterator>::operator*() const {
   return index_->first;
 }
 
 template<>
-const py::tuple RosValue::const_iterator<py::tuple, std::unordered_map<std::string, size_t>::const_iterator>::operator*() const {
-  return py::make_tuple(index_->first, castValue(value_.object_info_.children.at(index_->second)));
+const py::tuple RosValue::const_iterator<py::tuple, FieldIndex::const_iterator>::operator*() const {
+  return py::make_tuple(index_->first, castValue(value_.at(index_->second)));
 }
 }
@@ -0,0 +1,433 @@
+#include <cstring>
+#include <unordered_map>
+
+#include <structmember.h>
+
+#include "dict_plan.h"
+
+namespace {
+
+using Type = Embag::RosValue::Type;
+using Opcode = Embag::ParseProgram::Opcode;
+
+py::object steal(PyObject *object) {
+  if (object == nullptr) {
+    throw py::error_already_set();
+  }
+
+  return py::reinterpret_steal<py::object>(object);
+}
+
+py::object internedKey(const std::string &name) {
+#if PY_VERSION_HEX >= 0x03000000
+  return steal(PyUnicode_InternFromString(name.c_str()));
+#else
+  return steal(PyString_InternFromString(name.c_str()));
+#endif
+}
+
+template<typename T>
+T load(const char *data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+PyObject *convertBool(const char *data) {
+  return PyBool_FromLong(load<bool>(data));
+}
+
+template<typename T>
+PyObject *convertSigned(const char *data) {
+  return PyLong_FromLongLong(load<T>(data));
+}
+
+template<typename T>
+PyObject *convertUnsigned(const char *data) {
+  return PyLong_FromUnsignedLongLong(load<T>(data));
+}
+
+template<typename T>
+PyObject *convertFloat(const char *data) {
+  return PyFloat_FromDouble(load<T>(data));
+}
+
+void checkFits(size_t offset, size_t size, size_t length) {
+  if (offset + size > length) {
+    throw std::runtime_error("Message is shorter than its definition requires");
+  }
+}
+
+template<typename RosTimeType>
+py::object convertTime(const char *data, DictPlan::TimeConversion times) {
+  const RosTimeType value{load<uint32_t>(data), load<uint32_t>(data + sizeof(uint32_t))};
+  switch (times) {
+    case DictPlan::TimeConversion::nanoseconds:
+      return steal(PyLong_FromLongLong(value.to_nsec()));
+    case DictPlan::TimeConversion::seconds:
+      return steal(PyFloat_FromDouble(value.to_sec()));
+    default:
+      return py::cast(value);
+  }
+}
+
+py::object convertTimeOfType(Type type, const char *data, DictPlan::TimeConversion times) {
+  if (type == Type::ros_time) {
+    return convertTime<Embag::RosValue::ros_time_t>(data, times);
+  }
+
+  return convertTime<Embag::RosValue::ros_duration_t>(data, times);
+}
+
+// The shared program of a type embedded in another, which keeps it alive
+std::shared_ptr<const Embag::ParseProgram> embeddedProgram(
+    const Embag::ParseProgram &program,
+    const Embag::ParseProgram *embedded) {
+  for (const auto &embedded_program : program.embedded_programs) {
+    if (embedded_program.get() == embedded) {
+      return embedded_program;
+    }
+  }
+
+  throw std::runtime_error("The program of " + program.type_name + " doesn't own the programs it embeds");
+}
+
+py::handle typeOf(py::handle object) {
+  return reinterpret_cast<PyObject *>(Py_TYPE(object.ptr()));
+}
+
+py::object recordRepr(py::handle self) {
+  py::list fields;
+  for (const auto name : typeOf(self).attr("__slots__")) {
+    fields.append(py::str("{}={!r}").format(name, self.attr(name)));
+  }
+
+  return py::str("{}({})").format(typeOf(self).attr("__name__"), py::str(", ").attr("join")(fields));
+}
+
+py::object recordEquals(py::handle self, py::handle other) {
+  if (typeOf(self).ptr() != typeOf(other).ptr()) {
+    return py::reinterpret_borrow<py::object>(Py_NotImplemented);
+  }
+
+  for (const auto name : typeOf(self).attr("__slots__")) {
+    if (!self.attr(name).equal(other.attr(name))) {
+      return py::bool_(false);
+    }
+  }
+
+  return py::bool_(true);
+}
+
+// The base of every record class, which compares and prints records by their fields like rospy messages
+py::handle recordBase() {
+  // Never destroyed, as the record classes derive from it
+  static PyObject *base = nullptr;
+  if (base == nullptr) {
+    py::dict attributes;
+    attributes["__slots__"] = py::tuple();
+    attributes["__module__"] = py::str("embag");
+    auto type = steal(PyObject_CallFunction(
+      reinterpret_cast<PyObject *>(&PyType_Type), "s(O)O", "Record", &PyBaseObject_Type, attributes.ptr()));
+
+    type.attr("__repr__") = py::cpp_function(recordRepr, py::name("__repr__"), py::is_method(type));
+    type.attr("__eq__") = py::cpp_function(recordEquals, py::name("__eq__"), py::is_method(type));
+    // Python 2 doesn't derive != from ==
+    type.attr("__ne__") = py::cpp_function(
+      [](py::handle self, py::handle other) -> py::object {
+        const auto equals = recordEquals(self, other);
+        if (equals.ptr() == Py_NotImplemented) {
+          return equals;
+        }
+        return py::bool_(!equals.cast<bool>());
+      },
+      py::name("__ne__"),
+      py::is_method(type));
+
+    base = type.release().ptr();
+  }
+
+  return base;
+}
+
+// The plans of message programs, dropped once their program is gone
+struct plan_cache_t {
+  struct entry_t {
+    std::weak_ptr<const Embag::ParseProgram> program;
+    std::shared_ptr<const DictPlan> plan;
+  };
+
+  std::unordered_map<const Embag::ParseProgram *, entry_t> entries;
+};
+
+}
+
+py::object memoryviewOf(const BufferView &view) {
+  return steal(PyMemoryView_FromObject(py::cast(view).ptr()));
+}
+
+DictPlan::DictPlan(const Embag::ParseProgram &program)
+  : program_(program)
+{
+  fields_.reserve(program.fields.size());
+  for (size_t i = 0; i < program.fields.size(); ++i) {
+    const auto &instruction = program.fields[i];
+
+    field_t field{internedKey(program.field_indexes->name(i)), &instruction, nullptr, nullptr};
+    switch (instruction.type) {
+      case Type::ros_bool: field.convert_scalar = convertBool; break;
+      case Type::int8: field.convert_scalar = convertSigned<int8_t>; break;
+      case Type::uint8: field.convert_scalar = convertUnsigned<uint8_t>; break;
+      case Type::int16: field.convert_scalar = convertSigned<int16_t>; break;
+      case Type::uint16: field.convert_scalar = convertUnsigned<uint16_t>; break;
+      case Type::int32: field.convert_scalar = convertSigned<int32_t>; break;
+      case Type::uint32: field.convert_scalar = convertUnsigned<uint32_t>; break;
+      case Type::int64: field.convert_scalar = convertSigned<int64_t>; break;
+      case Type::uint64: field.convert_scalar = convertUnsigned<uint64_t>; break;
+      case Type::float32: field.convert_scalar = convertFloat<float>; break;
+      case Type::float64: field.convert_scalar = convertFloat<double>; break;
+      default: break;
+    }
+
+    // Embedded types share the plan of their program, and so its record class, wherever they appear
+    if (instruction.program != nullptr) {
+      field.plan = forProgram(embeddedProgram(program, instruction.program));
+    }
+
+    fields_.push_back(std::move(field));
+  }
+}
+
+std::shared_ptr<const DictPlan> DictPlan::forProgram(const std::shared_ptr<const Embag::ParseProgram> &program) {
+  // Never destroyed, as the plans hold Python objects that can't be released once the interpreter is shutting down
+  static plan_cache_t *cache = new plan_cache_t();
+
+  const auto existing = cache->entries.find(program.get());
+  if (existing != cache->entries.end() && existing->second.program.lock() == program) {
+    return existing->second.plan;
+  }
+
+  // Forget the plans of programs that no longer exist, along with any stale entry at this address
+  for (auto entry = cache->entries.begin(); entry != cache->entries.end();) {
+    if (entry->second.program.expired() || entry->first == program.get()) {
+      entry = cache->entries.erase(entry);
+    } else {
+      ++entry;
+    }
+  }
+
+  const auto plan = std::make_shared<const DictPlan>(*program);
+  cache->entries.emplace(program.get(), plan_cache_t::entry_t{program, plan});
+  return plan;
+}
+
+py::object DictPlan::convert(const Embag::RosMessage &message, const options_t &options) const {
+  checkFits(message.raw_buffer_offset, message.raw_data_len, message.raw_buffer->size());
+
+  const context_t context{
+    message.raw_buffer,
+    message.raw_buffer->data() + message.raw_buffer_offset,
+    message.raw_data_len,
+    options,
+  };
+
+  size_t offset = 0;
+  return convertObject(context, offset);
+}
+
+const DictPlan::record_class_t &DictPlan::recordClass() const {
+  if (record_class_ != nullptr) {
+    return *record_class_;
+  }
+
+  // The classes by type name and field names, so that programs of a type parsed from different connections, or
+  // embedded in different messages, share one class.  Never destroyed, like the plans.
+  static auto *record_classes = new std::unordered_map<std::string, record_class_t>();
+
+  const auto &type_name = program_.type_name;
+  std::string layout = type_name;
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    layout += '\0';
+    layout += program_.field_indexes->name(i);
+  }
+
+  auto record_class = record_classes->find(layout);
+  if (record_class == record_classes->end()) {
+    const std::string class_name = type_name.empty() ? "Message" : type_name.substr(type_name.rfind('/') + 1);
+
+    // Slots rather than an instance dict, in declaration order like the __slots__ of rospy classes.  Any identifier,
+    // Python keywords included, can name a slot, so every field keeps its name.
+    py::tuple slots(fields_.size());
+    for (size_t i = 0; i < fields_.size(); ++i) {
+      slots[i] = fields_[i].key;
+    }
+
+    py::dict attributes;
+    attributes["__slots__"] = slots;
+    attributes["__module__"] = py::str("embag");
+    attributes["_type"] = py::str(type_name);
+
+    record_class_t generated{
+      steal(PyObject_CallFunction(
+        reinterpret_cast<PyObject *>(&PyType_Type), "s(O)O", class_name.c_str(), recordBase().ptr(), attributes.ptr())),
+      {},
+    };
+
+    // Each slot is read by a member descriptor on the class, which holds the slot's offset in the instances
+    generated.slot_offsets.reserve(fields_.size());
+    for (const auto &field : fields_) {
+      const auto descriptor = steal(PyObject_GetAttr(generated.type.ptr(), field.key.ptr()));
+      if (Py_TYPE(descriptor.ptr()) != &PyMemberDescr_Type) {
+        throw std::runtime_error("The record class of " + type_name + " has no slot for a field");
+      }
+
+      generated.slot_offsets.push_back(reinterpret_cast<PyMemberDescrObject *>(descriptor.ptr())->d_member->offset);
+    }
+
+    record_class = record_classes->emplace(layout, std::move(generated)).first;
+  }
+
+  record_class_ = &record_class->second;
+  return *record_class_;
+}
+
+py::object DictPlan::convertObject(const context_t &context, size_t &offset) const {
+  if (context.options.records) {
+    return convertRecord(context, offset);
+  }
+
+  const auto dict = steal(PyDict_New());
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    offset = program_.skipDropped(i, context.data, context.length, offset);
+
+    const auto value = convertField(context, fields_[i], offset);
+    if (PyDict_SetItem(dict.ptr(), fields_[i].key.ptr(), value.ptr()) != 0) {
+      throw py::error_already_set();
+    }
+  }
+
+  offset = program_.skipDropped(fields_.size(), context.data, context.length, offset);
+  return dict;
+}
+
+py::object DictPlan::convertRecord(const context_t &context, size_t &offset) const {
+  // Allocated like object.__new__ does, with empty slots that the values are stored straight into
+  const auto &record_class = recordClass();
+  auto *type = reinterpret_cast<PyTypeObject *>(record_class.type.ptr());
+  const auto record = steal(type->tp_alloc(type, 0));
+  char *instance = reinterpret_cast<char *>(record.ptr());
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    offset = program_.skipDropped(i, context.data, context.length, offset);
+
+    auto value = convertField(context, fields_[i], offset);
+    *reinterpret_cast<PyObject **>(instance + record_class.slot_offsets[i]) = value.release().ptr();
+  }
+
+  offset = program_.skipDropped(fields_.size(), context.data, context.length, offset);
+  return record;
+}
+
+py::object DictPlan::convertField(const context_t &context, const field_t &field, size_t &offset) const {
+  const auto &instruction = *field.instruction;
+  switch (instruction.opcode) {
+    case Opcode::primitive:
+    case Opcode::string:
+      return convertPrimitive(context, field, offset);
+    case Opcode::object:
+      return field.plan->convertObject(context, offset);
+    default:
+      break;
+  }
+
+  size_t array_length;
+  if (instruction.array_size == -1) {
+    array_length = Embag::ParseProgram::readLength(context.data, context.length, offset);
+    offset += sizeof(uint32_t);
+  } else {
+    array_length = static_cast<size_t>(instruction.array_size);
+  }
+
+  if (instruction.opcode == Opcode::primitive_array) {
+    return convertPrimitiveArray(context, field, array_length, offset);
+  }
+
+  const auto list = steal(PyList_New(array_length));
+  for (size_t i = 0; i < array_length; ++i) {
+    py::object element;
+    if (instruction.opcode == Opcode::string_array) {
+      element = convertPrimitive(context, field, offset);
+    } else {
+      element = field.plan->convertObject(context, offset);
+    }
+
+    PyList_SET_ITEM(list.ptr(), i, element.release().ptr());
+  }
+
+  return list;
+}
+
+py::object DictPlan::convertPrimitive(const context_t &context, const field_t &field, size_t &offset) const {
+  const auto type = field.instruction->type;
+  if (type == Type::string) {
+    const uint32_t string_length = Embag::ParseProgram::readLength(context.data, context.length, offset);
+    offset += sizeof(uint32_t);
+    checkFits(offset, string_length, context.length);
+
+    const auto string = steal(PyUnicode_DecodeLatin1(context.data + offset, string_length, nullptr));
+    offset += string_length;
+    return string;
+  }
+
+  const size_t size = field.instruction->element_size;
+  checkFits(offset, size, context.length);
+  const char *data = context.data + offset;
+  offset += size;
+
+  if (field.convert_scalar != nullptr) {
+    return steal(field.convert_scalar(data));
+  }
+
+  return convertTimeOfType(type, data, context.options.times);
+}
+
+py::object DictPlan::convertPrimitiveArray(const context_t &context, const field_t &field, size_t length, size_t &offset) const {
+  const auto type = field.instruction->type;
+  const size_t element_size = field.instruction->element_size;
+  checkFits(offset, length * element_size, context.length);
+  const char *data = context.data + offset;
+  const size_t buffer_offset = data - context.buffer->data();
+  offset += length * element_size;
+
+  if (context.options.isBlob(type)) {
+    if (context.options.blob_types_as_memoryview) {
+      const BufferView view{context.buffer, buffer_offset, length, type};
+      #if PY_VERSION_HEX >= 0x03030000
+        // In python 3.3 and above, memoryview provides good support for converting to a list via tolist
+        return memoryviewOf(view);
+      #else
+        // In other versions, we need to rely on numpy arrays to provide a powerful tolist functionality
+        return py::module::import("numpy").attr("array")(py::cast(view));
+      #endif
+    }
+
+    return steal(PyBytes_FromStringAndSize(data, length * element_size));
+  }
+
+  const auto list = steal(PyList_New(length));
+  for (size_t i = 0; i < length; ++i) {
+    const char *element = data + i * element_size;
+    PyObject *value;
+    if (field.convert_scalar != nullptr) {
+      value = field.convert_scalar(element);
+      if (value == nullptr) {
+        throw py::error_already_set();
+      }
+    } else {
+      value = convertTimeOfType(type, element, context.options.times).release().ptr();
+    }
+
+    PyList_SET_ITEM(list.ptr(), i, value);
+  }
+
+  return list;
+}
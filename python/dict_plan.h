@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+#include "lib/parse_program.h"
+#include "lib/ros_message.h"
+
+namespace py = pybind11;
+
+// A run of primitive values inside a message buffer, exposed to Python through the buffer protocol.  It shares
+// ownership of the buffer, so memoryviews of it stay valid after the message is gone.
+struct BufferView {
+  std::shared_ptr<std::vector<char>> buffer;
+  size_t offset;
+  size_t length;
+  Embag::RosValue::Type element_type;
+};
+
+// A memoryview of a BufferView, which keeps its buffer alive
+py::object memoryviewOf(const BufferView &view);
+
+// Converts messages of one type to dicts straight from their raw bytes, without parsing them into RosValues first.
+//
+// A plan is compiled once per parse program: the dict keys are created up front as interned Python strings, and each
+// field gets a converter for its type, so converting a message only creates the values themselves.  The dicts have the
+// same contents as rosValueToDict gives for the parsed message, with keys in declaration order.
+//
+// Messages can be converted to records instead, instances of a class generated for the type on first use and shared by
+// every program of the type with the same fields.  Like rospy classes, the class is named after the type, has a slot
+// per field and the type name as _type, so rospy style code such as msg.pose.position.x = 0 runs unchanged.  Records
+// are filled straight into their slots and take less memory than dicts.
+class DictPlan {
+ public:
+  enum class TimeConversion {
+    // RosTime and RosDuration objects
+    object,
+    nanoseconds,
+    seconds,
+  };
+
+  struct options_t {
+    // A bit for each RosValue::Type of primitive array element that is converted to bytes rather than a list
+    uint32_t blob_types = 0;
+    bool blob_types_as_memoryview = false;
+    TimeConversion times = TimeConversion::object;
+    // Objects become records rather than dicts
+    bool records = false;
+
+    bool isBlob(Embag::RosValue::Type type) const {
+      return blob_types & (1u << static_cast<uint32_t>(type));
+    }
+  };
+
+  explicit DictPlan(const Embag::ParseProgram &program);
+
+  // The plan for the program a message is parsed with, compiled on first use.  Must be called with the GIL held.
+  static std::shared_ptr<const DictPlan> forProgram(const std::shared_ptr<const Embag::ParseProgram> &program);
+
+  py::object convert(const Embag::RosMessage &message, const options_t &options) const;
+
+ private:
+  typedef PyObject *(*scalar_converter_t)(const char *data);
+
+  struct field_t {
+    py::object key;
+    const Embag::ParseProgram::instruction_t *instruction;
+    // For primitive fields and primitive arrays, the converter for a single value
+    scalar_converter_t convert_scalar;
+    // For objects and object arrays, the plan of the embedded program
+    std::shared_ptr<const DictPlan> plan;
+  };
+
+  // State shared by every object of one conversion
+  struct context_t {
+    const std::shared_ptr<std::vector<char>> &buffer;
+    const char *data;
+    size_t length;
+    const options_t &options;
+  };
+
+  // A generated record class, with the offset of each field's slot in its instances
+  struct record_class_t {
+    py::object type;
+    std::vector<Py_ssize_t> slot_offsets;
+  };
+
+  // The record class of the type, created on first use
+  const record_class_t &recordClass() const;
+
+  py::object convertObject(const context_t &context, size_t &offset) const;
+  py::object convertRecord(const context_t &context, size_t &offset) const;
+  py::object convertField(const context_t &context, const field_t &field, size_t &offset) const;
+  py::object convertPrimitive(const context_t &context, const field_t &field, size_t &offset) const;
+  py::object convertPrimitiveArray(const context_t &context, const field_t &field, size_t length, size_t &offset) const;
+
+  const Embag::ParseProgram &program_;
+  std::vector<field_t> fields_;
+  mutable const record_class_t *record_class_ = nullptr;
+};
@@ -1,5 +1,10 @@
+#include "lib/point_cloud.h"
 #include "lib/view.h"
 
+#include <cmath>
+
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -13,15 +18,55 @@ namespace py = pybind11;
 PYBIND11_MODULE(libembag, m) {
   m.doc() = "Python bindings for Embag";
 
+  py::class_<MessageIterator>(m, "MessageIterator")
+      .def("__iter__", [](py::object self) { return self; })
+      .def("__next__", [](MessageIterator &it) {
+        auto message = it.next();
+        if (!message) {
+          throw py::stop_iteration();
+        }
+
+        return message;
+      });
+
+  py::class_<IteratorCompat>(m, "IteratorCompat")
+      .def("__iter__", [](py::object self) { return self; })
+      .def("__next__", &IteratorCompat::next);
+
   py::class_<Embag::Bag, std::shared_ptr<Embag::Bag>>(m, "Bag")
-      .def(py::init<const std::string>())
-      .def(py::init([](const std::string &bytes, size_t length) {
-        return std::make_shared<Embag::Bag>(std::make_shared<const std::string>(bytes));
-      }))
+      // A single string is a path, anything else is a bag in memory, see isBagPath
+      .def(
+        py::init([](py::object source, py::object length) {
+          if (length.is_none() && isBagPath(source)) {
+            const auto bag_path = source.cast<std::string>();
+            return withoutGil([&]() {
+              return std::make_shared<Embag::Bag>(bag_path);
+            });
+          }
+
+          size_t buffer_length;
+          auto bytes = sharedBuffer(source, buffer_length);
+          if (!length.is_none()) {
+            if (length.cast<size_t>() > buffer_length) {
+              throw std::runtime_error("The length of the bag is larger than its buffer");
+            }
+            buffer_length = length.cast<size_t>();
+          }
+
+          return withoutGil([&]() {
+            return std::make_shared<Embag::Bag>(std::move(bytes), buffer_length);
+          });
+        }),
+        py::arg("source"),
+        py::arg("length") = py::none())
       .def("topics", &Embag::Bag::topics)
       .def(
         "read_messages",
-        [](std::shared_ptr<Embag::Bag> &bag, py::object topics) {
+        [](std::shared_ptr<Embag::Bag> &bag, py::object topics, bool raw, bool records) {
+          if (raw && records) {
+            throw std::runtime_error("Messages can't be both raw and records");
+          }
+
           Embag::View view{};
           view.addBag(bag);
           if (topics.is_none()) {
@@ -34,10 +79,14 @@ PYBIND11_MODULE(libembag, m) {
             throw std::runtime_error("topics must be None, a string, or a list!");
           }
 
-          return py::make_iterator(IteratorCompat{view.begin()}, IteratorCompat{view.end()});
+          // The first chunk is read as soon as iteration begins
+          const auto begin = withoutGil([&]() { return view.begin(); });
+          return IteratorCompat{MessageIterator{begin, view.end()}, raw, records};
         },
         py::keep_alive<0, 1>(), /* Essential: keep object alive while iterator exists */
-        py::arg("topics") = py::none()
+        py::arg("topics") = py::none(),
+        py::arg("raw") = false,
+        py::arg("records") = false
       )
       .def("getSchema", [](std::shared_ptr<Embag::Bag> &bag, const std::string &topic) {
         auto builder = SchemaBuilder{bag};
@@ -46,20 +95,253 @@ PYBIND11_MODULE(libembag, m) {
       .def("connectionsByTopic", &Embag::Bag::connectionsByTopicMap)
       .def("close", &Embag::Bag::close);
 
+  py::class_<Embag::View::shard_t> shard(m, "Shard");
+  py::enum_<Embag::View::shard_t::balance_t>(shard, "Balance")
+      .value("uncompressed_bytes", Embag::View::shard_t::balance_t::uncompressed_bytes)
+      .value("message_count", Embag::View::shard_t::balance_t::message_count)
+      .export_values();
+  shard
+      .def_readonly("index", &Embag::View::shard_t::index)
+      .def_readonly("count", &Embag::View::shard_t::count)
+      .def("toString", &Embag::View::shard_t::toString)
+      .def_static("fromString", &Embag::View::shard_t::fromString)
+      .def("__str__", &Embag::View::shard_t::toString);
+
+  py::class_<Embag::View::plan_t>(m, "Plan")
+      .def_readonly("reverse", &Embag::View::plan_t::reverse)
+      .def_readonly("message_counts", &Embag::View::plan_t::message_counts)
+      .def_readonly("compressed_bytes", &Embag::View::plan_t::compressed_bytes)
+      .def_readonly("uncompressed_bytes", &Embag::View::plan_t::uncompressed_bytes)
+      .def_readonly("wanted_bytes", &Embag::View::plan_t::wanted_bytes)
+      .def_property_readonly("chunk_count", [](const Embag::View::plan_t &p) {
+        return p.chunks.size();
+      })
+      .def("readAmplification", &Embag::View::plan_t::readAmplification)
+      .def("explain", &Embag::View::plan_t::explain)
+      .def("__str__", &Embag::View::plan_t::explain);
+
+  // Arrow PyCapsule interface: https://arrow.apache.org/docs/format/CDataInterface/PyCapsuleInterface.html
+  py::class_<Embag::ArrowBatches, std::shared_ptr<Embag::ArrowBatches>>(m, "ArrowBatches")
+      .def("__len__", &Embag::ArrowBatches::size)
+      .def_property_readonly("num_rows", &Embag::ArrowBatches::rowCount)
+      .def("__arrow_c_schema__", [](const Embag::ArrowBatches &b) {
+        std::unique_ptr<ArrowSchema> schema{new ArrowSchema()};
+        b.exportSchema(schema.get());
+        const auto capsule = PyCapsule_New(schema.get(), "arrow_schema", [](PyObject *object) {
+          auto *exported = static_cast<ArrowSchema *>(PyCapsule_GetPointer(object, "arrow_schema"));
+          if (exported->release != nullptr) {
+            exported->release(exported);
+          }
+          delete exported;
+        });
+        if (capsule == nullptr) {
+          schema->release(schema.get());
+          throw py::error_already_set();
+        }
+
+        schema.release();
+        return py::reinterpret_steal<py::object>(capsule);
+      })
+      .def("__arrow_c_stream__", [](const Embag::ArrowBatches &b, py::object requested_schema) {
+        // The batches are always exported with their own schema, which consumers are free to cast
+        std::unique_ptr<ArrowArrayStream> stream{new ArrowArrayStream()};
+        b.exportStream(stream.get());
+        const auto capsule = PyCapsule_New(stream.get(), "arrow_array_stream", [](PyObject *object) {
+          auto *exported = static_cast<ArrowArrayStream *>(PyCapsule_GetPointer(object, "arrow_array_stream"));
+          if (exported->release != nullptr) {
+            exported->release(exported);
+          }
+          delete exported;
+        });
+        if (capsule == nullptr) {
+          stream->release(stream.get());
+          throw py::error_already_set();
+        }
+
+        stream.release();
+        return py::reinterpret_steal<py::object>(capsule);
+      }, py::arg("requested_schema") = py::none());
+
   py::class_<Embag::View>(m, "View")
       .def(py::init())
       .def(py::init<std::shared_ptr<Embag::Bag>>())
-      .def(py::init<const std::string&>())
-      .def("addBag", (Embag::View (Embag::View::*)(const std::string &)) &Embag::View::addBag)
+      .def(py::init<const std::string&>(), py::call_guard<py::gil_scoped_release>())
+      .def(
+        "addBag",
+        (Embag::View (Embag::View::*)(const std::string &)) &Embag::View::addBag,
+        py::call_guard<py::gil_scoped_release>())
       .def("addBag", (Embag::View (Embag::View::*)(std::shared_ptr<Embag::Bag>)) &Embag::View::addBag)
       .def("getStartTime", &Embag::View::getStartTime)
       .def("getEndTime", &Embag::View::getEndTime)
       .def("getMessages", (Embag::View (Embag::View::*)(void)) &Embag::View::getMessages)
       .def("getMessages", (Embag::View (Embag::View::*)(const std::string &)) &Embag::View::getMessages)
       .def("getMessages", (Embag::View (Embag::View::*)(const std::vector<std::string> &)) &Embag::View::getMessages)
+      .def(
+        "getMessages",
+        (Embag::View (Embag::View::*)(
+          const std::vector<std::string> &,
+          const Embag::RosValue::ros_time_t &,
+          const Embag::RosValue::ros_time_t &)) &Embag::View::getMessages,
+        py::arg("topics"),
+        py::arg("start_time"),
+        py::arg("end_time"))
+      .def("getMessages", (Embag::View (Embag::View::*)(const Embag::View::shard_t &)) &Embag::View::getMessages)
+      .def(
+        "getMessages",
+        (Embag::View (Embag::View::*)(const std::vector<std::string> &, const Embag::View::predicate_t &)) &Embag::View::getMessages,
+        py::arg("topics"),
+        py::arg("predicate"))
+      .def(
+        "sample",
+        [](Embag::View &v, const std::string &topic, uint32_t stride, double period, bool bucketed) {
+          // Also rejects NaN, and periods whose seconds don't fit in a ROS duration
+          if (!(period >= 0.0 && period < 4294967296.0)) {
+            throw py::value_error("The sampling period must be at least 0 and less than 2^32 seconds");
+          }
+
+          Embag::View::sampling_t sampling;
+          sampling.stride = stride;
+          // Rounded to whole nanoseconds before splitting, so rounding can't leave a full second of nanoseconds
+          const long long nanoseconds = std::llround(period * 1e9);
+          sampling.period = Embag::RosValue::ros_duration_t{
+            static_cast<uint32_t>(nanoseconds / 1000000000),
+            static_cast<uint32_t>(nanoseconds % 1000000000),
+          };
+          sampling.bucketed = bucketed;
+          return v.sample(topic, sampling);
+        },
+        py::arg("topic"),
+        py::arg("stride") = 1,
+        py::arg("period") = 0.0,
+        py::arg("bucketed") = false)
+      .def(
+        "shard",
+        &Embag::View::shard,
+        py::arg("index"),
+        py::arg("count"),
+        py::arg("balance") = Embag::View::shard_t::balance_t::uncompressed_bytes)
+      .def("plan", &Embag::View::plan, py::arg("reverse") = false)
+      .def("execute", [](Embag::View &v, const Embag::View::plan_t &plan) {
+        return MessageIterator{withoutGil([&]() { return v.begin(plan); }), v.end()};
+      }, py::keep_alive<0, 1>() /* Essential: keep object alive while iterator exists */ )
       .def("__iter__", [](Embag::View &v) {
-        return py::make_iterator(v.begin(), v.end());
+        return MessageIterator{withoutGil([&]() { return v.begin(); }), v.end()};
+      }, py::keep_alive<0, 1>() /* Essential: keep object alive while iterator exists */ )
+      .def("reversed", [](Embag::View &v) {
+        return MessageIterator{withoutGil([&]() { return v.rbegin(); }), v.rend()};
       }, py::keep_alive<0, 1>() /* Essential: keep object alive while iterator exists */ )
+      .def(
+        "readArrow",
+        [](const Embag::View &v, const std::string &topic, py::object start_time, py::object end_time, size_t threads) {
+          const auto start = start_time.is_none() ? Embag::RosValue::ros_time_t{0, 0} : start_time.cast<Embag::RosValue::ros_time_t>();
+          const auto end = end_time.is_none() ? Embag::RosValue::ros_time_t{UINT32_MAX, UINT32_MAX} : end_time.cast<Embag::RosValue::ros_time_t>();
+          return withoutGil([&]() {
+            return std::make_shared<Embag::ArrowBatches>(v.readArrow(topic, start, end, threads));
+          });
+        },
+        py::arg("topic"),
+        py::arg("start_time") = py::none(),
+        py::arg("end_time") = py::none(),
+        py::arg("threads") = 0)
+      .def(
+        "readRecords",
+        [](const Embag::View &v, const std::string &topic, py::object start_time, py::object end_time, size_t threads) {
+          const auto start = start_time.is_none() ? Embag::RosValue::ros_time_t{0, 0} : start_time.cast<Embag::RosValue::ros_time_t>();
+          const auto end = end_time.is_none() ? Embag::RosValue::ros_time_t{UINT32_MAX, UINT32_MAX} : end_time.cast<Embag::RosValue::ros_time_t>();
+          const auto records = withoutGil([&]() {
+            return std::make_shared<Embag::View::records_t>(v.readRecords(topic, start, end, threads));
+          });
+
+          // The array shares ownership of the rows rather than copying them
+          const py::capsule owner(new std::shared_ptr<Embag::View::records_t>(records), [](void *p) {
+            delete static_cast<std::shared_ptr<Embag::View::records_t> *>(p);
+          });
+
+          return py::array(
+            recordsDtype(records->fields, records->row_size),
+            std::vector<size_t>{records->size()},
+            records->rows.data(),
+            owner);
+        },
+        py::arg("topic"),
+        py::arg("start_time") = py::none(),
+        py::arg("end_time") = py::none(),
+        py::arg("threads") = 0)
+      .def(
+        "readRaw",
+        [](const Embag::View &v, const std::string &topic, py::object start_time, py::object end_time, size_t threads) {
+          const auto start = start_time.is_none() ? Embag::RosValue::ros_time_t{0, 0} : start_time.cast<Embag::RosValue::ros_time_t>();
+          const auto end = end_time.is_none() ? Embag::RosValue::ros_time_t{UINT32_MAX, UINT32_MAX} : end_time.cast<Embag::RosValue::ros_time_t>();
+
+          std::shared_ptr<Embag::View::raw_messages_t> messages;
+          std::shared_ptr<std::vector<int64_t>> timestamps;
+          withoutGil([&]() {
+            messages = std::make_shared<Embag::View::raw_messages_t>(v.readRaw(topic, start, end, threads));
+            timestamps = std::make_shared<std::vector<int64_t>>();
+            timestamps->reserve(messages->size());
+            for (const auto &timestamp : messages->timestamps) {
+              timestamps->push_back(timestamp.to_nsec());
+            }
+          });
+
+          const py::capsule timestamps_owner(new std::shared_ptr<std::vector<int64_t>>(timestamps), [](void *p) {
+            delete static_cast<std::shared_ptr<std::vector<int64_t>> *>(p);
+          });
+          const py::capsule owner(new std::shared_ptr<Embag::View::raw_messages_t>(messages), [](void *p) {
+            delete static_cast<std::shared_ptr<Embag::View::raw_messages_t> *>(p);
+          });
+
+          // The memoryview shares the bytes with the offsets, through a pointer that owns all of the messages
+          const std::shared_ptr<std::vector<char>> bytes{messages, &messages->bytes};
+          return py::make_tuple(
+            py::array_t<int64_t>(timestamps->size(), timestamps->data(), timestamps_owner),
+            memoryviewOf(BufferView{bytes, 0, bytes->size(), Embag::RosValue::Type::uint8}),
+            py::array_t<uint64_t>(messages->offsets.size(), messages->offsets.data(), owner));
+        },
+        py::arg("topic"),
+        py::arg("start_time") = py::none(),
+        py::arg("end_time") = py::none(),
+        py::arg("threads") = 0)
+      .def(
+        "column",
+        [](const Embag::View &v, const std::string &topic, const std::string &path, py::object start_time, py::object end_time, size_t threads) {
+          const auto start = start_time.is_none() ? Embag::RosValue::ros_time_t{0, 0} : start_time.cast<Embag::RosValue::ros_time_t>();
+          const auto end = end_time.is_none() ? Embag::RosValue::ros_time_t{UINT32_MAX, UINT32_MAX} : end_time.cast<Embag::RosValue::ros_time_t>();
+
+          std::shared_ptr<Embag::View::columns_t> columns;
+          std::shared_ptr<std::vector<int64_t>> timestamps;
+          withoutGil([&]() {
+            columns = std::make_shared<Embag::View::columns_t>(v.readColumns(topic, {path}, start, end, threads));
+            timestamps = std::make_shared<std::vector<int64_t>>();
+            timestamps->reserve(columns->timestamps.size());
+            for (const auto &timestamp : columns->timestamps) {
+              timestamps->push_back(timestamp.to_nsec());
+            }
+          });
+
+          // The arrays share ownership of the values rather than copying them
+          const py::capsule timestamps_owner(new std::shared_ptr<std::vector<int64_t>>(timestamps), [](void *p) {
+            delete static_cast<std::shared_ptr<std::vector<int64_t>> *>(p);
+          });
+          const py::capsule owner(new std::shared_ptr<Embag::View::columns_t>(columns), [](void *p) {
+            delete static_cast<std::shared_ptr<Embag::View::columns_t> *>(p);
+          });
+
+          const auto &column = columns->columns.front();
+          const py::array timestamp_array = py::array_t<int64_t>(timestamps->size(), timestamps->data(), timestamps_owner);
+          const py::array values = py::array(primitiveDtype(column.type), std::vector<size_t>{column.size()}, column.bytes.data(), owner);
+          if (!column.isArray()) {
+            return py::make_tuple(timestamp_array, values);
+          }
+
+          const py::array offsets = py::array_t<uint64_t>(column.offsets.size(), column.offsets.data(), owner);
+          return py::make_tuple(timestamp_array, values, offsets);
+        },
+        py::arg("topic"),
+        py::arg("path"),
+        py::arg("start_time") = py::none(),
+        py::arg("end_time") = py::none(),
+        py::arg("threads") = 0)
       .def("topics", &Embag::View::topics)
       .def("connectionsByTopic", &Embag::View::connectionsByTopicMap);
 
@@ -89,9 +371,14 @@ PYBIND11_MODULE(libembag, m) {
       })
       .def("data", [](std::shared_ptr<Embag::RosMessage> &m) {
         return m->data();
-      })
+      }, py::call_guard<py::gil_scoped_release>())
+      // A read-only memoryview that shares the buffer of the message's chunk rather than copying the message
       .def_property_readonly("raw_data", [](std::shared_ptr<Embag::RosMessage> &m) {
-        return py::bytes(&m->raw_buffer->at(m->raw_buffer_offset), m->raw_data_len);
+        if (m->raw_buffer_offset + m->raw_data_len > m->raw_buffer->size()) {
+          throw std::out_of_range("The message is outside of its buffer");
+        }
+
+        return memoryviewOf(BufferView{m->raw_buffer, m->raw_buffer_offset, m->raw_data_len, Embag::RosValue::Type::uint8});
       })
       .def(
         "dict",
@@ -100,11 +387,24 @@ PYBIND11_MODULE(libembag, m) {
             const RosValueTypeSet &array_blob_types,
             bool blob_types_as_memoryview,
             py::object ros_time_py_type) {
-          if (m->data()->getType() != Embag::RosValue::Type::object) {
-            throw std::runtime_error("Element is not an object");
-          }
-
-          return rosValueToDict(m->data(), array_blob_types, blob_types_as_memoryview, ros_time_py_type);
+          // Built straight from the raw message with a plan compiled once per type, rather than by parsing it first
+          const auto options = dictPlanOptions(array_blob_types, blob_types_as_memoryview, ros_time_py_type);
+          return DictPlan::forProgram(m->program())->convert(*m, options);
+        },
+        py::arg("array_blob_types") = default_array_blob_types,
+        py::arg("blob_types_as_memoryview") = false,
+        py::arg("ros_time_py_type") = py::none())
+      .def(
+        "record",
+        [](
+            std::shared_ptr<Embag::RosMessage> &m,
+            const RosValueTypeSet &array_blob_types,
+            bool blob_types_as_memoryview,
+            py::object ros_time_py_type) {
+          // An instance of a class generated once per type, with the fields as attributes like a rospy message
+          auto options = dictPlanOptions(array_blob_types, blob_types_as_memoryview, ros_time_py_type);
+          options.records = true;
+          return DictPlan::forProgram(m->program())->convert(*m, options);
         },
         py::arg("array_blob_types") = default_array_blob_types,
         py::arg("blob_types_as_memoryview") = false,
@@ -114,6 +414,49 @@ PYBIND11_MODULE(libembag, m) {
       .def_readonly("md5", &Embag::RosMessage::md5)
       .def_readonly("raw_data_len", &Embag::RosMessage::raw_data_len);
 
+  // Everything but the special methods below is looked up on the parsed message through __getattr__
+  py::class_<LazyMessage>(m, "LazyMessage")
+      .def_property_readonly("_type", [](LazyMessage &l) {
+        return l.message()->getTypeName();
+      })
+      .def_property_readonly("_md5sum", [](LazyMessage &l) {
+        return l.message()->md5;
+      })
+      .def("__getattr__", [](LazyMessage &l, const std::string &name) -> py::object {
+        // Message fields never start with an underscore, so there's no need to parse the message to look these up
+        if (name.empty() || name[0] == '_') {
+          throw py::attribute_error("LazyMessage has no attribute " + name);
+        }
+
+        return l.data().attr(name.c_str());
+      })
+      .def("__getitem__", [](LazyMessage &l, py::object key) -> py::object {
+        return l.data()[key];
+      })
+      .def("__iter__", [](LazyMessage &l) {
+        return l.data().attr("__iter__")();
+      })
+      .def("__len__", [](LazyMessage &l) {
+        return py::len(l.data());
+      })
+      .def("__str__", [](LazyMessage &l) {
+        return py::str(l.data());
+      });
+
+  py::class_<BufferView>(m, "BufferView", py::buffer_protocol())
+      .def_buffer([](BufferView &v) {
+        const size_t size_of_elements = Embag::RosValue::primitiveTypeToSize(v.element_type);
+        return pybind11::buffer_info(
+          (void *) (v.buffer->data() + v.offset),
+          size_of_elements,
+          Embag::RosValue::primitiveTypeToFormat(v.element_type),
+          1,
+          { v.length },
+          { size_of_elements },
+          true
+        );
+      });
+
   auto ros_value = py::class_<Embag::RosValue::Pointer>(m, "RosValue", py::dynamic_attr(), py::buffer_protocol())
       .def_buffer([](Embag::RosValue::Pointer &v) {
         if (v->getElementType() == Embag::RosValue::Type::string) {
@@ -214,6 +557,45 @@ PYBIND11_MODULE(libembag, m) {
         return getIndex(v, index);
       });
 
+  m.def(
+    "decode_point_cloud",
+    [](Embag::RosValue::Pointer &cloud_data, py::object fields, bool skip_nans, py::object dtype) {
+      Embag::PointCloud::options_t options;
+      if (!fields.is_none()) {
+        options.fields = fields.cast<std::vector<std::string>>();
+      }
+      options.skip_nans = skip_nans;
+      if (!dtype.is_none()) {
+        options.type = numericType(dtype);
+      }
+
+      // The arrays share ownership of the decoded cloud rather than copying it
+      const auto cloud = std::make_shared<Embag::PointCloud>(Embag::PointCloud::decode(cloud_data, options));
+      py::dict arrays;
+      for (const auto &field : cloud->fields()) {
+        const py::capsule owner(new std::shared_ptr<Embag::PointCloud>(cloud), [](void *p) {
+          delete static_cast<std::shared_ptr<Embag::PointCloud> *>(p);
+        });
+
+        std::vector<size_t> shape{cloud->size()};
+        if (field.count != 1) {
+          shape.push_back(field.count);
+        }
+
+        arrays[py::str(field.name)] = py::array(
+          py::dtype(Embag::RosValue::primitiveTypeToFormat(field.type)),
+          shape,
+          field.bytes.data(),
+          owner);
+      }
+
+      return arrays;
+    },
+    py::arg("cloud"),
+    py::arg("fields") = py::none(),
+    py::arg("skip_nans") = false,
+    py::arg("dtype") = py::none());
+
   py::class_<Embag::RosValue::ros_time_t>(m, "RosTime")
       .def(py::init())
       .def(py::init<uint32_t, uint32_t>())
@@ -3,29 +3,82 @@
 #include <pybind11/pybind11.h>
 
 #include "lib/view.h"
+#include "dict_plan.h"
 #include "utils.h"
 
 namespace py = pybind11;
 
+// A message yielded by read_messages.  It is only parsed once one of its fields is accessed, so loops that skip messages
+// based on their topic or timestamp don't pay for parsing them.  Otherwise, it behaves like the message's RosValue.
+class LazyMessage {
+ public:
+  explicit LazyMessage(const std::shared_ptr<Embag::RosMessage> &message) : message_(message) {}
+
+  const std::shared_ptr<Embag::RosMessage>& message() const {
+    return message_;
+  }
+
+  // The RosValue of the message, parsed on first use
+  const py::object& data() {
+    if (!data_) {
+      const auto &message = message_;
+      data_ = py::cast(withoutGil([&]() { return message->data(); }));
+    }
+
+    return data_;
+  }
+
+ private:
+  std::shared_ptr<Embag::RosMessage> message_;
+  py::object data_;
+};
+
+// Yields rosbag style (topic, message, timestamp) tuples, advancing with the GIL released like MessageIterator.
+// With raw set, the message is rosbag's raw tuple (datatype, data, md5sum, position, pytype) instead, where data is a
+// memoryview of the serialized message and pytype is None.  With records set, it's a record built by DictPlan, with
+// uint8 arrays as bytes like rospy.
 struct IteratorCompat {
-  explicit IteratorCompat(const Embag::View::iterator& i) : iterator_(i) {}
+  IteratorCompat(MessageIterator messages, bool raw, bool records)
+    : messages_(std::move(messages)), raw_(raw), records_(records) {}
+
+  py::tuple next() {
+    const auto msg = messages_.next();
+    if (!msg) {
+      throw py::stop_iteration();
+    }
+
+    if (raw_) {
+      return py::make_tuple(
+        msg->topic,
+        py::make_tuple(
+          msg->getTypeName(),
+          memoryviewOf(BufferView{msg->raw_buffer, msg->raw_buffer_offset, msg->raw_data_len, Embag::RosValue::Type::uint8}),
+          msg->md5,
+          py::make_tuple(msg->chunk_position, msg->chunk_offset),
+          py::none()),
+        msg->timestamp
+      );
+    }
+
+    if (records_) {
+      DictPlan::options_t options;
+      options.blob_types = 1u << static_cast<uint32_t>(Embag::RosValue::Type::uint8);
+      options.records = true;
+      return py::make_tuple(
+        msg->topic,
+        DictPlan::forProgram(msg->program())->convert(*msg, options),
+        msg->timestamp
+      );
+    }
 
-  py::tuple operator*() const {
-    const auto msg = *iterator_;
     return py::make_tuple(
       msg->topic,
-      msg->data(),
+      LazyMessage{msg},
       msg->timestamp
     );
   }
 
-  bool operator==(const IteratorCompat &other) const {
-    return iterator_ == other.iterator_;
-  }
-
-  Embag::View::iterator& operator++() {
-    return ++iterator_;
-  }
-
-  Embag::View::iterator iterator_;
+  MessageIterator messages_;
+  bool raw_;
+  bool records_;
 };
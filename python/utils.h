@@ -1,9 +1,73 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+
 #include <pybind11/pybind11.h>
 #include <Python.h>
 
+#include "lib/view.h"
+
 
 pybind11::str encodeStrLatin1(const std::string& str) {
   return pybind11::reinterpret_steal<pybind11::str>(PyUnicode_DecodeLatin1(str.data(), str.length(), nullptr));
 }
+
+// Whether the only argument of Bag is a path rather than the bag itself.  Python 2 strs are bytes, so they are paths
+// too, and bags in them need their length.
+bool isBagPath(const pybind11::object &object) {
+#if PY_MAJOR_VERSION < 3
+  if (PyString_Check(object.ptr())) {
+    return true;
+  }
+#endif
+  return PyUnicode_Check(object.ptr());
+}
+
+// The bytes of an object that supports the buffer protocol, such as bytes, bytearray, mmap or a contiguous numpy array,
+// without copying them.  The object stays alive, and its buffer exported, until the last copy of the pointer is gone,
+// which may happen on any thread.
+std::shared_ptr<const char> sharedBuffer(const pybind11::object &object, size_t &length) {
+  Py_buffer *view = new Py_buffer();
+  if (PyObject_GetBuffer(object.ptr(), view, PyBUF_SIMPLE) != 0) {
+    delete view;
+    throw pybind11::error_already_set();
+  }
+
+  length = static_cast<size_t>(view->len);
+  return std::shared_ptr<const char>(static_cast<const char *>(view->buf), [view](const char *) {
+    // Once the interpreter is gone, so is the object
+    if (!Py_IsInitialized()) {
+      return;
+    }
+
+    pybind11::gil_scoped_acquire acquire;
+    PyBuffer_Release(view);
+    delete view;
+  });
+}
+
+// Calls function with the GIL released, so other Python threads can run while it decompresses or parses.  function
+// must not touch any Python object.
+template<typename Function>
+auto withoutGil(const Function &function) -> decltype(function()) {
+  pybind11::gil_scoped_release release;
+  return function();
+}
+
+// Walks the messages of a view for Python iterators, advancing with the GIL released, as advancing is where chunks are
+// decompressed and scanned.  Several Python threads may share an iterator, and View::shared_iterator gives each message
+// to exactly one of them.  Its lock is only ever taken without the GIL, as advancing may run a Python predicate that
+// takes the GIL.
+class MessageIterator {
+ public:
+  MessageIterator(const Embag::View::iterator &begin, const Embag::View::iterator &end) : messages_(begin, end) {}
+
+  // Returns the next message, or nullptr once there are none left.  Must be called with the GIL held.
+  std::shared_ptr<Embag::RosMessage> next() {
+    return withoutGil([this]() { return messages_.next(); });
+  }
+
+ private:
+  Embag::View::shared_iterator messages_;
+};
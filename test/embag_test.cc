@@ -1,8 +1,13 @@
 #include "gtest/gtest.h"
 #include "lib/embag.h"
+#include "lib/field_path.h"
+#include "lib/point_cloud.h"
 #include "lib/view.h"
 
+#include <cmath>
+#include <cstring>
 #include <set>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 #include <fstream>
@@ -19,6 +24,27 @@ TEST(EmbagTest, OpenCloseOddPaddingBag) {
   oddly_padded_bag.close();
 }
 
+TEST(EmbagTest, BagFromMemory) {
+  std::ifstream file{"test/test.bag", std::ios::binary};
+  const std::vector<char> contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+  // The bag reads the memory in place and releases it through the deleter once it's done with it
+  bool released = false;
+  std::shared_ptr<const char> bytes{contents.data(), [&](const char *) { released = true; }};
+  {
+    const auto bag = std::make_shared<Embag::Bag>(std::move(bytes), contents.size());
+    Embag::View view{bag};
+    size_t count = 0;
+    for (const auto &message : view.getMessages("/base_scan")) {
+      ASSERT_EQ(message->data()["header"]["frame_id"]->as<std::string>(), "base_laser_link");
+      ++count;
+    }
+    ASSERT_GT(count, 0);
+    ASSERT_FALSE(released);
+  }
+  ASSERT_TRUE(released);
+}
+
 class BagTest : public ::testing::Test {
  protected:
   Embag::Bag bag_{"test/test.bag"};
@@ -94,6 +120,41 @@ TEST_F(BagTest, MsgDefForTopic) {
   ASSERT_EQ(array_field.arraySize(), -1);  // -1 is an array of undefined length
 }
 
+TEST_F(BagTest, ParseProgram) {
+  using Opcode = Embag::ParseProgram::Opcode;
+  const auto variable_size = Embag::ParseProgram::variable_size;
+
+  const auto &scan_program = bag_.msgDefForTopic("/base_scan")->program();
+  ASSERT_EQ(scan_program.type_name, "sensor_msgs/LaserScan");
+  ASSERT_EQ(scan_program.fields[0].program->type_name, "std_msgs/Header");
+  ASSERT_EQ(scan_program.fields.size(), 10);
+  ASSERT_EQ(scan_program.size, variable_size);
+  ASSERT_EQ(scan_program.fields[0].opcode, Opcode::object);
+  ASSERT_EQ(scan_program.fields[0].program->size, variable_size);
+  ASSERT_EQ(scan_program.fields[1].opcode, Opcode::primitive);
+  ASSERT_EQ(scan_program.fields[1].size, sizeof(float));
+  ASSERT_EQ(scan_program.fields[8].opcode, Opcode::primitive_array);
+  ASSERT_EQ(scan_program.fields[8].array_size, -1);
+  ASSERT_EQ(scan_program.fields[8].size, variable_size);
+
+  // The seven float32 fields between the header and the arrays are skipped in one step
+  ASSERT_EQ(scan_program.skip_instructions.size(), 4);
+  ASSERT_EQ(scan_program.skip_instructions[1].opcode, Opcode::fixed);
+  ASSERT_EQ(scan_program.skip_instructions[1].size, 7 * sizeof(float));
+
+  // Odometry ends with a pose and a twist, each with a 6x6 covariance, which have a fixed size
+  const auto &odometry_program = bag_.msgDefForTopic("/base_pose_ground_truth")->program();
+  ASSERT_EQ(odometry_program.fields.size(), 4);
+  ASSERT_EQ(odometry_program.fields[2].program->size, (7 + 36) * sizeof(double));
+  ASSERT_EQ(odometry_program.fields[3].program->size, (6 + 36) * sizeof(double));
+  ASSERT_EQ(odometry_program.skip_instructions.size(), 3);
+  ASSERT_EQ(odometry_program.skip_instructions[2].size, (7 + 36 + 6 + 36) * sizeof(double));
+
+  const auto &pointcloud_program = bag_.msgDefForTopic("/luminar_pointcloud")->program();
+  ASSERT_EQ(pointcloud_program.fields[3].opcode, Opcode::object_array);
+  ASSERT_EQ(pointcloud_program.fields[3].program->size, variable_size);
+}
+
 TEST_F(BagTest, ConnectionsForTopic) {
   const auto connection_records = bag_.connectionsForTopic("/base_scan");
   ASSERT_EQ(connection_records.size(), 1);
@@ -163,8 +224,12 @@ TEST_F(ViewTest, AllMessages) {
     ASSERT_NE(message->topic, "");
     ASSERT_TRUE(message->raw_buffer);
     ASSERT_GT(message->raw_data_len, 0);
+    ASSERT_GT(message->chunk_position, 0);
 
     if (unseen_topics.count(message->topic)) {
+      // The first message of each topic is at the chunk and offset the bag's index has for it
+      ASSERT_EQ(message->chunk_position, 3823880);
+      ASSERT_EQ(message->chunk_offset, message->topic == "/base_scan" ? 2340 : 6331);
       unseen_topics.erase(message->topic);
     }
 
@@ -206,6 +271,12 @@ TEST_F(ViewTest, AllMessages) {
   }
 
   ASSERT_EQ(unseen_topics.size(), 0);
+
+  // Reading backwards, the offsets come from the index rather than from scanning the chunk
+  Embag::View reverse_view{"test/test.bag"};
+  const auto last_scan = *reverse_view.getMessages("/base_scan").rbegin();
+  ASSERT_EQ(last_scan->chunk_position, 3823880);
+  ASSERT_EQ(last_scan->chunk_offset, 11830);
 }
 
 TEST_F(ViewTest, MessagesForTopic) {
@@ -227,6 +298,1095 @@ TEST_F(ViewTest, MessagesForTopic) {
   }
 }
 
+TEST_F(ViewTest, ReverseMessages) {
+  std::vector<std::pair<std::string, Embag::RosValue::ros_time_t>> forward;
+  for (const auto &message : view_.getMessages()) {
+    forward.emplace_back(message->topic, message->timestamp);
+  }
+
+  std::vector<std::pair<std::string, Embag::RosValue::ros_time_t>> reverse;
+  for (auto it = view_.rbegin(); it != view_.rend(); ++it) {
+    const auto message = *it;
+    reverse.emplace_back(message->topic, message->timestamp);
+  }
+
+  ASSERT_GT(forward.size(), 0);
+  ASSERT_EQ(forward.size(), reverse.size());
+  ASSERT_TRUE(std::equal(forward.begin(), forward.end(), reverse.rbegin(), [](
+      const std::pair<std::string, Embag::RosValue::ros_time_t> &a,
+      const std::pair<std::string, Embag::RosValue::ros_time_t> &b) {
+    return a.first == b.first && a.second == b.second;
+  }));
+
+  // Reading backwards from a seek point yields everything up to and including it
+  const std::vector<std::string> topics{"/base_scan", "/base_pose_ground_truth"};
+  std::vector<Embag::RosValue::ros_time_t> forward_times;
+  for (const auto &message : view_.getMessages(topics)) {
+    forward_times.emplace_back(message->timestamp);
+  }
+
+  const auto seek_time = forward_times[forward_times.size() / 2];
+  view_.getMessages(topics, Embag::RosValue::ros_time_t{0, 0}, seek_time);
+  auto expected = forward_times.rbegin() + (forward_times.size() - forward_times.size() / 2 - 1);
+  size_t count = 0;
+  for (auto it = view_.rbegin(); it != view_.rend(); ++it) {
+    ASSERT_LE((*it)->timestamp, seek_time);
+    ASSERT_EQ((*it)->timestamp, *expected++);
+    ++count;
+  }
+  ASSERT_EQ(count, forward_times.size() / 2 + 1);
+}
+
+TEST_F(ViewTest, Shards) {
+  const std::vector<std::string> topics{"/base_scan", "/luminar_pointcloud"};
+
+  std::multiset<std::pair<std::string, uint32_t>> expected;
+  for (const auto &message : view_.getMessages(topics)) {
+    expected.emplace(message->topic, message->data()["header"]["seq"]->as<uint32_t>());
+  }
+  ASSERT_GT(expected.size(), 0);
+
+  for (const auto balance : {Embag::View::shard_t::balance_t::uncompressed_bytes, Embag::View::shard_t::balance_t::message_count}) {
+    const size_t shard_count = 3;
+    std::multiset<std::pair<std::string, uint32_t>> seen;
+
+    for (size_t i = 0; i < shard_count; ++i) {
+      const auto descriptor = view_.shard(i, shard_count, balance).toString();
+      const auto shard = Embag::View::shard_t::fromString(descriptor);
+      ASSERT_EQ(shard.toString(), descriptor);
+      ASSERT_EQ(shard.index, i);
+      ASSERT_EQ(shard.count, shard_count);
+
+      // Each worker opens its own view of the bag
+      Embag::View worker_view{"test/test.bag"};
+      for (const auto &message : worker_view.getMessages(shard)) {
+        seen.emplace(message->topic, message->data()["header"]["seq"]->as<uint32_t>());
+      }
+    }
+
+    ASSERT_EQ(seen, expected);
+  }
+
+  ASSERT_THROW(Embag::View::shard_t::fromString("not a shard"), std::runtime_error);
+  ASSERT_THROW(view_.shard(3, 3), std::runtime_error);
+
+  // Filters can't be carried by shard descriptors
+  Embag::View::sampling_t sampling;
+  sampling.stride = 2;
+  ASSERT_THROW(view_.getMessages("/base_scan").sample("/base_scan", sampling).shard(0, 2), std::runtime_error);
+  const auto predicate = [](const Embag::RosBagTypes::connection_data_t &, const Embag::RosValue::ros_time_t &) {
+    return true;
+  };
+  ASSERT_THROW(view_.getMessages({"/base_scan"}, predicate).shard(0, 2), std::runtime_error);
+  ASSERT_NO_THROW(view_.getMessages("/base_scan").shard(0, 2));
+}
+
+TEST_F(ViewTest, Sampling) {
+  std::vector<uint32_t> all_scans;
+  std::vector<Embag::RosValue::ros_time_t> scan_times;
+  for (const auto &message : view_.getMessages("/base_scan")) {
+    all_scans.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+    scan_times.push_back(message->timestamp);
+  }
+  ASSERT_GT(all_scans.size(), 2);
+
+  // Every other scan, while the other selected topic is left untouched
+  Embag::View::sampling_t every_other;
+  every_other.stride = 2;
+  std::vector<uint32_t> sampled_scans;
+  size_t pose_count = 0;
+  for (const auto &message : view_.getMessages({"/base_scan", "/base_pose_ground_truth"}).sample("/base_scan", every_other)) {
+    if (message->topic == "/base_scan") {
+      sampled_scans.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+    } else {
+      ++pose_count;
+    }
+  }
+
+  ASSERT_EQ(sampled_scans.size(), (all_scans.size() + 1) / 2);
+  for (size_t i = 0; i < sampled_scans.size(); ++i) {
+    ASSERT_EQ(sampled_scans[i], all_scans[i * 2]);
+  }
+  ASSERT_GT(pose_count, 0);
+
+  // Reverse iteration honors the same samples
+  std::vector<uint32_t> reverse_scans;
+  for (auto it = view_.rbegin(); it != view_.rend(); ++it) {
+    if ((*it)->topic == "/base_scan") {
+      reverse_scans.push_back((*it)->data()["header"]["seq"]->as<uint32_t>());
+    }
+  }
+  ASSERT_TRUE(std::equal(sampled_scans.rbegin(), sampled_scans.rend(), reverse_scans.begin()));
+
+  // A period longer than the bag keeps only the first message
+  Embag::View::sampling_t once;
+  once.period = Embag::RosValue::ros_duration_t{3600, 0};
+  size_t count = 0;
+  for (const auto &message : view_.getMessages("/base_scan").sample("/base_scan", once)) {
+    ASSERT_EQ(message->data()["header"]["seq"]->as<uint32_t>(), all_scans.front());
+    ++count;
+  }
+  ASSERT_EQ(count, 1);
+
+  // Bucketed sampling keeps the first message of each one second bucket
+  Embag::View::sampling_t per_second;
+  per_second.period = Embag::RosValue::ros_duration_t{1, 0};
+  per_second.bucketed = true;
+  std::vector<uint32_t> expected_secs;
+  for (const auto &time : scan_times) {
+    if (expected_secs.empty() || expected_secs.back() != time.secs) {
+      expected_secs.push_back(time.secs);
+    }
+  }
+  std::vector<uint32_t> bucketed_secs;
+  for (const auto &message : view_.getMessages("/base_scan").sample("/base_scan", per_second)) {
+    bucketed_secs.push_back(message->timestamp.secs);
+  }
+  ASSERT_EQ(bucketed_secs, expected_secs);
+
+  ASSERT_THROW(view_.getMessages("/base_scan").sample("/luminar_pointcloud", once), std::runtime_error);
+}
+
+TEST_F(ViewTest, Predicate) {
+  const std::vector<std::string> all_topics(known_topics_.begin(), known_topics_.end());
+
+  size_t expected_count = 0;
+  std::vector<Embag::RosValue::ros_time_t> times;
+  for (const auto &message : view_.getMessages({"/base_scan", "/base_pose_ground_truth"})) {
+    times.push_back(message->timestamp);
+    ++expected_count;
+  }
+
+  // Exclude a single publisher
+  size_t count = 0;
+  const auto not_pointcloud_publisher = [](const Embag::RosBagTypes::connection_data_t &connection, const Embag::RosValue::ros_time_t &) {
+    return connection.callerid != "/play_1604515189845695821";
+  };
+  for (const auto &message : view_.getMessages(all_topics, not_pointcloud_publisher)) {
+    ASSERT_NE(message->topic, "/luminar_pointcloud");
+    ++count;
+  }
+  ASSERT_EQ(count, expected_count);
+
+  // A list of time windows
+  const std::vector<std::pair<Embag::RosValue::ros_time_t, Embag::RosValue::ros_time_t>> windows = {
+      {times[1], times[2]},
+      {times[times.size() - 2], times.back()},
+  };
+  const auto in_windows = [&windows](const Embag::RosBagTypes::connection_data_t &, const Embag::RosValue::ros_time_t &time) {
+    for (const auto &window : windows) {
+      if (window.first <= time && time <= window.second) {
+        return true;
+      }
+    }
+    return false;
+  };
+  count = 0;
+  for (const auto &message : view_.getMessages({"/base_scan", "/base_pose_ground_truth"}, in_windows)) {
+    ASSERT_TRUE(in_windows(Embag::RosBagTypes::connection_data_t{}, message->timestamp));
+    ++count;
+  }
+  ASSERT_EQ(count, 4);
+
+  // Reverse iteration filters on the index entries
+  count = 0;
+  for (auto it = view_.rbegin(); it != view_.rend(); ++it) {
+    ++count;
+  }
+  ASSERT_EQ(count, 4);
+
+  // Nothing matches, so nothing is read
+  size_t calls = 0;
+  const auto nothing = [&calls](const Embag::RosBagTypes::connection_data_t &, const Embag::RosValue::ros_time_t &) {
+    ++calls;
+    return false;
+  };
+  auto empty_view = view_.getMessages(all_topics, nothing);
+  const size_t index_calls = calls;
+  ASSERT_GT(index_calls, 0);
+  ASSERT_TRUE(empty_view.begin() == empty_view.end());
+  ASSERT_EQ(calls, index_calls);
+}
+
+TEST_F(ViewTest, Plan) {
+  std::vector<uint32_t> scans;
+  for (const auto &message : view_.getMessages({"/base_scan"})) {
+    scans.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+  }
+
+  const auto plan = view_.plan();
+  ASSERT_EQ(plan.bags.size(), 1);
+  ASSERT_EQ(plan.message_counts.size(), 1);
+  ASSERT_EQ(plan.message_counts.at("/base_scan"), scans.size());
+  ASSERT_FALSE(plan.chunks.empty());
+  ASSERT_GT(plan.compressed_bytes, 0);
+  ASSERT_GE(plan.uncompressed_bytes, plan.wanted_bytes);
+  ASSERT_GE(plan.readAmplification(), 1.0);
+
+  uint64_t planned_messages = 0;
+  for (size_t i = 0; i < plan.chunks.size(); ++i) {
+    ASSERT_GT(plan.chunks[i].wanted_messages, 0);
+    planned_messages += plan.chunks[i].wanted_messages;
+    if (i > 0) {
+      ASSERT_LT(plan.chunks[i - 1].chunk->offset, plan.chunks[i].chunk->offset);
+    }
+  }
+  ASSERT_EQ(planned_messages, scans.size());
+
+  const auto explanation = plan.explain();
+  ASSERT_NE(explanation.find("/base_scan: " + std::to_string(scans.size())), std::string::npos);
+  ASSERT_NE(explanation.find("read amplification"), std::string::npos);
+
+  // Plans are executed by the iterator
+  std::vector<uint32_t> planned_scans;
+  for (auto it = view_.begin(plan); it != view_.end(); ++it) {
+    planned_scans.push_back((*it)->data()["header"]["seq"]->as<uint32_t>());
+  }
+  ASSERT_EQ(planned_scans, scans);
+
+  const auto reverse_plan = view_.plan(true);
+  ASSERT_TRUE(reverse_plan.reverse);
+  std::vector<uint32_t> reverse_scans;
+  for (auto it = view_.begin(reverse_plan); it != view_.end(); ++it) {
+    reverse_scans.push_back((*it)->data()["header"]["seq"]->as<uint32_t>());
+  }
+  ASSERT_TRUE(std::equal(scans.rbegin(), scans.rend(), reverse_scans.begin()));
+}
+
+TEST_F(ViewTest, LazyData) {
+  size_t message_count = 0;
+  for (const auto &message : view_.getMessages()) {
+    const auto lazy = message->lazyData();
+    ASSERT_EQ(lazy.getType(), Embag::RosValue::Type::object);
+
+    // Fields at the end of the message are read before those at its start to exercise the offset cache
+    if (message->topic == "/luminar_pointcloud") {
+      ASSERT_EQ(lazy["is_dense"].as<bool>(), message->data()["is_dense"]->as<bool>());
+      ASSERT_EQ(lazy["data"].getType(), Embag::RosValue::Type::primitive_array);
+      ASSERT_EQ(lazy["data"].size(), message->data()["data"]->size());
+      ASSERT_EQ(lazy["fields"].getType(), Embag::RosValue::Type::array);
+      ASSERT_EQ(lazy["fields"].getElementType(), Embag::RosValue::Type::object);
+      ASSERT_EQ(lazy["fields"].size(), message->data()["fields"]->size());
+      for (size_t i = 0; i < lazy["fields"].size(); ++i) {
+        ASSERT_EQ(lazy["fields"][i]["name"].as<std::string>(), message->data()["fields"][i]["name"]->as<std::string>());
+        ASSERT_EQ(lazy["fields"][i]["offset"].as<uint32_t>(), message->data()["fields"][i]["offset"]->as<uint32_t>());
+      }
+    } else if (message->topic == "/base_scan") {
+      ASSERT_EQ(lazy["range_max"].as<float>(), message->data()["range_max"]->as<float>());
+      ASSERT_EQ(lazy["ranges"].getElementType(), Embag::RosValue::Type::float32);
+      ASSERT_EQ(lazy["ranges"].size(), message->data()["ranges"]->size());
+      ASSERT_EQ(lazy["ranges"][3].as<float>(), message->data()["ranges"][3]->as<float>());
+      ASSERT_EQ(lazy["intensities"].size(), message->data()["intensities"]->size());
+    } else {
+      ASSERT_EQ(lazy["twist"]["covariance"][35].as<double>(), message->data()["twist"]["covariance"][35]->as<double>());
+      ASSERT_EQ(lazy["pose"]["pose"]["position"]["x"].as<double>(), message->data()["pose"]["pose"]["position"]["x"]->as<double>());
+      ASSERT_EQ(lazy["child_frame_id"].as<std::string>(), message->data()["child_frame_id"]->as<std::string>());
+    }
+
+    ASSERT_EQ(lazy["header"]["seq"].as<uint32_t>(), message->data()["header"]["seq"]->as<uint32_t>());
+    ASSERT_EQ(lazy["header"]["stamp"].as<Embag::RosValue::ros_time_t>(), message->data()["header"]["stamp"]->as<Embag::RosValue::ros_time_t>());
+    ASSERT_EQ(lazy["header"]["frame_id"].as<std::string>(), message->data()["header"]["frame_id"]->as<std::string>());
+    ASSERT_TRUE(lazy.has("header"));
+    ASSERT_FALSE(lazy.has("not_a_field"));
+    ASSERT_THROW(lazy["header"]["seq"]["not_an_object"], std::runtime_error);
+
+    message_count++;
+  }
+
+  ASSERT_GT(message_count, 0);
+}
+
+TEST_F(ViewTest, LazyDataCorruptLength) {
+  Embag::Bag bag{"test/test.bag"};
+  const auto message = *view_.getMessages("/luminar_pointcloud").begin();
+  const std::string frame_id = message->data()["header"]["frame_id"]->as<std::string>();
+
+  // A copy of the message whose fields array claims far more elements than the message could hold
+  const auto buffer = std::make_shared<std::vector<char>>(
+    message->raw_buffer->begin() + message->raw_buffer_offset,
+    message->raw_buffer->begin() + message->raw_buffer_offset + message->raw_data_len);
+  const size_t fields_length_offset = 4 + 8 + 4 + frame_id.size() + 4 + 4;
+  const uint32_t corrupt_length = 0xFFFFFFFF;
+  std::memcpy(buffer->data() + fields_length_offset, &corrupt_length, sizeof(corrupt_length));
+
+  Embag::RosMessage corrupt{
+    message->topic,
+    message->timestamp,
+    message->md5,
+    buffer,
+    0,
+    message->raw_data_len,
+    bag.msgDefForTopic("/luminar_pointcloud"),
+  };
+  const auto lazy = corrupt.lazyData();
+  ASSERT_EQ(lazy["height"].as<uint32_t>(), message->data()["height"]->as<uint32_t>());
+  ASSERT_THROW(lazy["fields"], std::runtime_error);
+  ASSERT_THROW(lazy["is_dense"], std::runtime_error);
+}
+
+TEST_F(ViewTest, ConstantFields) {
+  Embag::Bag bag{"test/test.bag"};
+  const auto &program = bag.msgDefForTopic("/base_pose_ground_truth")->program();
+
+  const auto seq = program.constantField("header.seq");
+  ASSERT_EQ(seq.offset, 0);
+  ASSERT_EQ(seq.type, Embag::RosValue::Type::uint32);
+  const auto stamp = program.constantField("header.stamp");
+  ASSERT_EQ(stamp.offset, sizeof(uint32_t));
+  ASSERT_EQ(stamp.type, Embag::RosValue::Type::ros_time);
+
+  // The pose follows the variable length frame ids
+  ASSERT_THROW(program.constantField("header.frame_id"), std::runtime_error);
+  ASSERT_THROW(program.constantField("pose.pose.position.x"), std::runtime_error);
+  ASSERT_THROW(program.constantField("header"), std::runtime_error);
+  ASSERT_THROW(program.constantField("header.not_a_field"), std::runtime_error);
+  ASSERT_THROW(program.constantField("header.seq[0]"), std::runtime_error);
+
+  // Header fields are at the same offsets in every message that starts with a header
+  for (const auto &message : view_.getMessages()) {
+    ASSERT_EQ(message->getConstant<uint32_t>(seq), message->data()["header"]["seq"]->as<uint32_t>());
+    ASSERT_EQ(
+      message->getConstant<Embag::RosValue::ros_time_t>("header.stamp"),
+      message->data()["header"]["stamp"]->as<Embag::RosValue::ros_time_t>());
+    ASSERT_THROW(message->getConstant<uint64_t>(seq), std::runtime_error);
+  }
+}
+
+size_t countChildValues(const Embag::RosValue::Pointer &value) {
+  if (value->getType() != Embag::RosValue::Type::object && value->getType() != Embag::RosValue::Type::array) {
+    return 0;
+  }
+
+  size_t count = 0;
+  for (const auto &child : value->getValues()) {
+    count += 1 + countChildValues(child);
+  }
+  return count;
+}
+
+TEST_F(ViewTest, ValueCounts) {
+  Embag::Bag bag{"test/test.bag"};
+
+  for (const auto &message : view_.getMessages()) {
+    const auto &program = bag.msgDefForTopic(message->topic)->program();
+
+    size_t offset = message->raw_buffer_offset;
+    const size_t count = program.countValues(message->raw_buffer->data(), message->raw_buffer->size(), offset);
+    ASSERT_EQ(count, countChildValues(message->data()));
+    ASSERT_EQ(offset, message->raw_buffer_offset + message->raw_data_len);
+
+    // Only the point cloud has a variable length array of objects
+    if (message->topic == "/luminar_pointcloud") {
+      ASSERT_EQ(program.value_count, Embag::ParseProgram::variable_size);
+    } else {
+      ASSERT_EQ(program.value_count, count);
+    }
+  }
+}
+
+TEST(RosValueTest, ValuesOutliveTheirMessage) {
+  Embag::RosValue::Pointer ranges;
+  Embag::RosValue::Pointer frame_id;
+  float first_range;
+  {
+    Embag::View view{"test/test.bag"};
+    for (const auto &message : view.getMessages("/base_scan")) {
+      ranges = message->data()["ranges"];
+      frame_id = message->data()["header"]["frame_id"];
+      first_range = ranges[0]->as<float>();
+      break;
+    }
+  }
+
+  // Each value shares ownership of its message's buffer and schema
+  ASSERT_EQ(ranges->getType(), Embag::RosValue::Type::primitive_array);
+  ASSERT_EQ(ranges[0]->as<float>(), first_range);
+  ASSERT_THROW(ranges[ranges->size()], std::out_of_range);
+  ASSERT_FALSE(frame_id->as<std::string>().empty());
+}
+
+TEST_F(ViewTest, BorrowedValues) {
+  for (const auto &message : view_.getMessages({"/base_pose_ground_truth", "/base_scan"})) {
+    const auto &data = message->data();
+    const auto ref = data.borrow();
+
+    ASSERT_EQ(ref["header"]["seq"]->as<uint32_t>(), data["header"]["seq"]->as<uint32_t>());
+    ASSERT_EQ(ref("header")("frame_id")->as<std::string>(), data["header"]["frame_id"]->as<std::string>());
+    ASSERT_EQ(ref->size(), data->size());
+    ASSERT_THROW(ref["not_a_field"], std::out_of_range);
+    ASSERT_THROW(ref["header"]["seq"][0], std::runtime_error);
+
+    if (message->topic == "/base_scan") {
+      ASSERT_EQ(ref["ranges"]->getType(), Embag::RosValue::Type::primitive_array);
+      ASSERT_EQ(ref["ranges"][3]->as<float>(), data["ranges"][3]->as<float>());
+      ASSERT_THROW(ref["ranges"][ref["ranges"]->size()], std::out_of_range);
+    } else {
+      ASSERT_EQ(
+        ref["pose"]["pose"]["position"]["x"]->as<double>(),
+        data["pose"]["pose"]["position"]["x"]->as<double>());
+      ASSERT_EQ(ref["twist"]["covariance"][35]->as<double>(), data["twist"]["covariance"][35]->as<double>());
+    }
+  }
+}
+
+TEST_F(ViewTest, FieldSymbols) {
+  const Embag::Symbol header{"header"};
+  const Embag::Symbol seq{"seq"};
+  const Embag::Symbol ranges{"ranges"};
+  const Embag::Symbol missing{"not_a_field"};
+  ASSERT_EQ(Embag::Symbol{"header"}, header);
+  ASSERT_NE(seq, header);
+  ASSERT_EQ(header.name(), "header");
+
+  Embag::Bag bag{"test/test.bag"};
+  for (const auto &message : view_.getMessages({"/base_pose_ground_truth", "/base_scan"})) {
+    const auto &data = message->data();
+    const auto ref = data.borrow();
+    const auto lazy = message->lazyData();
+
+    // One symbol serves every message type with a field of that name
+    ASSERT_EQ(data[header][seq]->as<uint32_t>(), data["header"]["seq"]->as<uint32_t>());
+    ASSERT_EQ(ref[header][seq]->as<uint32_t>(), data["header"]["seq"]->as<uint32_t>());
+    ASSERT_EQ(lazy[header][seq].as<uint32_t>(), data["header"]["seq"]->as<uint32_t>());
+    ASSERT_TRUE(data->has(header));
+    ASSERT_FALSE(data->has(missing));
+    ASSERT_THROW(data[missing], std::out_of_range);
+    ASSERT_THROW(ref[missing], std::out_of_range);
+    ASSERT_THROW(ref["header"]["seq"][seq], std::runtime_error);
+    ASSERT_EQ(data->has(ranges), message->topic == "/base_scan");
+    ASSERT_EQ(lazy.has(ranges), message->topic == "/base_scan");
+
+    // Fields are iterated in the order they are declared in
+    const auto msg_def = bag.msgDefForTopic(message->topic);
+    size_t index = 0;
+    for (auto item = data->beginItems<const std::pair<const std::string&, const Embag::RosValue::Pointer>>(); item != data->endItems<const std::pair<const std::string&, const Embag::RosValue::Pointer>>(); ++item) {
+      ASSERT_EQ((*item).first, msg_def->field(index).name());
+      ASSERT_EQ((*item).second->getType(), data[index]->getType());
+      ++index;
+    }
+    ASSERT_EQ(index, msg_def->fieldCount());
+  }
+
+  const Embag::FieldIndex index{{"x", "yy", "z", "x"}};
+  ASSERT_EQ(index.size(), 4);
+  ASSERT_EQ(index.find("yy"), 1);
+  ASSERT_EQ(index.find("y"), Embag::FieldIndex::npos);
+  ASSERT_EQ(index.find("zz"), Embag::FieldIndex::npos);
+  ASSERT_EQ(index.at(Embag::Symbol{"z"}), 2);
+  ASSERT_EQ(index.find(seq), Embag::FieldIndex::npos);
+  ASSERT_THROW(index.at("w"), std::out_of_range);
+  // A repeated name refers to its first declaration
+  ASSERT_EQ(index.at("x"), 0);
+  ASSERT_EQ(index.at(Embag::Symbol{"x"}), 0);
+  ASSERT_EQ(index.name(3), "x");
+
+  // Larger definitions are hashed, and names that only differ in the middle or past their eighth byte are told apart
+  const std::vector<std::string> names{"a", "abc", "abd", "axc", "abcd", "abxd", "position_x", "position_y",
+                                       "orientation_x", "orientation_y", "velocity", "velocitx", ""};
+  const Embag::FieldIndex large{names};
+  for (size_t i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(large.at(names[i]), i);
+    ASSERT_EQ(large.at(Embag::Symbol{names[i]}), i);
+  }
+  ASSERT_EQ(large.find("position_z"), Embag::FieldIndex::npos);
+  ASSERT_EQ(large.find("ab"), Embag::FieldIndex::npos);
+  ASSERT_EQ(large.find("abcde"), Embag::FieldIndex::npos);
+}
+
+TEST_F(ViewTest, FieldPaths) {
+  Embag::Bag bag{"test/test.bag"};
+  const auto &odometry = *bag.msgDefForTopic("/base_pose_ground_truth");
+  const Embag::FieldPath seq{odometry, "header.seq"};
+  const Embag::FieldPath frame_id{odometry, "header.frame_id"};
+  const Embag::FieldPath x{odometry, "pose.pose.position.x"};
+  const Embag::FieldPath covariance{odometry, "twist.covariance[35]"};
+  const Embag::FieldPath pose{odometry, "pose.pose"};
+
+  ASSERT_TRUE(seq.hasConstantOffset());
+  ASSERT_FALSE(x.hasConstantOffset());
+  ASSERT_EQ(x.type(), Embag::RosValue::Type::float64);
+  ASSERT_EQ(pose.type(), Embag::RosValue::Type::object);
+
+  ASSERT_THROW(Embag::FieldPath(odometry, "header.not_a_field"), std::runtime_error);
+  ASSERT_THROW(Embag::FieldPath(odometry, "header.seq[0]"), std::runtime_error);
+  ASSERT_THROW(Embag::FieldPath(odometry, "header.seq.value"), std::runtime_error);
+  ASSERT_THROW(Embag::FieldPath(odometry, "twist.covariance[x]"), std::runtime_error);
+  ASSERT_THROW(Embag::FieldPath(odometry, "twist.covariance[36]"), std::out_of_range);
+
+  const auto &laser_scan = *bag.msgDefForTopic("/base_scan");
+  const Embag::FieldPath range{laser_scan, "ranges[3]"};
+  const Embag::FieldPath past_the_end{laser_scan, "ranges[100000]"};
+  ASSERT_EQ(range.type(), Embag::RosValue::Type::float32);
+
+  size_t message_count = 0;
+  for (const auto &message : view_.getMessages({"/base_pose_ground_truth", "/base_scan"})) {
+    const auto &data = message->data();
+
+    if (message->topic == "/base_scan") {
+      ASSERT_EQ(range.resolve(data)->as<float>(), data["ranges"][3]->as<float>());
+      ASSERT_EQ(range.get<float>(*message), data["ranges"][3]->as<float>());
+      ASSERT_THROW(past_the_end.get<float>(*message), std::out_of_range);
+      ASSERT_THROW(past_the_end.resolve(data), std::out_of_range);
+    } else {
+      ASSERT_EQ(seq.get<uint32_t>(*message), data["header"]["seq"]->as<uint32_t>());
+      ASSERT_EQ(frame_id.get<std::string>(*message), data["header"]["frame_id"]->as<std::string>());
+      ASSERT_EQ(x.get<double>(*message), data["pose"]["pose"]["position"]["x"]->as<double>());
+      ASSERT_EQ(x.resolve(data)->as<double>(), data["pose"]["pose"]["position"]["x"]->as<double>());
+      ASSERT_EQ(covariance.get<double>(*message), data["twist"]["covariance"][35]->as<double>());
+      ASSERT_EQ(pose.resolve(data)["orientation"]["w"]->as<double>(), data["pose"]["pose"]["orientation"]["w"]->as<double>());
+      ASSERT_THROW(x.get<float>(*message), std::runtime_error);
+      ASSERT_THROW(pose.get<double>(*message), std::runtime_error);
+    }
+
+    message_count++;
+  }
+
+  ASSERT_GT(message_count, 0);
+}
+
+TEST_F(ViewTest, Projection) {
+  Embag::Bag bag{"test/test.bag"};
+  Embag::View full_view{"test/test.bag"};
+  full_view.getMessages({"/base_pose_ground_truth", "/base_scan", "/luminar_pointcloud"});
+  std::vector<std::shared_ptr<Embag::RosMessage>> full_messages;
+  for (const auto &message : full_view) {
+    full_messages.push_back(message);
+  }
+
+  view_.getMessages(Embag::View::projection_t{
+    {"/base_pose_ground_truth", {"header.stamp", "pose.pose.position", "twist.covariance"}},
+    {"/base_scan", {}},
+    {"/luminar_pointcloud", {"header", "width", "height", "fields.name"}},
+  });
+
+  size_t message_count = 0;
+  for (const auto &message : view_) {
+    ASSERT_LT(message_count, full_messages.size());
+    const auto &full_data = full_messages[message_count]->data();
+    const auto &data = message->data();
+    ASSERT_EQ(message->topic, full_messages[message_count]->topic);
+
+    if (message->topic == "/base_pose_ground_truth") {
+      ASSERT_EQ(data->size(), 3);
+      ASSERT_EQ(data["header"]->size(), 1);
+      ASSERT_FALSE(data["header"]->has("frame_id"));
+      ASSERT_EQ(
+        data["header"]["stamp"]->as<Embag::RosValue::ros_time_t>(),
+        full_data["header"]["stamp"]->as<Embag::RosValue::ros_time_t>());
+      ASSERT_EQ(data["pose"]["pose"]->size(), 1);
+      ASSERT_EQ(data["pose"]["pose"]["position"]["z"]->as<double>(), full_data["pose"]["pose"]["position"]["z"]->as<double>());
+      ASSERT_EQ(data["twist"]["covariance"][35]->as<double>(), full_data["twist"]["covariance"][35]->as<double>());
+      ASSERT_FALSE(data["twist"]->has("twist"));
+    } else if (message->topic == "/base_scan") {
+      ASSERT_EQ(data->size(), full_data->size());
+      ASSERT_EQ(data["ranges"][3]->as<float>(), full_data["ranges"][3]->as<float>());
+    } else {
+      ASSERT_EQ(data->size(), 4);
+      ASSERT_FALSE(data->has("data"));
+      ASSERT_EQ(data["header"]["frame_id"]->as<std::string>(), full_data["header"]["frame_id"]->as<std::string>());
+      ASSERT_EQ(data["width"]->as<uint32_t>(), full_data["width"]->as<uint32_t>());
+      ASSERT_EQ(data["height"]->as<uint32_t>(), full_data["height"]->as<uint32_t>());
+      ASSERT_EQ(data["fields"]->size(), full_data["fields"]->size());
+      for (size_t i = 0; i < data["fields"]->size(); ++i) {
+        ASSERT_EQ(data["fields"][i]->size(), 1);
+        ASSERT_EQ(data["fields"][i]["name"]->as<std::string>(), full_data["fields"][i]["name"]->as<std::string>());
+      }
+    }
+
+    message_count++;
+  }
+  ASSERT_EQ(message_count, full_messages.size());
+
+  // Paths can be followed through a projection, and straight through the raw bytes with the projected program
+  const auto projected = bag.msgDefForTopic("/base_pose_ground_truth")->program().project({"pose.pose.position.x"});
+  const Embag::FieldPath x{*projected, "pose.pose.position.x"};
+  for (const auto &message : full_view.getMessages("/base_pose_ground_truth")) {
+    ASSERT_EQ(x.get<double>(*message), message->data()["pose"]["pose"]["position"]["x"]->as<double>());
+  }
+
+  ASSERT_THROW(view_.getMessages(Embag::View::projection_t{{"/base_scan", {"not_a_field"}}}), std::runtime_error);
+  ASSERT_THROW(view_.getMessages(Embag::View::projection_t{{"/base_scan", {"ranges.x"}}}), std::runtime_error);
+  ASSERT_THROW(view_.getMessages(Embag::View::projection_t{{"/base_scan", {"ranges[3]"}}}), std::runtime_error);
+}
+
+TEST_F(ViewTest, Columns) {
+  std::vector<Embag::RosValue::ros_time_t> timestamps;
+  std::vector<double> linear_x;
+  std::vector<uint32_t> seqs;
+  for (const auto &message : view_.getMessages("/base_pose_ground_truth")) {
+    timestamps.push_back(message->timestamp);
+    linear_x.push_back(message->data()["twist"]["twist"]["linear"]["x"]->as<double>());
+    seqs.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+  }
+  ASSERT_GT(timestamps.size(), 0);
+
+  for (const size_t threads : {1, 4}) {
+    const auto columns = view_.readColumns("/base_pose_ground_truth", {"twist.twist.linear.x", "header.seq"}, threads);
+    ASSERT_EQ(columns.timestamps, timestamps);
+    ASSERT_EQ(columns.columns.size(), 2);
+    ASSERT_EQ(columns["twist.twist.linear.x"].type, Embag::RosValue::Type::float64);
+    ASSERT_EQ(columns["twist.twist.linear.x"].values<double>(), linear_x);
+    ASSERT_EQ(columns["header.seq"].values<uint32_t>(), seqs);
+    ASSERT_THROW(columns["header.seq"].values<uint64_t>(), std::runtime_error);
+    ASSERT_THROW(columns["header.stamp"], std::out_of_range);
+  }
+
+  // Only the messages in the time range are read
+  const auto &start_time = timestamps[timestamps.size() / 4];
+  const auto &end_time = timestamps[timestamps.size() / 2];
+  const auto range = view_.readColumns("/base_pose_ground_truth", {"header.seq"}, start_time, end_time);
+  ASSERT_EQ(range.timestamps.front(), start_time);
+  ASSERT_EQ(range.timestamps.back(), end_time);
+  ASSERT_EQ(range["header.seq"].size(), range.timestamps.size());
+  ASSERT_EQ(range["header.seq"].data<uint32_t>()[0], seqs[timestamps.size() / 4]);
+
+  std::vector<float> ranges;
+  for (const auto &message : view_.getMessages("/base_scan")) {
+    ranges.push_back(message->data()["ranges"][3]->as<float>());
+  }
+  ASSERT_EQ(view_.readColumns("/base_scan", {"ranges[3]"})["ranges[3]"].values<float>(), ranges);
+  ASSERT_FALSE(view_.readColumns("/base_scan", {"ranges[3]"})["ranges[3]"].isArray());
+
+  // Whole arrays are read as the elements of every message, back to back
+  std::vector<float> all_ranges;
+  std::vector<uint64_t> offsets{0};
+  for (const auto &message : view_.getMessages("/base_scan")) {
+    const auto message_ranges = message->data()["ranges"];
+    for (size_t i = 0; i < message_ranges->size(); ++i) {
+      all_ranges.push_back(message_ranges[i]->as<float>());
+    }
+    offsets.push_back(all_ranges.size());
+  }
+
+  for (const size_t threads : {1, 4}) {
+    const auto columns = view_.readColumns("/base_scan", {"ranges", "header.seq"}, threads);
+    ASSERT_TRUE(columns["ranges"].isArray());
+    ASSERT_EQ(columns["ranges"].type, Embag::RosValue::Type::float32);
+    ASSERT_EQ(columns["ranges"].values<float>(), all_ranges);
+    ASSERT_EQ(columns["ranges"].offsets, offsets);
+    ASSERT_EQ(columns["header.seq"].size(), columns.timestamps.size());
+  }
+
+  ASSERT_THROW(view_.readColumns("/base_pose_ground_truth", {"header.frame_id"}), std::runtime_error);
+  ASSERT_THROW(view_.readColumns("/base_pose_ground_truth", {"pose.pose"}), std::runtime_error);
+  ASSERT_THROW(view_.readColumns("/not_a_topic", {"header.seq"}), std::runtime_error);
+}
+
+TEST_F(ViewTest, Records) {
+  std::vector<Embag::RosValue::ros_time_t> timestamps;
+  std::vector<double> linear_x;
+  std::vector<uint32_t> seqs;
+  for (const auto &message : view_.getMessages("/base_pose_ground_truth")) {
+    timestamps.push_back(message->timestamp);
+    linear_x.push_back(message->data()["twist"]["twist"]["linear"]["x"]->as<double>());
+    seqs.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+  }
+  ASSERT_GT(timestamps.size(), 0);
+
+  for (const size_t threads : {1, 4}) {
+    const auto records = view_.readRecords("/base_pose_ground_truth", threads);
+    ASSERT_EQ(records.size(), timestamps.size());
+
+    // Odometry keeps everything but its frame ids, which are strings
+    ASSERT_EQ(records.fields.size(), 4);
+    const auto &header = records.fields[1];
+    ASSERT_EQ(records.fields[0].name, "timestamp");
+    ASSERT_EQ(header.name, "header");
+    ASSERT_EQ(header.size, sizeof(uint32_t) + 2 * sizeof(uint32_t));
+    ASSERT_EQ(header.fields.size(), 2);
+    ASSERT_EQ(header.fields[1].name, "stamp");
+    ASSERT_EQ(header.fields[1].type, Embag::RosValue::Type::ros_time);
+    ASSERT_EQ(header.fields[1].offset, sizeof(uint32_t));
+
+    const auto &twist = records.fields[3];
+    ASSERT_EQ(twist.name, "twist");
+    ASSERT_EQ(twist.fields[1].name, "covariance");
+    ASSERT_EQ(twist.fields[1].array_size, 36);
+    ASSERT_EQ(twist.fields[1].size, sizeof(double));
+    ASSERT_EQ(records.row_size, twist.offset + twist.size);
+    const size_t linear_x_offset = twist.offset + twist.fields[0].offset + twist.fields[0].fields[0].offset;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+      ASSERT_EQ(records.timestamp(i), timestamps[i]);
+
+      uint32_t seq;
+      double x;
+      std::memcpy(&seq, records.row(i) + header.offset, sizeof(seq));
+      std::memcpy(&x, records.row(i) + linear_x_offset, sizeof(x));
+      ASSERT_EQ(seq, seqs[i]);
+      ASSERT_EQ(x, linear_x[i]);
+    }
+  }
+
+  // Only the messages in the time range are read
+  const auto &start_time = timestamps[timestamps.size() / 4];
+  const auto &end_time = timestamps[timestamps.size() / 2];
+  const auto range = view_.readRecords("/base_pose_ground_truth", start_time, end_time);
+  ASSERT_EQ(range.timestamp(0), start_time);
+  ASSERT_EQ(range.timestamp(range.size() - 1), end_time);
+
+  ASSERT_THROW(view_.readRecords("/not_a_topic"), std::runtime_error);
+}
+
+TEST_F(ViewTest, Arrow) {
+  std::vector<Embag::RosValue::ros_time_t> timestamps;
+  std::vector<uint32_t> seqs;
+  std::vector<std::string> frame_ids;
+  for (const auto &message : view_.getMessages("/base_pose_ground_truth")) {
+    timestamps.push_back(message->timestamp);
+    seqs.push_back(message->data()["header"]["seq"]->as<uint32_t>());
+    frame_ids.push_back(message->data()["header"]["frame_id"]->as<std::string>());
+  }
+  ASSERT_GT(timestamps.size(), 0);
+
+  for (const size_t threads : {1, 4}) {
+    auto batches = view_.readArrow("/base_pose_ground_truth", threads);
+    ASSERT_EQ(batches.rowCount(), timestamps.size());
+
+    ArrowSchema schema;
+    batches.exportSchema(&schema);
+    ASSERT_STREQ(schema.format, "+s");
+    ASSERT_EQ(schema.n_children, 5);
+    ASSERT_STREQ(schema.children[0]->name, "timestamp");
+    ASSERT_STREQ(schema.children[0]->format, "tsn:");
+    const auto *header = schema.children[1];
+    ASSERT_STREQ(header->name, "header");
+    ASSERT_STREQ(header->children[0]->format, "I");
+    ASSERT_STREQ(header->children[1]->format, "tsn:");
+    ASSERT_STREQ(header->children[2]->format, "u");
+    ASSERT_STREQ(schema.children[3]->children[1]->name, "covariance");
+    ASSERT_STREQ(schema.children[3]->children[1]->format, "+w:36");
+    ASSERT_STREQ(schema.children[3]->children[1]->children[0]->format, "g");
+    schema.release(&schema);
+    ASSERT_EQ(schema.release, nullptr);
+
+    // Rows are in the same order as the messages
+    size_t row = 0;
+    for (size_t b = 0; b < batches.size(); ++b) {
+      const auto &batch = batches[b];
+      ASSERT_EQ(batch.n_children, 5);
+      const auto *times = static_cast<const int64_t *>(batch.children[0]->buffers[1]);
+      const auto *header_array = batch.children[1];
+      const auto *seq = static_cast<const uint32_t *>(header_array->children[0]->buffers[1]);
+      const auto *frame_id_offsets = static_cast<const int32_t *>(header_array->children[2]->buffers[1]);
+      const auto *frame_id_bytes = static_cast<const char *>(header_array->children[2]->buffers[2]);
+      const auto *covariance = batch.children[3]->children[1];
+      ASSERT_EQ(covariance->children[0]->length, 36 * batch.length);
+
+      for (int64_t i = 0; i < batch.length; ++i, ++row) {
+        ASSERT_EQ(times[i], timestamps[row].to_nsec());
+        ASSERT_EQ(seq[i], seqs[row]);
+        ASSERT_EQ(std::string(frame_id_bytes + frame_id_offsets[i], frame_id_offsets[i + 1] - frame_id_offsets[i]), frame_ids[row]);
+      }
+    }
+    ASSERT_EQ(row, timestamps.size());
+  }
+
+  // Variable length arrays are lists, and uint8 arrays are binary
+  std::vector<float> ranges;
+  size_t message_count = 0;
+  for (const auto &message : view_.getMessages("/base_scan")) {
+    const auto scan_ranges = message->data()["ranges"];
+    const auto *values = static_cast<const float *>(scan_ranges->getPrimitiveArrayRosValueBuffer());
+    ranges.insert(ranges.end(), values, values + scan_ranges->size());
+    ++message_count;
+  }
+
+  std::vector<float> arrow_ranges;
+  size_t arrow_count = 0;
+  ArrowArrayStream stream;
+  ArrowArrayStream second_stream;
+  {
+    // Streams share the batches, so there can be any number of them, and they outlive the batches
+    const auto scans = view_.readArrow("/base_scan", timestamps.front(), timestamps.back());
+    scans.exportStream(&stream);
+    scans.exportStream(&second_stream);
+    ASSERT_GT(scans.size(), 0);
+  }
+
+  ArrowSchema scan_schema;
+  ASSERT_EQ(stream.get_schema(&stream, &scan_schema), 0);
+  size_t ranges_index = 0;
+  while (std::string(scan_schema.children[ranges_index]->name) != "ranges") {
+    ++ranges_index;
+  }
+  ASSERT_STREQ(scan_schema.children[ranges_index]->format, "+l");
+  scan_schema.release(&scan_schema);
+
+  ArrowArray batch;
+  while (stream.get_next(&stream, &batch) == 0 && batch.release != nullptr) {
+    const auto *list = batch.children[ranges_index];
+    const auto *offsets = static_cast<const int32_t *>(list->buffers[1]);
+    const auto *values = static_cast<const float *>(list->children[0]->buffers[1]);
+    arrow_ranges.insert(arrow_ranges.end(), values, values + offsets[list->length]);
+    arrow_count += batch.length;
+    batch.release(&batch);
+  }
+  stream.release(&stream);
+
+  size_t second_count = 0;
+  while (second_stream.get_next(&second_stream, &batch) == 0 && batch.release != nullptr) {
+    second_count += batch.length;
+    batch.release(&batch);
+  }
+  second_stream.release(&second_stream);
+  ASSERT_EQ(second_count, arrow_count);
+  ASSERT_LE(arrow_count, message_count);
+  ASSERT_GT(arrow_count, 0);
+  ASSERT_TRUE(std::equal(arrow_ranges.begin(), arrow_ranges.end(), ranges.begin()));
+
+  auto clouds = view_.readArrow("/luminar_pointcloud");
+  ArrowSchema cloud_schema;
+  clouds.exportSchema(&cloud_schema);
+  std::set<std::string> formats;
+  for (int64_t i = 0; i < cloud_schema.n_children; ++i) {
+    formats.emplace(std::string(cloud_schema.children[i]->name) + ":" + cloud_schema.children[i]->format);
+  }
+  cloud_schema.release(&cloud_schema);
+  ASSERT_EQ(formats.count("data:z"), 1);
+  ASSERT_EQ(formats.count("fields:+l"), 1);
+  ASSERT_EQ(formats.count("is_dense:b"), 1);
+
+  ASSERT_THROW(view_.readArrow("/not_a_topic"), std::runtime_error);
+}
+
+TEST_F(ViewTest, RawMessages) {
+  std::vector<Embag::RosValue::ros_time_t> timestamps;
+  std::vector<std::string> payloads;
+  for (const auto &message : view_.getMessages("/base_scan")) {
+    timestamps.push_back(message->timestamp);
+    payloads.emplace_back(message->raw_buffer->data() + message->raw_buffer_offset, message->raw_data_len);
+  }
+  ASSERT_GT(timestamps.size(), 0);
+
+  for (const size_t threads : {1, 4}) {
+    const auto raw = view_.readRaw("/base_scan", threads);
+    ASSERT_EQ(raw.timestamps, timestamps);
+    ASSERT_EQ(raw.offsets.size(), raw.size() + 1);
+    ASSERT_EQ(raw.offsets.back(), raw.bytes.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+      ASSERT_EQ(std::string(raw.data(i), raw.length(i)), payloads[i]);
+    }
+  }
+
+  const auto range = view_.readRaw("/base_scan", timestamps[1], timestamps[2]);
+  ASSERT_EQ(range.size(), 2);
+  ASSERT_EQ(std::string(range.data(0), range.length(0)), payloads[1]);
+
+  ASSERT_THROW(view_.readRaw("/not_a_topic"), std::runtime_error);
+
+  // Every connection of the topic is read
+  Embag::View chatter_view{"test/test_2.bag"};
+  size_t chatter_count = 0;
+  for (const auto &message : chatter_view.getMessages("chatter")) {
+    ++chatter_count;
+  }
+  ASSERT_GT(chatter_count, 0);
+  ASSERT_EQ(chatter_view.readRaw("chatter").size(), chatter_count);
+}
+
+TEST(EmbagTest, ThreadsShareBagsAndMessages) {
+  std::vector<std::string> expected;
+  for (const auto &message : Embag::View{"test/test.bag"}.getMessages()) {
+    expected.push_back(message->toString());
+  }
+
+  // Views on a shared bag parse its definitions concurrently, and every thread parses the same shared messages
+  const auto bag = std::make_shared<Embag::Bag>("test/test.bag");
+  std::vector<std::shared_ptr<Embag::RosMessage>> shared_messages;
+  for (const auto &message : Embag::View{"test/test.bag"}.getMessages()) {
+    shared_messages.push_back(message);
+  }
+
+  std::vector<std::vector<std::string>> results(4);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < results.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      for (const auto &message : Embag::View{bag}.getMessages()) {
+        results[t].push_back(message->toString());
+      }
+      for (const auto &message : shared_messages) {
+        message->data();
+        message->lazyData();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &result : results) {
+    ASSERT_EQ(result, expected);
+  }
+  for (size_t i = 0; i < shared_messages.size(); ++i) {
+    ASSERT_EQ(shared_messages[i]->toString(), expected[i]);
+  }
+}
+
+TEST(EmbagTest, ThreadsShareAnIterator) {
+  Embag::View view{"test/test.bag"};
+  view.getMessages(view.topics(), [](const Embag::RosBagTypes::connection_data_t &, const Embag::RosValue::ros_time_t &) {
+    return true;
+  });
+
+  std::multiset<std::string> expected;
+  for (const auto &message : view) {
+    expected.insert(message->topic + " " + std::to_string(message->timestamp.to_nsec()));
+  }
+
+  // Every message goes to exactly one of the threads
+  Embag::View::shared_iterator messages{view.begin(), view.end()};
+  std::vector<std::vector<std::string>> results(4);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < results.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      while (const auto message = messages.next()) {
+        results[t].push_back(message->topic + " " + std::to_string(message->timestamp.to_nsec()));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::multiset<std::string> seen;
+  for (const auto &result : results) {
+    seen.insert(result.begin(), result.end());
+  }
+  ASSERT_EQ(seen, expected);
+  ASSERT_EQ(messages.next(), nullptr);
+}
+
+TEST_F(ViewTest, PointClouds) {
+  Embag::Bag bag{"test/test.bag"};
+  size_t message_count = 0;
+  for (const auto &message : view_.getMessages("/luminar_pointcloud")) {
+    const auto &data = message->data();
+    const auto cloud = Embag::PointCloud::decode(data);
+
+    const size_t point_count = data["width"]->as<uint32_t>() * data["height"]->as<uint32_t>();
+    const size_t point_step = data["point_step"]->as<uint32_t>();
+    const auto *points = static_cast<const char *>(data["data"]->getPrimitiveArrayRosValueBuffer());
+    ASSERT_EQ(cloud.size(), point_count);
+    ASSERT_EQ(cloud.fields().size(), data["fields"]->size());
+
+    // Every field is de-interleaved in its own type
+    for (size_t f = 0; f < data["fields"]->size(); ++f) {
+      const auto point_field = data["fields"][f];
+      const auto &field = cloud.fields()[f];
+      const size_t offset = point_field["offset"]->as<uint32_t>();
+      const size_t size = Embag::RosValue::primitiveTypeToSize(field.type);
+      ASSERT_EQ(field.name, point_field["name"]->as<std::string>());
+      ASSERT_EQ(field.bytes.size(), point_count * field.count * size);
+      for (size_t i = 0; i < point_count; i += 97) {
+        ASSERT_EQ(std::memcmp(field.bytes.data() + i * field.count * size, points + i * point_step + offset, field.count * size), 0);
+      }
+    }
+
+    // Selected fields are converted and points with NaNs dropped
+    Embag::PointCloud::options_t options;
+    options.fields = {"z", "x"};
+    options.skip_nans = true;
+    options.type = Embag::RosValue::Type::float64;
+    const auto filtered = Embag::PointCloud::decode(data, options);
+    ASSERT_EQ(filtered.fields().size(), 2);
+    ASSERT_EQ(filtered.fields()[0].name, "z");
+
+    const auto x = cloud["x"].values<float>();
+    const auto z = cloud["z"].values<float>();
+    std::vector<double> kept_x;
+    for (size_t i = 0; i < point_count; ++i) {
+      if (!std::isnan(x[i]) && !std::isnan(z[i])) {
+        kept_x.push_back(x[i]);
+      }
+    }
+    ASSERT_EQ(filtered.size(), kept_x.size());
+    ASSERT_EQ(filtered["x"].values<double>(), kept_x);
+    ASSERT_THROW(filtered["x"].values<float>(), std::runtime_error);
+    ASSERT_THROW(filtered["y"], std::out_of_range);
+
+    options.fields = {"not_a_field"};
+    ASSERT_THROW(Embag::PointCloud::decode(data, options), std::runtime_error);
+
+    // Blank out some points of a copy of the message
+    const auto *message_start = message->raw_buffer->data() + message->raw_buffer_offset;
+    auto copy = std::make_shared<std::vector<char>>(message_start, message_start + message->raw_data_len);
+    const size_t x_offset = (points - message_start) + data["fields"][0]["offset"]->as<uint32_t>();
+    const float nan = std::nanf("");
+    for (const size_t i : {size_t{0}, size_t{5}, size_t{1500}, point_count - 1}) {
+      std::memcpy(copy->data() + x_offset + i * point_step, &nan, sizeof(nan));
+    }
+
+    Embag::MessageParser parser{copy, 0, *bag.msgDefForTopic("/luminar_pointcloud")};
+    const auto blanked_data = parser.parse();
+    options.fields = {"x", "intensity"};
+    options.type = Embag::RosValue::Type::object;
+    const auto blanked = Embag::PointCloud::decode(blanked_data, options);
+    ASSERT_EQ(blanked.size(), point_count - 4);
+    ASSERT_EQ(blanked["x"].data<float>()[0], x[1]);
+    ASSERT_EQ(blanked["x"].data<float>()[4], x[6]);
+    ASSERT_EQ(blanked["x"].data<float>()[1500 - 2], x[1501]);
+    ASSERT_EQ(blanked["intensity"].data<float>()[4], cloud["intensity"].data<float>()[6]);
+
+    // NaNs are found the same way in converted values, and before converting to integers
+    options.type = Embag::RosValue::Type::float64;
+    const auto blanked_doubles = Embag::PointCloud::decode(blanked_data, options);
+    ASSERT_EQ(blanked_doubles.size(), point_count - 4);
+    ASSERT_EQ(blanked_doubles["x"].data<double>()[1500 - 2], x[1501]);
+
+    options.type = Embag::RosValue::Type::int32;
+    const auto blanked_integers = Embag::PointCloud::decode(blanked_data, options);
+    ASSERT_EQ(blanked_integers.size(), point_count - 4);
+    ASSERT_EQ(blanked_integers["intensity"].data<int32_t>()[1500 - 2], static_cast<int32_t>(cloud["intensity"].data<float>()[1501]));
+
+    message_count++;
+  }
+
+  ASSERT_GT(message_count, 0);
+}
+
+TEST(MultiBagViewTest, ArrowOrder) {
+  Embag::View view{"test/test.bag"};
+  view.addBag("test/test.bag");
+
+  // Both bags have the same chunks, which overlap and so share batches ordered by timestamp
+  const auto single = Embag::View{"test/test.bag"}.readArrow("/base_scan");
+  const auto batches = view.readArrow("/base_scan");
+  ASSERT_EQ(batches.rowCount(), 2 * single.rowCount());
+  ASSERT_EQ(batches.size(), single.size());
+
+  int64_t last_time = 0;
+  for (size_t b = 0; b < batches.size(); ++b) {
+    const auto *times = static_cast<const int64_t *>(batches[b].children[0]->buffers[1]);
+    for (int64_t i = 0; i < batches[b].length; ++i) {
+      ASSERT_LE(last_time, times[i]);
+      last_time = times[i];
+    }
+  }
+}
+
+TEST(MultiBagViewTest, ReverseMerge) {
+  Embag::View view{"test/test.bag"};
+  view.addBag("test/test.bag");
+
+  size_t forward_count = 0;
+  for (const auto &message : view.getMessages("/base_scan")) {
+    ++forward_count;
+  }
+
+  size_t reverse_count = 0;
+  Embag::RosValue::ros_time_t last_time{UINT32_MAX, UINT32_MAX};
+  for (auto it = view.rbegin(); it != view.rend(); ++it) {
+    ASSERT_EQ((*it)->topic, "/base_scan");
+    ASSERT_LE((*it)->timestamp, last_time);
+    last_time = (*it)->timestamp;
+    ++reverse_count;
+  }
+
+  ASSERT_GT(forward_count, 0);
+  ASSERT_EQ(forward_count, reverse_count);
+}
+
 class StreamTest : public ::testing::Test {
  protected:
   std::string bag_path_ = "test/test.bag";
@@ -332,4 +1492,83 @@ TEST_F(ArraysTest, ArrayReading) {
   ASSERT_EQ(index, 20);
 }
 
+TEST_F(ArraysTest, LazyArrayReading) {
+  uint32_t index = 0;
+  for (const auto &message : view_.getMessages("/array_test")) {
+    const auto lazy = message->lazyData();
+
+    // Read the later arrays first so the earlier ones have to be skipped over
+    const auto bool_object_array = lazy["index_as_bool_object_array"];
+    ASSERT_EQ(bool_object_array.size(), 20);
+    for (uint32_t inner_index = 0; inner_index < 20; inner_index++) {
+      ASSERT_EQ(bool_object_array[inner_index]["data"].as<bool>(), index == inner_index);
+    }
+    ASSERT_THROW(bool_object_array[20], std::out_of_range);
+
+    const auto string_array = lazy["index_as_string_array"];
+    for (uint32_t inner_index = 20; inner_index-- > 0;) {
+      ASSERT_EQ(string_array[inner_index].as<std::string>(), index == inner_index ? "true" : "false");
+    }
+
+    const auto static_uint64_array = lazy["index_multiples_as_static_uint64_array"];
+    const auto dynamic_bool_array = lazy["index_as_dynamic_bool_array"];
+    for (uint32_t inner_index = 0; inner_index < 20; inner_index++) {
+      ASSERT_EQ(static_uint64_array[inner_index].as<uint64_t>(), (uint64_t) index * inner_index);
+      ASSERT_EQ(dynamic_bool_array[inner_index].as<bool>(), index == inner_index);
+    }
+
+    ASSERT_EQ(lazy["index"].as<uint32_t>(), index);
+    index++;
+  }
+
+  ASSERT_EQ(index, 20);
+}
+
+TEST_F(ArraysTest, FieldPaths) {
+  Embag::Bag bag{"test/array_test.bag"};
+  const auto &msg_def = *bag.msgDefForTopic("/array_test");
+  const Embag::FieldPath index_path{msg_def, "index"};
+
+  uint32_t index = 0;
+  for (const auto &message : view_.getMessages("/array_test")) {
+    // Elements of string and object arrays have to be skipped over one at a time
+    for (uint32_t inner_index = 0; inner_index < 20; inner_index++) {
+      const std::string suffix = "[" + std::to_string(inner_index) + "]";
+      const Embag::FieldPath string_element{msg_def, "index_as_string_array" + suffix};
+      const Embag::FieldPath bool_element{msg_def, "index_as_bool_object_array" + suffix + ".data"};
+      const Embag::FieldPath dynamic_element{msg_def, "index_as_dynamic_bool_array" + suffix};
+
+      ASSERT_EQ(string_element.get<std::string>(*message), index == inner_index ? "true" : "false");
+      ASSERT_EQ(bool_element.get<bool>(*message), index == inner_index);
+      ASSERT_EQ(bool_element.resolve(message->data())->as<bool>(), index == inner_index);
+      ASSERT_EQ(dynamic_element.get<bool>(*message), index == inner_index);
+    }
+
+    ASSERT_EQ(index_path.get<uint32_t>(*message), index);
+    index++;
+  }
+
+  ASSERT_EQ(index, 20);
+}
+
+TEST_F(ArraysTest, Projection) {
+  view_.getMessages(Embag::View::projection_t{{"/array_test", {"index_as_string_array", "index"}}});
+
+  uint32_t index = 0;
+  for (const auto &message : view_) {
+    const auto &data = message->data();
+    ASSERT_EQ(data->size(), 2);
+    ASSERT_EQ(data["index"]->as<uint32_t>(), index);
+
+    const auto string_array = data["index_as_string_array"];
+    for (uint32_t inner_index = 0; inner_index < 20; inner_index++) {
+      ASSERT_EQ(string_array[inner_index]->as<std::string>(), index == inner_index ? "true" : "false");
+    }
+
+    index++;
+  }
+
+  ASSERT_EQ(index, 20);
+}
+
 // TODO: test multi-bag message sorting
@@ -1,11 +1,18 @@
 import python.libembag as embag
 from collections import OrderedDict
+import mmap
 import numpy as np
 import pickle
 import struct
 import sys
+import threading
 import unittest
 
+try:
+    import pyarrow
+except ImportError:
+    pyarrow = None
+
 
 class EmbagTest(unittest.TestCase):
     def setUp(self):
@@ -154,9 +161,192 @@ class EmbagTest(unittest.TestCase):
                 for v in msg_data['pose']['covariance']:
                     self.assertEqual(v, 0)
 
+    def testReverseMessages(self):
+        forward = [(msg.topic, msg.timestamp.to_nsec()) for msg in self.view.getMessages()]
+        backward = [(msg.topic, msg.timestamp.to_nsec()) for msg in self.view.reversed()]
+        self.assertGreater(len(forward), 0)
+        self.assertEqual(forward[::-1], backward)
+
+        # Iterate backwards from a seek point
+        topics = ['/base_scan']
+        times = [msg.timestamp for msg in self.view.getMessages(topics)]
+        seek_time = times[len(times) // 2]
+        view = self.view.getMessages(topics, embag.RosTime(0, 0), seek_time)
+        backward = [msg.timestamp.to_nsec() for msg in view.reversed()]
+        self.assertEqual(backward, [t.to_nsec() for t in times[:len(times) // 2 + 1]][::-1])
+
+    def testShards(self):
+        topics = ['/base_scan', '/luminar_pointcloud']
+        expected = sorted((msg.topic, msg.data()['header']['seq']) for msg in self.view.getMessages(topics))
+
+        seen = []
+        for i in range(3):
+            descriptor = str(self.view.shard(i, 3, embag.Shard.Balance.message_count))
+            worker_view = embag.View(self.bag_path)
+            for msg in worker_view.getMessages(embag.Shard.fromString(descriptor)):
+                seen.append((msg.topic, msg.data()['header']['seq']))
+
+        self.assertEqual(sorted(seen), expected)
+
+    def testSampling(self):
+        all_scans = [msg.data()['header']['seq'] for msg in self.view.getMessages('/base_scan')]
+        sampled_scans = [msg.data()['header']['seq'] for msg in self.view.getMessages(['/base_scan']).sample('/base_scan', stride=2)]
+        self.assertEqual(sampled_scans, all_scans[::2])
+
+        first_only = [msg.data()['header']['seq'] for msg in self.view.getMessages(['/base_scan']).sample('/base_scan', period=3600.0)]
+        self.assertEqual(first_only, all_scans[:1])
+
+        # Just under a second rounds to a whole second
+        first_each_second = [msg.data()['header']['seq'] for msg in self.view.getMessages(['/base_scan']).sample('/base_scan', period=0.9999999999)]
+        self.assertEqual(first_each_second, [msg.data()['header']['seq'] for msg in self.view.getMessages(['/base_scan']).sample('/base_scan', period=1.0)])
+
+        self.assertRaises(ValueError, self.view.getMessages(['/base_scan']).sample, '/base_scan', period=-1.0)
+        self.assertRaises(ValueError, self.view.getMessages(['/base_scan']).sample, '/base_scan', period=float('nan'))
+
+    def testPredicate(self):
+        def not_pointcloud_publisher(connection, timestamp):
+            return connection.callerid != '/play_1604515189845695821'
+
+        topics = set(msg.topic for msg in self.view.getMessages(list(self.known_topics), not_pointcloud_publisher))
+        self.assertSetEqual(topics, {'/base_scan', '/base_pose_ground_truth'})
+
+    def testPlan(self):
+        view = self.view.getMessages(['/base_scan'])
+        seqs = [msg.data()['header']['seq'] for msg in view]
+
+        plan = view.plan()
+        self.assertEqual(plan.message_counts, {'/base_scan': len(seqs)})
+        self.assertGreaterEqual(plan.uncompressed_bytes, plan.wanted_bytes)
+        self.assertGreaterEqual(plan.readAmplification(), 1.0)
+        self.assertIn('/base_scan: {}'.format(len(seqs)), plan.explain())
+        self.assertEqual([msg.data()['header']['seq'] for msg in view.execute(plan)], seqs)
+        self.assertEqual([msg.data()['header']['seq'] for msg in view.execute(view.plan(reverse=True))], seqs[::-1])
+
+    def testPointCloud(self):
+        for msg in self.view.getMessages('/luminar_pointcloud'):
+            data = msg.data()
+            points = np.array(data['data'], copy=False).reshape(-1, data['point_step'])
+            x_offset = data['fields'][0]['offset']
+            x = points[:, x_offset:x_offset + 4].copy().view('<f4').ravel()
+
+            cloud = embag.decode_point_cloud(data)
+            self.assertEqual(list(cloud.keys()), [field['name'] for field in data['fields']])
+            self.assertEqual(len(cloud['x']), len(points))
+            self.assertTrue(np.array_equal(cloud['x'], x))
+
+            converted = embag.decode_point_cloud(data, fields=['x'], skip_nans=True, dtype=np.float64)
+            self.assertEqual(list(converted.keys()), ['x'])
+            self.assertEqual(converted['x'].dtype, np.float64)
+            self.assertTrue(np.array_equal(converted['x'], x[~np.isnan(x)].astype(np.float64)))
+            self.assertEqual(embag.decode_point_cloud(data, fields=['x'], dtype='f4')['x'].dtype, np.float32)
+            self.assertEqual(embag.decode_point_cloud(data, fields=['x'], skip_nans=True, dtype=embag.RosValueType.int32)['x'].dtype, np.int32)
+            self.assertRaises(RuntimeError, embag.decode_point_cloud, data, dtype=np.complex64)
+
+    def testRecords(self):
+        messages = [(msg.timestamp, msg.data()) for msg in self.view.getMessages('/base_pose_ground_truth')]
+        records = self.view.readRecords('/base_pose_ground_truth')
+        self.assertEqual(len(records), len(messages))
+        # Strings are left out of the records
+        self.assertEqual(records.dtype.names, ('timestamp', 'header', 'pose', 'twist'))
+        self.assertEqual(records.dtype['header'].names, ('seq', 'stamp'))
+
+        for record, (timestamp, data) in zip(records, messages):
+            self.assertEqual(record['timestamp'], timestamp.to_nsec())
+            self.assertEqual(record['header']['seq'], data['header']['seq'])
+            self.assertEqual(record['header']['stamp']['secs'], data['header']['stamp'].secs)
+            self.assertEqual(record['twist']['twist']['linear']['x'], data['twist']['twist']['linear']['x'])
+            self.assertEqual(list(record['pose']['covariance']), list(data['pose']['covariance']))
+
+        start_time, end_time = messages[1][0], messages[3][0]
+        in_range = self.view.readRecords('/base_pose_ground_truth', start_time=start_time, end_time=end_time)
+        self.assertTrue(np.array_equal(in_range, records[1:4]))
+
+    def testColumn(self):
+        messages = [(msg.timestamp, msg.data()) for msg in self.view.getMessages('/base_pose_ground_truth')]
+        timestamps, x = self.view.column('/base_pose_ground_truth', 'pose.pose.position.x')
+        self.assertEqual(list(timestamps), [timestamp.to_nsec() for timestamp, _ in messages])
+        self.assertEqual(list(x), [data['pose']['pose']['position']['x'] for _, data in messages])
+        self.assertEqual(x.dtype, np.float64)
+
+        scans = [msg.data()['ranges'] for msg in self.view.getMessages('/base_scan')]
+        timestamps, ranges, offsets = self.view.column('/base_scan', 'ranges', threads=2)
+        self.assertEqual(len(timestamps), len(scans))
+        self.assertEqual(len(offsets), len(scans) + 1)
+        for i, scan in enumerate(scans):
+            self.assertEqual(list(ranges[offsets[i]:offsets[i + 1]]), list(scan))
+
+        self.assertRaises(RuntimeError, self.view.column, '/base_pose_ground_truth', 'header.frame_id')
+
+    def testArrowBatches(self):
+        batches = self.view.readArrow('/base_pose_ground_truth')
+        self.assertEqual(batches.num_rows, 5)
+        self.assertGreater(len(batches), 0)
+        # Every stream shares the same batches
+        batches.__arrow_c_stream__()
+        batches.__arrow_c_stream__()
+        self.assertGreater(len(batches), 0)
+
+    @unittest.skipUnless(pyarrow, 'pyarrow is not installed')
+    def testArrowTable(self):
+        messages = [(msg.timestamp, msg.data()) for msg in self.view.getMessages('/base_pose_ground_truth')]
+        table = pyarrow.table(self.view.readArrow('/base_pose_ground_truth'))
+        self.assertEqual(table.column_names, ['timestamp', 'header', 'child_frame_id', 'pose', 'twist'])
+        self.assertEqual(table.schema.field('timestamp').type, pyarrow.timestamp('ns'))
+
+        rows = table.to_pylist()
+        self.assertEqual(len(rows), len(messages))
+        for row, (timestamp, data) in zip(rows, messages):
+            self.assertEqual(row['header']['seq'], data['header']['seq'])
+            self.assertEqual(row['header']['frame_id'], data['header']['frame_id'])
+            self.assertEqual(row['child_frame_id'], data['child_frame_id'])
+            self.assertEqual(row['pose']['covariance'], list(data['pose']['covariance']))
+
+        scans = pyarrow.table(self.view.readArrow('/base_scan'))
+        self.assertEqual(scans.schema.field('ranges').type, pyarrow.list_(pyarrow.float32()))
+
+    def testThreadedReads(self):
+        expected = [str(msg.data()) for msg in embag.View(self.bag_path).getMessages()]
+
+        # Reading and parsing release the GIL, and threads can share a bag
+        results = [[] for _ in range(4)]
+
+        def read(result):
+            for msg in embag.View(self.bag).getMessages():
+                result.append(str(msg.data()))
+
+        threads = [threading.Thread(target=read, args=(result,)) for result in results]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        for result in results:
+            self.assertEqual(result, expected)
+
+        # Threads sharing an iterator, even one that calls back into Python, get each message exactly once
+        topics = ['/base_scan', '/base_pose_ground_truth']
+        shared = iter(embag.View(self.bag).getMessages(topics, lambda connection, timestamp: True))
+        shared_results = [[] for _ in range(4)]
+
+        def share(result):
+            for msg in shared:
+                result.append((msg.timestamp.to_nsec(), msg.topic, str(msg.data())))
+
+        threads = [threading.Thread(target=share, args=(result,)) for result in shared_results]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        expected = [(msg.timestamp.to_nsec(), msg.topic, str(msg.data())) for msg in self.view.getMessages(topics)]
+        self.assertEqual(sorted(sum(shared_results, [])), sorted(expected))
+
     def testObjectIterators(self):
         for topic, msg, t in self.bag.read_messages(topics=['/luminar_pointcloud']):
             assert {field_name for field_name in msg} == {field_name for field_name in self.known_pointcloud_schema}
+            # Fields come in the order they are declared in
+            self.assertEqual(list(msg.keys()), list(self.known_pointcloud_schema.keys()))
+            self.assertEqual([field_name for field_name, _ in msg.items()], list(self.known_pointcloud_schema.keys()))
             for field_name, value in msg.items():
                 if isinstance(value, embag.RosValue):
                     assert str(msg[field_name]) == str(value)
@@ -184,6 +374,28 @@ class EmbagTest(unittest.TestCase):
         self.testConnectionsInView()
         bag_stream.close()
 
+    def testBagFromBuffers(self):
+        with open(self.bag_path, 'rb') as bag_file:
+            bag_bytes = bag_file.read()
+            bag_map = mmap.mmap(bag_file.fileno(), 0, access=mmap.ACCESS_READ)
+
+        buffers = [bytearray(bag_bytes), memoryview(bag_bytes), np.frombuffer(bag_bytes, dtype=np.uint8)]
+        # Python 2 strs are paths, and its mmaps don't support the buffer protocol
+        if sys.version_info[0] >= 3:
+            buffers += [bag_bytes, bag_map]
+
+        for buffer in buffers:
+            self.view = embag.View(embag.Bag(buffer))
+            self.testViewMessages()
+            self.testTopicsInView()
+
+        # The bag keeps its buffer alive
+        bag = embag.Bag(bytearray(bag_bytes))
+        self.assertEqual(set(bag.topics()), self.known_topics)
+
+        self.assertRaises(RuntimeError, embag.Bag, bag_bytes, len(bag_bytes) + 1)
+        self.assertEqual(set(embag.Bag(u'test/test.bag').topics()), self.known_topics)
+
     def testBufferInfo(self):
         for msg in self.view.getMessages('/base_pose_ground_truth'):
             covariance_array = msg.data()['pose']['covariance']
@@ -232,6 +444,19 @@ class EmbagTest(unittest.TestCase):
                 msg.data()['data'].dict(),
             )
 
+    def testDictMatchesParsedValues(self):
+        # Message dicts are built straight from the raw message, and must match those built from the parsed values
+        for msg in self.view.getMessages():
+            np.testing.assert_equal(msg.dict(), msg.data().dict())
+            np.testing.assert_equal(
+                msg.dict(array_blob_types={embag.RosValueType.float32, embag.RosValueType.float64}, ros_time_py_type=int),
+                msg.data().dict(array_blob_types={embag.RosValueType.float32, embag.RosValueType.float64}, ros_time_py_type=int),
+            )
+
+        for msg in self.view.getMessages('/luminar_pointcloud'):
+            self.assertEqual(list(msg.dict().keys()), list(self.known_pointcloud_schema.keys()))
+            self.assertEqual(list(msg.dict()['header'].keys()), ['seq', 'stamp', 'frame_id'])
+
     def testROSTimeDicting(self):
         for msg in self.view.getMessages('/base_pose_ground_truth'):
             assert isinstance(msg.dict()['header']['stamp'], embag.RosTime)
@@ -252,7 +477,101 @@ class EmbagTest(unittest.TestCase):
             raw_messages = pickle.load(raw_messages_file)
 
         for index, msg in enumerate(self.view.getMessages()):
-            assert raw_messages[index] == msg.raw_data
+            # A view of the chunk the message was read from, which stays valid after the message is gone
+            raw_data = msg.raw_data
+            self.assertIsInstance(raw_data, memoryview)
+            self.assertTrue(raw_data.readonly)
+            del msg
+            assert raw_messages[index] == raw_data.tobytes()
+
+    def testReadRaw(self):
+        messages = [(msg.timestamp.to_nsec(), msg.raw_data.tobytes()) for msg in self.view.getMessages('/base_scan')]
+        timestamps, data, offsets = self.view.readRaw('/base_scan', threads=2)
+        self.assertIsInstance(data, memoryview)
+        self.assertEqual(list(timestamps), [timestamp for timestamp, _ in messages])
+        self.assertEqual(len(offsets), len(messages) + 1)
+        for i, (_, raw_data) in enumerate(messages):
+            self.assertEqual(data[offsets[i]:offsets[i + 1]].tobytes(), raw_data)
+
+        self.assertRaises(RuntimeError, self.view.readRaw, '/not_a_topic')
+
+    def testRawReadMessages(self):
+        with open('test/test_bag_raw_messages.P', 'rb') as raw_messages_file:
+            raw_messages = pickle.load(raw_messages_file)
+
+        count = 0
+        for index, (topic, raw, t) in enumerate(self.bag.read_messages(raw=True)):
+            datatype, data, md5sum, position, pytype = raw
+            self.assertEqual(datatype, self.known_connections[topic]['type'])
+            self.assertEqual(md5sum, self.known_connections[topic]['md5sum'])
+            self.assertIsInstance(data, memoryview)
+            self.assertEqual(data.tobytes(), raw_messages[index])
+            # rosbag's position of a message in a 2.0 bag: its chunk, and its record's offset in the chunk
+            chunk_position, offset = position
+            self.assertGreater(chunk_position, 0)
+            if index == 0:
+                self.assertEqual(position, (4117, 2497))
+            if index == 5:
+                self.assertEqual(topic, '/base_scan')
+                self.assertEqual(position, (3823880, 2340))
+            self.assertIsNone(pytype)
+            count += 1
+        self.assertEqual(count, len(raw_messages))
+
+    def testRecordClasses(self):
+        for msg in self.view.getMessages('/base_pose_ground_truth'):
+            data = msg.dict()
+            record = msg.record()
+            self.assertEqual(record._type, 'nav_msgs/Odometry')
+            self.assertEqual(record.__slots__, tuple(data.keys()))
+            self.assertEqual(record.header.seq, data['header']['seq'])
+            self.assertEqual(record.header.stamp.to_nsec(), data['header']['stamp'].to_nsec())
+            self.assertEqual(record.header._type, 'std_msgs/Header')
+            self.assertEqual(record.pose.pose.position.x, data['pose']['pose']['position']['x'])
+            self.assertEqual(record.pose.covariance, data['pose']['covariance'])
+            self.assertEqual(record.child_frame_id, data['child_frame_id'])
+
+            # The classes are generated once per type
+            self.assertIs(type(record), type(msg.record(ros_time_py_type=int)))
+            self.assertEqual(msg.record(ros_time_py_type=int).header.stamp, data['header']['stamp'].to_nsec())
+            self.assertEqual(record, msg.record())
+            self.assertTrue(repr(record).startswith('Odometry(header=Header(seq='))
+
+            # Records can be changed like rospy messages, but only have their fields
+            record.header.frame_id = 'map'
+            self.assertEqual(record.header.frame_id, 'map')
+            self.assertNotEqual(record, msg.record())
+            self.assertFalse(hasattr(record, '__dict__'))
+            with self.assertRaises(AttributeError):
+                record.header.frame = 'map'
+
+        # Types embedded in several messages share one class
+        odometry = next(iter(self.view.getMessages('/base_pose_ground_truth'))).record()
+        scan = next(iter(self.view.getMessages('/base_scan'))).record()
+        self.assertIs(type(odometry.header), type(scan.header))
+
+    def testRecordReadMessages(self):
+        count = 0
+        for topic, msg, t in self.bag.read_messages(topics=['/base_scan'], records=True):
+            self.assertEqual(msg._type, 'sensor_msgs/LaserScan')
+            self.assertEqual(msg.header.frame_id, 'base_laser_link')
+            self.assertIsInstance(msg.ranges, list)
+            count += 1
+        self.assertGreater(count, 0)
+
+        self.assertRaises(RuntimeError, self.bag.read_messages, raw=True, records=True)
+
+    def testLazyReadMessages(self):
+        for topic, msg, t in self.bag.read_messages(topics=['/base_scan']):
+            # Available without parsing the message
+            self.assertEqual(msg._type, 'sensor_msgs/LaserScan')
+            self.assertEqual(msg._md5sum, self.known_connections[topic]['md5sum'])
+            self.assertRaises(AttributeError, getattr, msg, '_not_a_field')
+
+            self.assertEqual(msg.header.frame_id, 'base_laser_link')
+            self.assertEqual(msg['header']['frame_id'], 'base_laser_link')
+            self.assertEqual(len(msg), len(list(msg.keys())))
+            self.assertEqual(msg.dict()['scan_time'], 0.0)
 
 if __name__ == "__main__":
     unittest.main()